@@ -0,0 +1,185 @@
+#include "LzCodec.h"
+
+#include <cstring>
+
+/**
+ * @brief Load 4 bytes without alignment requirements.
+ **/
+static uint32_t load32(const char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief Write a length past the 15 a token nibble holds: 255 per byte, then the rest.
+ **/
+static bool putLength(char *&op, char *end, size_t length) {
+    for(; length >= 255; length -= 255) {
+        if(op >= end) {
+            return false;
+        }
+        *op++ = (char)255;
+    }
+
+    if(op >= end) {
+        return false;
+    }
+    *op++ = (char)length;
+
+    return true;
+}
+
+/**
+ * @brief Read a length continued past a token nibble.
+ **/
+static bool getLength(const uint8_t *&ip, const uint8_t *end, size_t &length) {
+    uint8_t byte;
+    do {
+        if(ip >= end) {
+            return false;
+        }
+        byte = *ip++;
+        length += byte;
+    } while(byte == 255);
+
+    return true;
+}
+
+size_t LzCodec::bound(size_t length) {
+    /** incompressible data costs one extra byte every 255 literals, plus a token */
+    return length + length / 255 + 16;
+}
+
+uint32_t LzCodec::hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+bool LzCodec::emit(char *&op, char *end, const char *anchor, size_t literals,
+        size_t offset, size_t matchLength) {
+    if(op >= end) {
+        return false;
+    }
+
+    size_t extra = matchLength ? matchLength - MIN_MATCH : 0;
+    char *token = op++;
+    *token = (char)(((literals < 15 ? literals : 15) << 4) | (extra < 15 ? extra : 15));
+
+    if(literals >= 15 && !putLength(op, end, literals - 15)) {
+        return false;
+    }
+
+    if((size_t)(end - op) < literals) {
+        return false;
+    }
+    memcpy(op, anchor, literals);
+    op += literals;
+
+    if(!matchLength) {
+        return true;
+    }
+
+    if(end - op < 2) {
+        return false;
+    }
+    *op++ = (char)(offset & 0xff);
+    *op++ = (char)(offset >> 8);
+
+    return extra < 15 || putLength(op, end, extra - 15);
+}
+
+size_t LzCodec::compress(const char *source, size_t length, char *target, size_t capacity) {
+    uint32_t table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    char *op = target;
+    char *end = target + capacity;
+    size_t anchor = 0;
+    size_t i = 0;
+
+    while(i + MIN_MATCH <= length) {
+        uint32_t sequence = load32(source + i);
+        uint32_t slot = hash(sequence);
+        size_t candidate = table[slot];
+        table[slot] = (uint32_t)i;
+
+        /** a stale or colliding slot is caught by comparing the bytes themselves */
+        if(candidate >= i || i - candidate > MAX_OFFSET || load32(source + candidate) != sequence) {
+            /** the longer nothing matches, the faster the search skips ahead */
+            i += 1 + ((i - anchor) >> 6);
+            continue;
+        }
+
+        size_t matchLength = MIN_MATCH;
+        while(i + matchLength < length && source[candidate + matchLength] == source[i + matchLength]) {
+            matchLength++;
+        }
+
+        if(!emit(op, end, source + anchor, i - anchor, i - candidate, matchLength)) {
+            return 0;
+        }
+
+        i += matchLength;
+        anchor = i;
+    }
+
+    /** the stream ends with whatever is left as literals */
+    if(anchor < length && !emit(op, end, source + anchor, length - anchor, 0, 0)) {
+        return 0;
+    }
+
+    return op - target;
+}
+
+size_t LzCodec::decompress(const char *source, size_t length, char *target, size_t capacity) {
+    const uint8_t *ip = (const uint8_t *)source;
+    const uint8_t *inputEnd = ip + length;
+    char *op = target;
+    char *outputEnd = target + capacity;
+
+    while(ip < inputEnd) {
+        uint8_t token = *ip++;
+
+        size_t literals = token >> 4;
+        if(literals == 15 && !getLength(ip, inputEnd, literals)) {
+            return 0;
+        }
+
+        if((size_t)(inputEnd - ip) < literals || (size_t)(outputEnd - op) < literals) {
+            return 0;
+        }
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        /** only the last sequence stops after its literals */
+        if(ip == inputEnd) {
+            break;
+        }
+
+        if(inputEnd - ip < 2) {
+            return 0;
+        }
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+
+        size_t matchLength = token & 15;
+        if(matchLength == 15 && !getLength(ip, inputEnd, matchLength)) {
+            return 0;
+        }
+        matchLength += MIN_MATCH;
+
+        if(offset == 0 || offset > (size_t)(op - target) || (size_t)(outputEnd - op) < matchLength) {
+            return 0;
+        }
+
+        /** a match may overlap the bytes it produces, so it is copied forward byte by byte */
+        const char *match = op - offset;
+        for(size_t k = 0; k < matchLength; k++) {
+            op[k] = match[k];
+        }
+        op += matchLength;
+    }
+
+    return op - target;
+}
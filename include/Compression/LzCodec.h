@@ -0,0 +1,51 @@
+#ifndef LZ_CODEC_H
+#define LZ_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Byte-oriented LZ77 codec for Data Blocks, in the spirit of LZ4: no entropy coding,
+ * @brief so both ways run at memory speed.
+ * @brief A stream is a run of sequences: a token, literals copied as they are, then a match
+ * @brief copied from up to 64 KiB back. The last sequence has literals only.
+ **/
+class LzCodec
+{
+public:
+    /**
+     * @brief Largest stream compress() can produce from length bytes.
+     **/
+    static size_t bound(size_t length);
+
+    /**
+     * @brief Compress length bytes of source into target.
+     * @return The size of the stream, 0 if it does not fit in capacity bytes.
+     **/
+    static size_t compress(const char *source, size_t length, char *target, size_t capacity);
+
+    /**
+     * @brief Expand a stream of length bytes into target.
+     * @return The number of bytes restored, 0 if the stream is corrupt or overflows capacity.
+     **/
+    static size_t decompress(const char *source, size_t length, char *target, size_t capacity);
+
+private:
+    /* Shortest match worth a sequence, and the farthest one a 16-bit offset reaches */
+    const static size_t MIN_MATCH = 4;
+    const static size_t MAX_OFFSET = 65535;
+
+    /* Positions remembered by the match finder, one per hash of 4 bytes */
+    const static uint32_t HASH_BITS = 12;
+
+    static uint32_t hash(uint32_t sequence);
+
+    /**
+     * @brief Append a sequence of literals from anchor and, when matchLength is not 0, a match.
+     * @return false if it does not fit between op and end.
+     **/
+    static bool emit(char *&op, char *end, const char *anchor, size_t literals,
+        size_t offset, size_t matchLength);
+};
+
+#endif
@@ -0,0 +1,100 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(size_t threads) {
+    if (threads == 0) {
+        unsigned cores = std::thread::hardware_concurrency();
+        threads = cores > 1 ? cores - 1 : 0;
+    }
+
+    task = NULL;
+    count = next = pending = generation = 0;
+    stopping = false;
+
+    for (size_t i = 0; i < threads; i++) {
+        workers.push_back(std::thread(&ThreadPool::work, this));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::run(size_t count, const Task &task) {
+    if (count == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> batch(batchLock);
+    std::unique_lock<std::mutex> guard(lock);
+    this->task = &task;
+    this->count = count;
+    next = 0;
+    pending = count;
+    error = std::exception_ptr();
+    generation++;
+    wake.notify_all();
+
+    drain(guard);
+    finished.wait(guard, [this] { return pending == 0; });
+
+    this->task = NULL;
+    std::exception_ptr failure = error;
+    error = std::exception_ptr();
+    guard.unlock();
+
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+}
+
+void ThreadPool::work() {
+    size_t seen = 0;
+    std::unique_lock<std::mutex> guard(lock);
+
+    while (true) {
+        wake.wait(guard, [this, seen] { return stopping || (task != NULL && generation != seen); });
+        if (stopping) {
+            return;
+        }
+
+        seen = generation;
+        drain(guard);
+    }
+}
+
+void ThreadPool::drain(std::unique_lock<std::mutex> &guard) {
+    while (task != NULL && next < count) {
+        size_t index = next++;
+        const Task &current = *task;
+        guard.unlock();
+
+        std::exception_ptr failure;
+        try {
+            current(index);
+        } catch (...) {
+            failure = std::current_exception();
+        }
+
+        guard.lock();
+        if (failure && !error) {
+            error = failure;
+        }
+
+        if (--pending == 0) {
+            finished.notify_all();
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdlib.h>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fixed set of worker threads running batches of indexed tasks.
+ * @brief The caller of run() works on the batch too and returns once all of it is done.
+ **/
+class ThreadPool {
+public:
+    typedef std::function<void(size_t index)> Task;
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wake;       // A batch was posted or the pool is stopping
+    std::condition_variable finished;   // The last task of a batch is done
+
+    /** Batch being run, guarded by lock */
+    const Task* task;
+    size_t count;
+    size_t next;                        // Next index to hand out
+    size_t pending;                     // Indexes not done yet
+    size_t generation;                  // Counts batches, so a worker joins each one once
+    std::exception_ptr error;           // First exception thrown by a task
+    bool stopping;
+
+    /** Only one batch runs at a time */
+    std::mutex batchLock;
+
+    void work();
+
+    /**
+     * @brief Run indexes of the current batch until none is left.
+    **/
+    void drain(std::unique_lock<std::mutex> &guard);
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+public:
+    /**
+     * @brief Start threads workers besides the caller, one per core but the caller's when 0.
+    **/
+    explicit ThreadPool(size_t threads = 0);
+
+    ~ThreadPool();
+
+    /**
+     * @brief Pool shared by the whole process.
+    **/
+    static ThreadPool& shared();
+
+    /**
+     * @brief Number of threads running a batch, the caller included.
+    **/
+    size_t size() const { return workers.size() + 1; }
+
+    /**
+     * @brief Call task(i) for every i in [0, count) over the workers and the caller.
+     * @exception Rethrows the first exception thrown by a task, once the batch is over.
+    **/
+    void run(size_t count, const Task &task);
+};
+
+#endif
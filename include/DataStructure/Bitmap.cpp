@@ -0,0 +1,229 @@
+#include "Bitmap.h"
+#include <algorithm>
+
+static const uint64_t FULL = ~(uint64_t)0;
+
+Bitmap::Bitmap(size_t bits) {
+    resize(bits);
+}
+
+void Bitmap::resize(size_t bits) {
+    this->bits = bits;
+    used = 0;
+    cursor = 0;
+    levels.clear();
+
+    /** Bits past the end are set, so they never look free and a last partial word can fill up */
+    size_t count = bits;
+    do {
+        size_t words = std::max((size_t)1, (count + 63) / 64);
+        std::vector<uint64_t> level(words, 0);
+        if (count % 64) {
+            level[words - 1] = FULL << (count % 64);
+        } else if (count == 0) {
+            level[0] = FULL;
+        }
+
+        levels.push_back(level);
+        count = words;
+    } while (count > 1);
+}
+
+void Bitmap::set(size_t bit) {
+    if (bit >= bits || test(bit)) {
+        return;
+    }
+
+    used++;
+
+    /** Mark the word full one level up whenever it fills */
+    for (size_t level = 0; level < levels.size(); level++) {
+        uint64_t &word = levels[level][bit / 64];
+        word |= (uint64_t)1 << (bit % 64);
+        if (word != FULL) {
+            return;
+        }
+
+        bit /= 64;
+    }
+}
+
+void Bitmap::reset(size_t bit) {
+    if (bit >= bits || !test(bit)) {
+        return;
+    }
+
+    used--;
+
+    /** A word that was full is no longer, so its summary bit clears too */
+    for (size_t level = 0; level < levels.size(); level++) {
+        uint64_t &word = levels[level][bit / 64];
+        bool wasFull = word == FULL;
+        word &= ~((uint64_t)1 << (bit % 64));
+        if (!wasFull) {
+            return;
+        }
+
+        bit /= 64;
+    }
+}
+
+size_t Bitmap::count(size_t from, size_t to) const {
+    to = std::min(to, bits);
+    size_t total = 0;
+
+    while (from < to) {
+        size_t word = from / 64;
+        uint64_t mask = FULL << (from % 64);
+        if (to < (word + 1) * 64) {
+            mask &= ~(FULL << (to % 64));
+        }
+
+        total += __builtin_popcountll(levels[0][word] & mask);
+        from = (word + 1) * 64;
+    }
+
+    return total;
+}
+
+void Bitmap::assign(const uint64_t *words, size_t count) {
+    std::vector<uint64_t> &bottom = levels[0];
+    size_t last = bottom.size() - 1;
+    uint64_t padding = bottom[last] & (bits % 64 ? FULL << (bits % 64) : (bits ? 0 : FULL));
+
+    std::fill(bottom.begin(), bottom.end(), 0);
+    std::copy(words, words + std::min(count, bottom.size()), bottom.begin());
+    bottom[last] |= padding;
+
+    rebuild();
+}
+
+void Bitmap::rebuild() {
+    const std::vector<uint64_t> &bottom = levels[0];
+    size_t last = bottom.size() - 1;
+    uint64_t padding = bits % 64 ? FULL << (bits % 64) : (bits ? 0 : FULL);
+
+    used = 0;
+    for (size_t word = 0; word < bottom.size(); word++) {
+        used += __builtin_popcountll(bottom[word]);
+    }
+    used -= __builtin_popcountll(bottom[last] & padding);
+
+    /** Summaries are built bottom up, padding past the words below counts as full */
+    for (size_t level = 1; level < levels.size(); level++) {
+        const std::vector<uint64_t> &below = levels[level - 1];
+        std::vector<uint64_t> &summary = levels[level];
+        std::fill(summary.begin(), summary.end(), 0);
+
+        size_t entries = below.size();
+        if (entries % 64) {
+            summary[summary.size() - 1] = FULL << (entries % 64);
+        }
+
+        for (size_t word = 0; word < entries; word++) {
+            if (below[word] == FULL) {
+                summary[word / 64] |= (uint64_t)1 << (word % 64);
+            }
+        }
+    }
+}
+
+size_t Bitmap::findClear(size_t level, size_t from) const {
+    const std::vector<uint64_t> &words = levels[level];
+    size_t word = from / 64;
+    if (word >= words.size()) {
+        return npos;
+    }
+
+    uint64_t clear = ~words[word] & (FULL << (from % 64));
+    if (!clear) {
+        /** Ask the summary for the next word that is not full */
+        if (level + 1 == levels.size()) {
+            return npos;
+        }
+
+        word = findClear(level + 1, word + 1);
+        if (word == npos) {
+            return npos;
+        }
+        clear = ~words[word];
+    }
+
+    return word * 64 + __builtin_ctzll(clear);
+}
+
+size_t Bitmap::findSet(size_t from, size_t to) const {
+    while (from < to) {
+        size_t word = from / 64;
+        uint64_t set = levels[0][word] & (FULL << (from % 64));
+        if (set) {
+            return std::min(to, word * 64 + __builtin_ctzll(set));
+        }
+        from = (word + 1) * 64;
+    }
+
+    return to;
+}
+
+size_t Bitmap::findRun(size_t count, size_t from, size_t to) const {
+    while (true) {
+        size_t bit = find(from, to);
+        if (bit == npos || count > to - bit) {
+            return npos;
+        }
+
+        size_t end = findSet(bit, bit + count);
+        if (end == bit + count) {
+            return bit;
+        }
+        from = end + 1;
+    }
+}
+
+size_t Bitmap::find(size_t from, size_t to) const {
+    size_t bit = findClear(0, from);
+    return bit < std::min(to, bits) ? bit : npos;
+}
+
+size_t Bitmap::allocate(size_t lower, size_t upper) {
+    upper = std::min(upper, bits);
+    size_t start = cursor >= lower && cursor < upper ? cursor : lower;
+
+    size_t bit = find(start, upper);
+    if (bit == npos) {
+        bit = find(lower, start);
+    }
+
+    if (bit == npos) {
+        return npos;
+    }
+
+    set(bit);
+    cursor = bit + 1;
+    return bit;
+}
+
+size_t Bitmap::allocateRun(size_t count, size_t lower, size_t upper) {
+    upper = std::min(upper, bits);
+    if (count == 0 || lower >= upper || count > upper - lower) {
+        return npos;
+    }
+
+    size_t start = cursor >= lower && cursor < upper ? cursor : lower;
+
+    /** Runs starting before the cursor may still reach past it */
+    size_t first = findRun(count, start, upper);
+    if (first == npos) {
+        first = findRun(count, lower, std::min(upper, start + count - 1));
+    }
+
+    if (first == npos) {
+        return npos;
+    }
+
+    for (size_t bit = first; bit < first + count; bit++) {
+        set(bit);
+    }
+    cursor = first + count;
+    return first;
+}
@@ -0,0 +1,117 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * @brief Hierarchical bitmap of used blocks, one bit per block (set means in use).
+ * @brief Each summary level holds one bit per word of the level below, set when that word is full,
+ * @brief so the next free bit is found with one count-trailing-zeros step per level.
+ **/
+class Bitmap {
+public:
+    /** Returned when no free bit is found */
+    static const size_t npos = (size_t)-1;
+
+private:
+    /** levels[0] holds the bits themselves; the last level is a single word */
+    std::vector<std::vector<uint64_t> > levels;
+    size_t bits;
+    size_t used;
+
+    /** Next-fit position: where the last allocation ended */
+    size_t cursor;
+
+    /**
+     * @brief Find the first clear bit at or after from in a level.
+    **/
+    size_t findClear(size_t level, size_t from) const;
+
+    /**
+     * @brief Find the first set bit in [from, to), or to if there is none.
+    **/
+    size_t findSet(size_t from, size_t to) const;
+
+    /**
+     * @brief Find count contiguous clear bits lying in [from, to).
+    **/
+    size_t findRun(size_t count, size_t from, size_t to) const;
+
+public:
+    explicit Bitmap(size_t bits = 0);
+
+    /**
+     * @brief Hold bits bits, all clear, and rewind the cursor.
+    **/
+    void resize(size_t bits);
+
+    size_t size() const { return bits; }
+
+    /**
+     * @brief Number of set bits.
+    **/
+    size_t count() const { return used; }
+
+    /**
+     * @brief Number of set bits in [from, to).
+    **/
+    size_t count(size_t from, size_t to) const;
+
+    /**
+     * @brief The bits as 64-bit words, bit i being bit i % 64 of word i / 64, for storing them.
+    **/
+    const uint64_t* words() const { return levels[0].data(); }
+
+    size_t wordCount() const { return levels[0].size(); }
+
+    /**
+     * @brief Replace every bit by count words laid out as words() and rebuild the summaries.
+     * @brief Missing words read as clear, bits past the end stay set.
+    **/
+    void assign(const uint64_t *words, size_t count);
+
+    /**
+     * @brief Set a bit, safe from several threads at once.
+     * @brief Only the bits themselves change: count() and find() are stale until rebuild().
+    **/
+    void mark(size_t bit) {
+        if (bit < bits) {
+            __atomic_fetch_or(&levels[0][bit / 64], (uint64_t)1 << (bit % 64), __ATOMIC_RELAXED);
+        }
+    }
+
+    /**
+     * @brief Recount the set bits and rebuild the summary levels from the bits.
+    **/
+    void rebuild();
+
+    bool test(size_t bit) const {
+        return (levels[0][bit / 64] >> (bit % 64)) & 1;
+    }
+
+    void set(size_t bit);
+
+    void reset(size_t bit);
+
+    /**
+     * @brief Find the first clear bit in [from, to).
+     * @return npos if every bit is set.
+    **/
+    size_t find(size_t from, size_t to) const;
+
+    /**
+     * @brief Set a clear bit of [lower, upper), searching next-fit from the cursor and wrapping once.
+     * @return The bit, or npos if the range is full.
+    **/
+    size_t allocate(size_t lower, size_t upper);
+
+    /**
+     * @brief Set a run of count contiguous clear bits of [lower, upper), next-fit from the cursor.
+     * @return The first bit of the run, or npos if no run is long enough.
+    **/
+    size_t allocateRun(size_t count, size_t lower, size_t upper);
+};
+
+#endif
@@ -0,0 +1,53 @@
+#include "Block.h"
+#include "VolumeEmulator/BufferPool.h"
+#include <string.h>
+
+Block::Block(size_t size) {
+    length = size;
+    data = BufferPool::shared().acquire(length);
+    bind();
+}
+
+Block::Block(const Block &other) {
+    length = other.length;
+    data = BufferPool::shared().acquire(length);
+    memcpy(data, other.data, length);
+    bind();
+}
+
+Block::Block(Block &&other) {
+    length = other.length;
+    data = other.data;
+    bind();
+
+    other.data = NULL;
+    other.bind();
+}
+
+Block& Block::operator=(const Block &other) {
+    if (this == &other) {
+        return *this;
+    }
+
+    if (length != other.length) {
+        BufferPool::shared().release(data, length);
+        length = other.length;
+        data = BufferPool::shared().acquire(length);
+        bind();
+    }
+    memcpy(data, other.data, length);
+
+    return *this;
+}
+
+Block::~Block() {
+    BufferPool::shared().release(data, length);
+}
+
+void Block::bind() {
+    metaBlock = (struct MetaBlock*)data;
+    pointers = (uint32_t*)data;
+    extents = (struct Extent*)data;
+    directories = (struct Directory*)data;
+    fingerprints = (struct Fingerprint*)data;
+}
@@ -1,21 +1,57 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
 #include <iostream>
 #include <stdint.h>
 
 #include "Config.h"
 #include "VolumeEmulator/Volume.h"
 #include "Directory.h"
+#include "Fingerprint.h"
 #include "MetaBlock.h"
 #include "Inode.h"
+#include "Geometry.h"
 
 /**
  * @brief Block is primary structure in Volume layout.
  * @brief There are 4 types: MetaBlock, InodeBlock, DataBlock, DirectoryBlock.
+ * @brief Volumes with deduplication also have Fingerprint Blocks.
+ * @brief Its buffer is page-aligned and borrowed from BufferPool, so it can go
+ * @brief straight to an O_DIRECT volume. Every view below points into that buffer.
+ * @brief The size is the block size of the volume, see Geometry.
+ * @brief Inode Blocks have no view: their slots are Geometry::inodeSize bytes, not always sizeof(Inode).
  **/
-union Block
+class Block
 {
-    struct MetaBlock metaBlock;
-    struct Inode inodes[Config::INODES_PER_BLOCK];
-    uint32_t pointers[Config::POINTERS_PER_BLOCK];
-    char data[Config::BLOCK_SIZE];
-    struct Directory directories[Config::DIR_PER_BLOCK];
-};
\ No newline at end of file
+public:
+    char *data;
+    struct MetaBlock *metaBlock;
+    uint32_t *pointers;
+    struct Extent *extents;
+    struct Directory *directories;
+    struct Fingerprint *fingerprints;
+
+    explicit Block(size_t size);
+
+    Block(const Block &other);
+
+    Block(Block &&other);
+
+    Block& operator=(const Block &other);
+
+    ~Block();
+
+    size_t size() const { return length; }
+
+private:
+    size_t length;
+
+    /** Point every view at data */
+    void bind();
+};
+
+/** The MetaBlock is read before the block size is known, so it must fit in the smallest block */
+static_assert(sizeof(MetaBlock) <= Config::BLOCK_SIZE, "MetaBlock does not fit in a block");
+static_assert(sizeof(Directory) <= Config::BLOCK_SIZE, "Directory does not fit in a block");
+
+#endif
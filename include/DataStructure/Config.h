@@ -6,20 +6,33 @@
 
 class Config {
 public:
-    /* Size of block: 512 byte */
+    /* Size of block: 512 byte, the default and smallest block size */
     const static size_t BLOCK_SIZE = 512;
 
+    /* Largest block size a volume can be formatted with */
+    const static size_t MAX_BLOCK_SIZE = 65536;
+
     /* Magic number */
     const static uint32_t MAGIC_NUMBER = 0xf0f03410;
-          
-    /* The number of inode in Inode Block */      
-    const static uint32_t INODES_PER_BLOCK = 16;
+
+    /* Size of an inode slot on new volumes, and of Inode in memory */
+    const static uint32_t INODE_SIZE = 128;
+
+    /* Size of the inode slots of volumes formatted before inodes could grow */
+    const static uint32_t COMPACT_INODE_SIZE = 32;
 
     /* The number of direct block in Inode */             
     const static uint32_t POINTERS_PER_INODE = 5;
 
-    /* The number of inode in indirect Inode Block */  
-    const static uint32_t POINTERS_PER_BLOCK = 128; 
+    /* The number of extents kept in an extent-mapped Inode */
+    const static uint32_t EXTENTS_PER_INODE = 2;
+
+    /* The number of direct blocks and of indirect tree levels in a tree-mapped Inode */
+    const static uint32_t TREE_DIRECT_POINTERS = 2;
+    const static uint32_t TREE_LEVELS = 3;
+
+    /* The number of file bytes compressed together on volumes formatted with compression */
+    const static size_t COMPRESSION_CLUSTER = 65536;
 
     /* The length of arbitary name */
     const static uint32_t NAME_SIZE = 16;
@@ -27,8 +40,30 @@ public:
     /* The number of entry in Directory Block */
     const static uint32_t ENTRIES_PER_DIR = 7;
 
-    /* The number of directory in Directory Block */
-    const static uint32_t DIR_PER_BLOCK = 8;
+    /* The number of blocks kept by the block cache of Volume */
+    const static size_t CACHE_BLOCKS = 1024;
+
+    /* The number of inodes kept by the inode cache of MyFS */
+    const static size_t INODE_CACHE = 4096;
+
+    /* The number of bytes moved by one batched read or write (1 MiB) */
+    const static size_t IO_BATCH_BYTES = 1048576;
+
+    /* The number of requests kept in flight by the io_uring backend */
+    const static size_t QUEUE_DEPTH = 64;
+
+    /* The number of bytes written to one image of a striped volume before moving to the next */
+    const static size_t STRIPE_UNIT = 65536;
+
+    /* The number of bytes read ahead by the first and by the longest sequential reads */
+    const static size_t READ_AHEAD_MIN = 16384;
+    const static size_t READ_AHEAD_MAX = 1048576;
+
+    /* The number of free aligned buffers of each size kept by the buffer pool */
+    const static size_t POOL_BUFFERS = 256;
+
+    /* The number of bytes a background scrub reads per second, unless told otherwise (8 MiB) */
+    const static size_t SCRUB_RATE = 8388608;
 };
 
 #endif
\ No newline at end of file
@@ -1,3 +1,6 @@
+#ifndef DIR_ENTRY_H
+#define DIR_ENTRY_H
+
 #include <iostream>
 #include <stdint.h>
 
@@ -11,4 +14,6 @@ struct DirEntry
     char name[Config::NAME_SIZE];
     uint32_t protect;
     char password[10];
-};
\ No newline at end of file
+};
+
+#endif
\ No newline at end of file
@@ -1,3 +1,6 @@
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
 #include <iostream>
 #include <stdint.h>
 
@@ -10,4 +13,6 @@ struct Directory
     uint32_t inumber;
     char name[Config::NAME_SIZE];
     struct DirEntry table[Config::ENTRIES_PER_DIR];
-};
\ No newline at end of file
+};
+
+#endif
\ No newline at end of file
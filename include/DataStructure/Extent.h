@@ -0,0 +1,17 @@
+#ifndef EXTENT_H
+#define EXTENT_H
+
+#include <iostream>
+#include <stdint.h>
+
+/**
+ * @brief Run of contiguous Data Blocks of a file.
+ * @brief The extents of a file follow each other in file order, without holes.
+ **/
+struct Extent 
+{
+    uint32_t start;
+    uint32_t length;
+};
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <iostream>
+#include <stdint.h>
+
+/**
+ * @brief Entry of the fingerprint index of a volume with deduplication:
+ * @brief the SHA-256 digest of a Data Block, where the block is and how many block pointers share it.
+ * @brief A Data Block without an entry has a single pointer to it.
+ **/
+struct Fingerprint 
+{
+    uint8_t digest[32];
+    uint32_t blockNumber;   // 0 for a free entry
+    uint32_t references;
+};
+
+#endif
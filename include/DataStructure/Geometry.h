@@ -0,0 +1,88 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <algorithm>
+#include <iostream>
+#include <stdint.h>
+
+#include "Config.h"
+#include "Directory.h"
+#include "Fingerprint.h"
+#include "Inode.h"
+
+/**
+ * @brief Layout derived from the block size recorded in the MetaBlock.
+ **/
+struct Geometry 
+{
+    /* Size of block in byte */
+    uint32_t blockSize;
+
+    /* Size of an inode slot in the inode table */
+    uint32_t inodeSize;
+
+    /* The number of inode in Inode Block */
+    uint32_t inodesPerBlock;
+
+    /* The number of bytes an inline inode holds, 0 with compact inodes */
+    uint32_t inlineBytes;
+
+    /* The number of pointer in indirect Inode Block */
+    uint32_t pointersPerBlock;
+
+    /* The number of directory in Directory Block */
+    uint32_t dirPerBlock;
+
+    /* The number of extent in Extent Block */
+    uint32_t extentsPerBlock;
+
+    /* The number of blocks of file data compressed together */
+    uint32_t clusterBlocks;
+
+    /* The number of entries of the fingerprint index in Fingerprint Block */
+    uint32_t fingerprintsPerBlock;
+
+    /* The number of block sums in Checksum Block */
+    uint32_t checksumsPerBlock;
+
+    /* The number of blocks a batched read or write moves with a single call */
+    uint32_t batchBlocks;
+
+    explicit Geometry(uint32_t blockSize = Config::BLOCK_SIZE, uint32_t inodeSize = Config::INODE_SIZE) 
+    {
+        this->blockSize = blockSize;
+        this->inodeSize = inodeSize;
+        inodesPerBlock = blockSize / inodeSize;
+        inlineBytes = inodeSize > Config::COMPACT_INODE_SIZE ? inodeSize - offsetof(Inode, inlineData) : 0;
+        pointersPerBlock = blockSize / sizeof(uint32_t);
+        dirPerBlock = blockSize / sizeof(Directory);
+        extentsPerBlock = blockSize / sizeof(Extent);
+        clusterBlocks = std::max((size_t)1, Config::COMPRESSION_CLUSTER / blockSize);
+        fingerprintsPerBlock = blockSize / sizeof(Fingerprint);
+        checksumsPerBlock = blockSize / sizeof(uint32_t);
+        batchBlocks = std::max((size_t)1, (size_t)Config::IO_BATCH_BYTES / blockSize);
+    }
+
+    /**
+     * @brief Check if a volume can be formatted with this block size.
+     **/
+    static bool isValid(size_t blockSize) 
+    {
+        return blockSize >= Config::BLOCK_SIZE 
+            && blockSize <= Config::MAX_BLOCK_SIZE
+            && (blockSize & (blockSize - 1)) == 0;
+    }
+
+    /**
+     * @brief Check if inode slots of inodeSize bytes fit Inode and blocks of blockSize bytes.
+     **/
+    static bool isValidInode(size_t inodeSize, size_t blockSize) 
+    {
+        return inodeSize >= Config::COMPACT_INODE_SIZE 
+            && inodeSize <= sizeof(Inode)
+            && inodeSize <= blockSize
+            && (inodeSize & (inodeSize - 1)) == 0;
+    }
+};
+
+#endif
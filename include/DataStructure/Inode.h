@@ -2,16 +2,81 @@
 #define INODE_H
 
 #include <iostream>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "Config.h"
+#include "Extent.h"
 
 struct Inode 
 {
-    uint32_t available;
+    /* Flag of an inode whose data is mapped by extents rather than block pointers */
+    const static uint16_t EXTENTS = 1;
+
+    /* Flag of a block-mapped inode with single, double and triple indirect blocks and a 64-bit size */
+    const static uint16_t TREE = 2;
+
+    /* Flag of an inode holding its data itself, in the rest of its slot */
+    const static uint16_t INLINE = 4;
+
+    /**
+     * Flag of a tree-mapped inode whose data is compressed by clusters of Geometry::clusterBlocks blocks.
+     * Cluster c takes the slots 2c and 2c + 1 of the trees: the first block of its run and the length of the run.
+     **/
+    const static uint16_t COMPRESSED = 8;
+
+    /* Set in the run length of a cluster that did not compress and is kept as it is */
+    const static uint32_t RAW_CLUSTER = 0x80000000;
+
+    uint16_t available;
+    uint16_t flags;
     uint32_t size;
-    uint32_t directBlocks[Config::POINTERS_PER_INODE];
-    uint32_t indirectBlock;
+
+    union {
+        /* Block-mapped: one pointer per Data Block */
+        struct {
+            uint32_t directBlocks[Config::POINTERS_PER_INODE];
+            uint32_t indirectBlock;
+        };
+
+        /* Extent-mapped: the first extents in the inode, the others in extentBlock */
+        struct {
+            Extent extents[Config::EXTENTS_PER_INODE];
+            uint32_t extentCount;
+            uint32_t extentBlock;
+        };
+
+        /* Tree-mapped: treeRoots[i] is the root of a tree of i + 1 levels of pointer blocks */
+        struct {
+            uint32_t treeDirect[Config::TREE_DIRECT_POINTERS];
+            uint32_t treeRoots[Config::TREE_LEVELS];
+            uint32_t sizeHigh;
+        };
+
+        /* Inline: the bytes of the file, as many as the inode slot of the volume has room for */
+        char inlineData[Config::INODE_SIZE - 8];
+    };
+
+    /**
+     * @brief Size in bytes, only tree-mapped inodes go past 32 bits.
+     **/
+    uint64_t fileSize() const {
+        return (flags & TREE) ? ((uint64_t)sizeHigh << 32) | size : size;
+    }
+
+    void setFileSize(uint64_t bytes) {
+        size = (uint32_t)bytes;
+        if (flags & TREE) {
+            sizeHigh = (uint32_t)(bytes >> 32);
+        }
+    }
 };
 
-#endif
\ No newline at end of file
+/** 
+ * available used to be a 32-bit word: flags is its upper half, 0 on block-mapped inodes.
+ * Every mapping fits in the first 32 bytes, the whole inode of volumes with compact inodes.
+ **/
+static_assert(offsetof(Inode, directBlocks) == 8 && offsetof(Inode, inlineData) == 8, "Inode layout changed");
+static_assert(sizeof(Inode) == Config::INODE_SIZE, "Inode does not fill its slot");
+
+#endif
@@ -13,6 +13,47 @@ struct MetaBlock
     uint32_t dirBlocks;
     uint32_t protect;
     char password[257];
+    uint32_t blockSize;     // 0 on volumes formatted before it was recorded: Config::BLOCK_SIZE
+
+    /** 
+     * Tail of the inode and directory tables left as holes by a lazy format, 
+     * counted in blocks. They read as empty and are initialized when first written.
+     **/
+    uint32_t uninitInodeBlocks;
+    uint32_t uninitDirBlocks;
+
+    /**
+     * Block and inode bitmaps stored right after the inode table, counted in blocks.
+     * Volumes formatted without them have 0 here and are scanned at every mount.
+     **/
+    uint32_t blockBitmapBlocks;
+    uint32_t inodeBitmapBlocks;
+
+    /** CLEAN once unmounted cleanly, when the stored bitmaps match the tables */
+    uint32_t state;
+
+    /** Size of an inode slot, 0 on volumes formatted with compact inodes */
+    uint32_t inodeSize;
+
+    /** Codec of the Data Blocks of new files, NONE on volumes formatted without compression */
+    uint32_t compression;
+
+    /**
+     * Fingerprint index stored right after the bitmaps, counted in blocks, one entry per block of the volume.
+     * Volumes formatted without deduplication have 0 here.
+     **/
+    uint32_t fingerprintBlocks;
+
+    /**
+     * CRC-32C table stored right after the fingerprint index, counted in blocks, one sum per block of the volume.
+     * Volumes formatted without it have 0 here and are not checked.
+     **/
+    uint32_t checksumBlocks;
+
+    const static uint32_t CLEAN = 0x434c454e;
+
+    const static uint32_t NONE = 0;
+    const static uint32_t LZ = 1;
 };
 
 #endif
\ No newline at end of file
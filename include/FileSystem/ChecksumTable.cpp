@@ -0,0 +1,39 @@
+#include "ChecksumTable.h"
+#include "HashMachine/Crc32c.h"
+
+void ChecksumTable::assign(const uint32_t *stored, size_t count, size_t blockSize, bool dirty) {
+    clear();
+    this->blockSize = blockSize;
+    perBlock = blockSize / sizeof(uint32_t);
+    sums.assign(stored, stored + count);
+
+    std::vector<char> empty(blockSize, 0);
+    emptySum = Crc32c::compute(empty.data(), blockSize);
+
+    for (size_t i = 0; dirty && i < count; i += perBlock) {
+        dirtyBlocks.insert(i / perBlock);
+    }
+}
+
+void ChecksumTable::clear() {
+    sums.clear();
+    dirtyBlocks.clear();
+}
+
+uint32_t ChecksumTable::sum(const char *data) const {
+    return Crc32c::compute(data, blockSize) ^ emptySum;
+}
+
+void ChecksumTable::set(uint32_t blockNumber, uint32_t sum) {
+    if (sums[blockNumber] == sum) {
+        return;
+    }
+
+    sums[blockNumber] = sum;
+    dirtyBlocks.insert(blockNumber / perBlock);
+}
+
+void ChecksumTable::takeDirty(std::vector<uint32_t> &out) {
+    out.assign(dirtyBlocks.begin(), dirtyBlocks.end());
+    dirtyBlocks.clear();
+}
@@ -0,0 +1,73 @@
+#ifndef CHECKSUM_TABLE_H
+#define CHECKSUM_TABLE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <set>
+#include <vector>
+
+/**
+ * @brief CRC-32C of every block of a volume, held whole in memory and stored in the Checksum Blocks.
+ * @brief A sum is the CRC of the block xor the CRC of an empty block, so a zeroed table
+ * @brief matches a zeroed volume and a lazy format only has to record the blocks it writes.
+ * @brief Like the Bitmap Blocks, a change only dirties the block holding it; the owner writes those back.
+ **/
+class ChecksumTable {
+private:
+    std::vector<uint32_t> sums;
+    size_t blockSize;
+    size_t perBlock;            // Sums in a Checksum Block
+    uint32_t emptySum;          // CRC of a block of zeros
+
+    /** Checksum Blocks, counted from the first one, changed since the last takeDirty */
+    std::set<uint32_t> dirtyBlocks;
+
+    ChecksumTable(const ChecksumTable&);
+    ChecksumTable& operator=(const ChecksumTable&);
+public:
+    ChecksumTable() : blockSize(0), perBlock(1), emptySum(0) {}
+
+    /**
+     * @brief Take count sums as stored in the Checksum Blocks of a volume of blockSize blocks.
+     * @param dirty Every Checksum Block is to be written back, the sums were counted again.
+     **/
+    void assign(const uint32_t *stored, size_t count, size_t blockSize, bool dirty = false);
+
+    /**
+     * @brief Drop every sum, for a volume without checksums.
+     **/
+    void clear();
+
+    bool empty() const { return sums.empty(); }
+
+    size_t size() const { return sums.size(); }
+
+    /**
+     * @brief Sum of a block holding data, blockSize bytes.
+     **/
+    uint32_t sum(const char *data) const;
+
+    uint32_t at(uint32_t blockNumber) const { return sums[blockNumber]; }
+
+    /**
+     * @brief Check data against the sum recorded for its block.
+     **/
+    bool verify(uint32_t blockNumber, const char *data) const { return sum(data) == sums[blockNumber]; }
+
+    /**
+     * @brief Record the sum of what a block now holds.
+     **/
+    void set(uint32_t blockNumber, uint32_t sum);
+
+    /**
+     * @brief Move out the Checksum Blocks changed since the last call, in order.
+     **/
+    void takeDirty(std::vector<uint32_t> &out);
+
+    /**
+     * @brief Sums as laid out in the Checksum Blocks.
+     **/
+    const uint32_t* data() const { return sums.data(); }
+};
+
+#endif
@@ -0,0 +1,102 @@
+#include "FingerprintIndex.h"
+#include <cstring>
+
+std::string FingerprintIndex::key(const uint8_t *digest) {
+    return std::string((const char *)digest, sizeof(((Fingerprint *)0)->digest));
+}
+
+void FingerprintIndex::changed(size_t entry) {
+    dirtyBlocks.insert(entry / perBlock);
+}
+
+void FingerprintIndex::assign(const Fingerprint *stored, size_t count, size_t perBlock) {
+    clear();
+    this->perBlock = perBlock;
+    entries.assign(stored, stored + count);
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (!entries[i].blockNumber) {
+            freeEntries.insert(i);
+            continue;
+        }
+
+        byDigest.insert(std::make_pair(key(entries[i].digest), i));
+        byBlock[entries[i].blockNumber] = i;
+    }
+}
+
+void FingerprintIndex::clear() {
+    entries.clear();
+    byDigest.clear();
+    byBlock.clear();
+    freeEntries.clear();
+    dirtyBlocks.clear();
+}
+
+ssize_t FingerprintIndex::find(const uint8_t *digest) const {
+    std::unordered_map<std::string, uint32_t>::const_iterator it = byDigest.find(key(digest));
+    return it == byDigest.end() ? -1 : (ssize_t)it->second;
+}
+
+ssize_t FingerprintIndex::findBlock(uint32_t blockNumber) const {
+    std::unordered_map<uint32_t, uint32_t>::const_iterator it = byBlock.find(blockNumber);
+    return it == byBlock.end() ? -1 : (ssize_t)it->second;
+}
+
+ssize_t FingerprintIndex::insert(const uint8_t *digest, uint32_t blockNumber) {
+    if (freeEntries.empty()) {
+        return -1;
+    }
+
+    size_t entry = *freeEntries.begin();
+    freeEntries.erase(freeEntries.begin());
+
+    memcpy(entries[entry].digest, digest, sizeof(entries[entry].digest));
+    entries[entry].blockNumber = blockNumber;
+    entries[entry].references = 1;
+
+    /** the first block found with a digest keeps it, a later one with the same data is only freed */
+    byDigest.insert(std::make_pair(key(digest), entry));
+    byBlock[blockNumber] = entry;
+    changed(entry);
+
+    return entry;
+}
+
+void FingerprintIndex::reference(size_t entry) {
+    entries[entry].references++;
+    changed(entry);
+}
+
+uint32_t FingerprintIndex::release(size_t entry) {
+    if (entries[entry].references > 1) {
+        entries[entry].references--;
+        changed(entry);
+        return entries[entry].references;
+    }
+
+    erase(entry);
+    return 0;
+}
+
+void FingerprintIndex::erase(size_t entry) {
+    std::unordered_map<std::string, uint32_t>::iterator it = byDigest.find(key(entries[entry].digest));
+    if (it != byDigest.end() && it->second == entry) {
+        byDigest.erase(it);
+    }
+    byBlock.erase(entries[entry].blockNumber);
+
+    memset(&entries[entry], 0, sizeof(Fingerprint));
+    freeEntries.insert(entry);
+    changed(entry);
+}
+
+void FingerprintIndex::setReferences(size_t entry, uint32_t references) {
+    entries[entry].references = references;
+    changed(entry);
+}
+
+void FingerprintIndex::takeDirty(std::vector<uint32_t> &out) {
+    out.assign(dirtyBlocks.begin(), dirtyBlocks.end());
+    dirtyBlocks.clear();
+}
@@ -0,0 +1,106 @@
+#ifndef FINGERPRINT_INDEX_H
+#define FINGERPRINT_INDEX_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "DataStructure/Fingerprint.h"
+
+/**
+ * @brief Fingerprint index of a volume with deduplication, held whole in memory.
+ * @brief Entries keep their slot in the Fingerprint Blocks, so a change only dirties the block holding it;
+ * @brief the owner writes those back, like the Bitmap Blocks.
+ **/
+class FingerprintIndex {
+private:
+    std::vector<Fingerprint> entries;
+    size_t perBlock;            // Entries in a Fingerprint Block
+
+    /** Entries in use by digest and by Data Block, free slots lowest first */
+    std::unordered_map<std::string, uint32_t> byDigest;
+    std::unordered_map<uint32_t, uint32_t> byBlock;
+    std::set<uint32_t> freeEntries;
+
+    /** Fingerprint Blocks, counted from the first one, changed since the last takeDirty */
+    std::set<uint32_t> dirtyBlocks;
+
+    static std::string key(const uint8_t *digest);
+
+    void changed(size_t entry);
+
+    FingerprintIndex(const FingerprintIndex&);
+    FingerprintIndex& operator=(const FingerprintIndex&);
+public:
+    FingerprintIndex() : perBlock(1) {}
+
+    /**
+     * @brief Take count entries as stored in the Fingerprint Blocks, perBlock to a block.
+     **/
+    void assign(const Fingerprint *stored, size_t count, size_t perBlock);
+
+    /**
+     * @brief Drop every entry, for a volume without deduplication.
+     **/
+    void clear();
+
+    size_t capacity() const { return entries.size(); }
+
+    size_t size() const { return byBlock.size(); }
+
+    const Fingerprint& at(size_t entry) const { return entries[entry]; }
+
+    /**
+     * @brief Entry of the Data Block holding data with this digest.
+     * @return -1 if there is none.
+     **/
+    ssize_t find(const uint8_t *digest) const;
+
+    /**
+     * @brief Entry of a Data Block.
+     * @return -1 if the block has none, it has a single pointer to it.
+     **/
+    ssize_t findBlock(uint32_t blockNumber) const;
+
+    /**
+     * @brief Record the digest of a Data Block with a single pointer to it.
+     * @return The entry, -1 if the index is full and the block stays out of it.
+     **/
+    ssize_t insert(const uint8_t *digest, uint32_t blockNumber);
+
+    /**
+     * @brief One more pointer shares the block of entry.
+     **/
+    void reference(size_t entry);
+
+    /**
+     * @brief One pointer less to the block of entry, the entry goes once none is left.
+     * @return The pointers left.
+     **/
+    uint32_t release(size_t entry);
+
+    /**
+     * @brief Drop entry whatever its references, its block is about to hold other data.
+     **/
+    void erase(size_t entry);
+
+    /**
+     * @brief Set the references of entry, when they are counted again from the files.
+     **/
+    void setReferences(size_t entry, uint32_t references);
+
+    /**
+     * @brief Move out the Fingerprint Blocks changed since the last call, in order.
+     **/
+    void takeDirty(std::vector<uint32_t> &out);
+
+    /**
+     * @brief Entries as laid out in the Fingerprint Blocks.
+     **/
+    const Fingerprint* data() const { return entries.data(); }
+};
+
+#endif
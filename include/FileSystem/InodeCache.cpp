@@ -0,0 +1,91 @@
+#include "InodeCache.h"
+#include <algorithm>
+
+InodeCache::InodeCache(size_t capacity) {
+    this->capacity = capacity;
+    dirtyCount = 0;
+}
+
+Inode* InodeCache::acquire(size_t inumber) {
+    std::unordered_map<size_t, std::list<Entry>::iterator>::iterator it = index.find(inumber);
+    if (it == index.end()) {
+        return NULL;
+    }
+
+    /** Move to the front as most recently used */
+    entries.splice(entries.begin(), entries, it->second);
+    it->second->references++;
+    return &it->second->inode;
+}
+
+Inode* InodeCache::insert(size_t inumber, const Inode &inode, bool dirty) {
+    std::unordered_map<size_t, std::list<Entry>::iterator>::iterator it = index.find(inumber);
+    if (it == index.end()) {
+        Entry entry;
+        entry.inumber = inumber;
+        entry.references = 0;
+        entry.dirty = false;
+        entries.push_front(entry);
+        it = index.insert(std::make_pair(inumber, entries.begin())).first;
+    } else {
+        entries.splice(entries.begin(), entries, it->second);
+    }
+
+    Entry &entry = *it->second;
+    entry.inode = inode;
+    entry.references++;
+    if (dirty && !entry.dirty) {
+        entry.dirty = true;
+        dirtyCount++;
+    }
+
+    return &entry.inode;
+}
+
+void InodeCache::release(size_t inumber, bool dirty) {
+    std::unordered_map<size_t, std::list<Entry>::iterator>::iterator it = index.find(inumber);
+    if (it == index.end()) {
+        return;
+    }
+
+    Entry &entry = *it->second;
+    if (entry.references > 0) {
+        entry.references--;
+    }
+
+    if (dirty && !entry.dirty) {
+        entry.dirty = true;
+        dirtyCount++;
+    }
+}
+
+void InodeCache::takeDirty(std::vector<std::pair<size_t, Inode> > &out) {
+    for (std::list<Entry>::iterator it = entries.begin(); it != entries.end() && dirtyCount > 0; ++it) {
+        if (it->dirty) {
+            out.push_back(std::make_pair(it->inumber, it->inode));
+            it->dirty = false;
+            dirtyCount--;
+        }
+    }
+
+    std::sort(out.begin(), out.end(), 
+        [](const std::pair<size_t, Inode> &a, const std::pair<size_t, Inode> &b) { return a.first < b.first; });
+}
+
+void InodeCache::trim() {
+    /** Walk from the tail, skipping what is still in use or not written back */
+    std::list<Entry>::iterator it = entries.end();
+    while (entries.size() > capacity && it != entries.begin()) {
+        --it;
+        if (it->references == 0 && !it->dirty) {
+            index.erase(it->inumber);
+            it = entries.erase(it);
+        }
+    }
+}
+
+void InodeCache::clear() {
+    entries.clear();
+    index.clear();
+    dirtyCount = 0;
+}
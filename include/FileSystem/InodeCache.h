@@ -0,0 +1,84 @@
+#ifndef INODE_CACHE_H
+#define INODE_CACHE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "DataStructure/Config.h"
+#include "DataStructure/Inode.h"
+
+/**
+ * @brief Inodes of the inode table kept in memory, keyed by inumber.
+ * @brief A referenced inode stays put; dirty ones wait to be written back by their owner,
+ * @brief which groups them by Inode Block.
+ **/
+class InodeCache {
+private:
+    struct Entry
+    {
+        size_t inumber;
+        Inode inode;
+        uint32_t references;
+        bool dirty;
+    };
+
+    size_t capacity;    // Inodes kept once unreferenced and clean
+    size_t dirtyCount;
+
+    /** Most recently used entry is in the front */
+    std::list<Entry> entries;
+    std::unordered_map<size_t, std::list<Entry>::iterator> index;
+
+    InodeCache(const InodeCache&);
+    InodeCache& operator=(const InodeCache&);
+public:
+    explicit InodeCache(size_t capacity = Config::INODE_CACHE);
+
+    size_t size() const { return entries.size(); }
+
+    /**
+     * @brief True when more inodes are held than the capacity.
+    **/
+    bool full() const { return entries.size() > capacity; }
+
+    size_t dirty() const { return dirtyCount; }
+
+    /**
+     * @brief Take a reference to a cached inode.
+     * @return NULL on a miss.
+    **/
+    Inode* acquire(size_t inumber);
+
+    /**
+     * @brief Cache an inode, replacing any cached copy, and take a reference to it.
+     * @param dirty The inode differs from the inode table.
+    **/
+    Inode* insert(size_t inumber, const Inode &inode, bool dirty);
+
+    /**
+     * @brief Drop a reference taken by acquire or insert.
+     * @param dirty The inode was changed through the reference.
+    **/
+    void release(size_t inumber, bool dirty);
+
+    /**
+     * @brief Copy every dirty inode into out, in inumber order, and count them as clean.
+    **/
+    void takeDirty(std::vector<std::pair<size_t, Inode> > &out);
+
+    /**
+     * @brief Drop unreferenced clean inodes, the least recently used first, down to the capacity.
+    **/
+    void trim();
+
+    /**
+     * @brief Drop everything, dirty inodes included.
+    **/
+    void clear();
+};
+
+#endif
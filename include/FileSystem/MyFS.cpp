@@ -1,92 +1,220 @@
 #include "MyFS.h"
+#include "Compression/LzCodec.h"
 #include "HashMachine/Hasher.h"
+#include "VolumeEmulator/BufferPool.h"
+#include "Concurrency/ThreadPool.h"
 
 #include <algorithm>
+#include <atomic>
 #include <string>
 #include <math.h>
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <iostream>
 
-bool MyFS::format(Volume *disk) {
-    if (disk->isMounted()) {
+/**
+ * @brief Fill a block with empty directories.
+ **/
+static void emptyDirectories(Block &block, const Geometry &geometry) {
+    Directory directory;
+    memset(&directory, 0, sizeof(Directory));
+    directory.inumber = -1;
+    directory.available = 0;
+
+    memset(block.data, 0, block.size());
+    for(uint32_t j = 0; j < geometry.dirPerBlock; j++) {
+        block.directories[j] = directory;
+    }
+}
+
+/**
+ * @brief Copy inode slot of an Inode Block into node, what a compact slot lacks reads as zeros.
+ **/
+static void loadSlot(const char *data, uint32_t slot, const Geometry &geometry, Inode &node) {
+    memset(&node, 0, sizeof(Inode));
+    memcpy(&node, data + (size_t)slot * geometry.inodeSize, geometry.inodeSize);
+}
+
+/**
+ * @brief Copy node into inode slot of an Inode Block, as much of it as the slot holds.
+ **/
+static void storeSlot(char *data, uint32_t slot, const Geometry &geometry, const Inode &node) {
+    memcpy(data + (size_t)slot * geometry.inodeSize, &node, geometry.inodeSize);
+}
+
+/**
+ * @brief Size of the inode table: a tenth of the volume, as long as inode numbers fit in 32 bits.
+ **/
+static uint32_t inodeTableBlocks(uint32_t blocks, const Geometry &geometry) {
+    uint64_t tenth = ((uint64_t)blocks + 9) / 10;
+    return (uint32_t)std::min(tenth, (uint64_t)(UINT32_MAX / geometry.inodesPerBlock));
+}
+
+/**
+ * @brief Size of the directory table: a hundredth of the volume.
+ **/
+static uint32_t directoryTableBlocks(uint32_t blocks) {
+    return (uint32_t)(((uint64_t)blocks + 99) / 100);
+}
+
+/**
+ * @brief Number of Fingerprint Blocks of a volume with deduplication, an entry for every block.
+ **/
+static uint32_t fingerprintTableBlocks(uint32_t blocks, const Geometry &geometry) {
+    return (uint32_t)(((uint64_t)blocks + geometry.fingerprintsPerBlock - 1) / geometry.fingerprintsPerBlock);
+}
+
+/**
+ * @brief Number of Checksum Blocks of a volume, a sum for every block.
+ **/
+static uint32_t checksumTableBlocks(uint32_t blocks, const Geometry &geometry) {
+    return (uint32_t)(((uint64_t)blocks + geometry.checksumsPerBlock - 1) / geometry.checksumsPerBlock);
+}
+
+/**
+ * @brief Number of blocks holding a bitmap of bits bits.
+ **/
+static uint32_t bitmapBlocks(uint64_t bits, const Geometry &geometry) {
+    uint64_t bitsPerBlock = (uint64_t)geometry.blockSize * 8;
+    return (uint32_t)((bits + bitsPerBlock - 1) / bitsPerBlock);
+}
+
+bool MyFS::format(Volume *disk, size_t blockSize, bool lazy, uint32_t compression, bool dedup) {
+    if (disk->isMounted() || !Geometry::isValid(blockSize) || compression > MetaBlock::LZ 
+        || (dedup && compression != MetaBlock::NONE)) 
+    {
         return false;
     } 
 
+    /** Geometry of the volume follows from the chosen block size */
+    disk->setBlockSize(blockSize);
+    Geometry geometry(blockSize);
+    if (disk->size() < 3) {
+        return false;
+    }
+
+    /** Block numbers are 32-bit on disk: a larger image is refused rather than losing its tail */
+    if (disk->size() > UINT32_MAX) {
+        uint64_t bytes = (uint64_t)disk->size() * blockSize;
+        size_t fits = blockSize;
+        while (fits <= Config::MAX_BLOCK_SIZE && bytes / fits > UINT32_MAX) {
+            fits *= 2;
+        }
+
+        if (fits <= Config::MAX_BLOCK_SIZE) {
+            fprintf(stderr, "[!] The image holds more than 2^32 blocks of %zu bytes, format it with blocks of %zu bytes or more\n", 
+                blockSize, fits);
+        } else {
+            fprintf(stderr, "[!] The image holds more than 2^32 blocks of any size\n");
+        }
+        return false;
+    }
+
     /** 
      * write Meta Block 
      **/
-    Block block;
-    memset(&block, 0, sizeof(Block));
-
-    block.metaBlock.magicNumber = Config::MAGIC_NUMBER;
-    block.metaBlock.blocks = (uint32_t)(disk->size());
-    block.metaBlock.inodeBlocks = (uint32_t)std::ceil((int(block.metaBlock.blocks) * 1.00)/10);
-    block.metaBlock.inodes = block.metaBlock.inodeBlocks * Config::INODES_PER_BLOCK;
-    block.metaBlock.dirBlocks = (uint32_t)std::ceil((int(block.metaBlock.blocks) * 1.00)/100);
-    block.metaBlock.protect = 0;
-    memset(block.metaBlock.password, 0, 257);
-
-    /** Write down Meta Block to volume **/
-    disk->writeBlock(0, block.data);
-
-    /** Clean all the blocks of Volume */
-    for(uint32_t i = 1; i <= block.metaBlock.inodeBlocks; i++){
-        Block inodeBlock;
-
-        /** First, clean each of Inodes */
-        for(uint32_t j = 0; j < Config::INODES_PER_BLOCK; j++){
-            inodeBlock.inodes[j].available = false;
-            inodeBlock.inodes[j].size = 0;
+    Block block(geometry.blockSize);
+    memset(block.data, 0, geometry.blockSize);
+
+    block.metaBlock->magicNumber = Config::MAGIC_NUMBER;
+    block.metaBlock->blocks = (uint32_t)disk->size();
+    block.metaBlock->inodeBlocks = inodeTableBlocks(block.metaBlock->blocks, geometry);
+    block.metaBlock->inodes = block.metaBlock->inodeBlocks * geometry.inodesPerBlock;
+    block.metaBlock->dirBlocks = directoryTableBlocks(block.metaBlock->blocks);
+    block.metaBlock->protect = 0;
+    memset(block.metaBlock->password, 0, 257);
+    block.metaBlock->blockSize = geometry.blockSize;
+    block.metaBlock->inodeSize = geometry.inodeSize;
+    block.metaBlock->compression = compression;
+
+    /** A lazy format leaves both tables to be initialized on first write, except the root block */
+    block.metaBlock->uninitInodeBlocks = lazy ? block.metaBlock->inodeBlocks : 0;
+    block.metaBlock->uninitDirBlocks = lazy ? block.metaBlock->dirBlocks - 1 : 0;
+
+    uint32_t blocks = block.metaBlock->blocks;
+    uint32_t dirBlocks = block.metaBlock->dirBlocks;
 
-            /** Clean all direct block pointers of Inode */
-            for(uint32_t k = 0; k < Config::POINTERS_PER_INODE; k++) {   
-                inodeBlock.inodes[j].directBlocks[k] = 0;
-            }
-    
-            /** Clean indirect block pointer of Inode */
-            inodeBlock.inodes[j].indirectBlock = 0;
+    /** 
+     * Allocation bitmaps follow the inode table when the volume has room for them.
+     * They start empty like the tables, so a new volume is clean.
+     **/
+    uint32_t blockBitmapBlocks = bitmapBlocks(blocks, geometry);
+    uint32_t inodeBitmapBlocks = bitmapBlocks(block.metaBlock->inodes, geometry);
+    if (1 + (uint64_t)block.metaBlock->inodeBlocks + blockBitmapBlocks + inodeBitmapBlocks < blocks - dirBlocks) {
+        block.metaBlock->blockBitmapBlocks = blockBitmapBlocks;
+        block.metaBlock->inodeBitmapBlocks = inodeBitmapBlocks;
+        block.metaBlock->state = MetaBlock::CLEAN;
+    }
+
+    /** The fingerprint index follows the bitmaps, it starts empty too */
+    if (dedup) {
+        uint32_t fingerprintBlocks = fingerprintTableBlocks(blocks, geometry);
+        if (!block.metaBlock->blockBitmapBlocks 
+            || 1 + (uint64_t)block.metaBlock->inodeBlocks + blockBitmapBlocks + inodeBitmapBlocks 
+                + fingerprintBlocks >= blocks - dirBlocks) 
+        {
+            return false;
         }
-
-        /** Write down change of Inode Block **/
-        disk->writeBlock(i, inodeBlock.data);
+        block.metaBlock->fingerprintBlocks = fingerprintBlocks;
     }
 
-    /** Free Data Blocks */
-    uint32_t blocks = block.metaBlock.blocks;
-    uint32_t inodeBlocks = block.metaBlock.inodeBlocks;
-    uint32_t dirBlocks = block.metaBlock.dirBlocks;
-
-    for(uint32_t i = inodeBlocks + 1; i < (blocks - dirBlocks); i++){
-        Block dataBlock;
-        memset(dataBlock.data, 0, Config::BLOCK_SIZE);
-        disk->writeBlock(i, dataBlock.data);
+    /** The checksum table follows, when there is room; a clean state tells when its sums can be trusted */
+    uint32_t checksumBlocks = checksumTableBlocks(blocks, geometry);
+    if (block.metaBlock->blockBitmapBlocks 
+        && 1 + (uint64_t)block.metaBlock->inodeBlocks + blockBitmapBlocks + inodeBitmapBlocks 
+            + block.metaBlock->fingerprintBlocks + checksumBlocks < blocks - dirBlocks) 
+    {
+        block.metaBlock->checksumBlocks = checksumBlocks;
     }
 
+    /** Every block reads as zeros once cleaned, which the empty table matches */
+    ChecksumTable checksums;
+    std::vector<uint32_t> emptySums(block.metaBlock->checksumBlocks ? blocks : 0, 0);
+    checksums.assign(emptySums.data(), emptySums.size(), geometry.blockSize);
+
     /** 
-     * Clean all Directory Blocks 
+     * Clean all the blocks of Volume.
+     * Holes are enough for Inodes and Data Blocks, which are all zeros when empty.
      **/
-    for(uint32_t i = (blocks - dirBlocks); i < blocks; i++) {
-        Directory directory;
-        directory.inumber = -1;
-        directory.available = 0;
-        memset(directory.table, 0, sizeof(DirEntry) * Config::ENTRIES_PER_DIR);
+    Block directoryBlock(geometry.blockSize);
+    emptyDirectories(directoryBlock, geometry);
+
+    if (lazy) {
+        disk->discard(1, blocks - 1);
+    } else {
+        /** A batch of blocks per call */
+        std::vector<char> batch(geometry.batchBlocks * geometry.blockSize, 0);
+
+        for(uint64_t i = 1; i < (blocks - dirBlocks); i += geometry.batchBlocks) {
+            uint32_t count = (uint32_t)std::min((uint64_t)geometry.batchBlocks, (blocks - dirBlocks) - i);
+            disk->writeBlocks(i, count, batch.data());
+        }
+
+        /** Clean routing table of every Directory Block */
+        for(uint32_t i = 0; i < geometry.batchBlocks; i++) {
+            memcpy(&batch[i * geometry.blockSize], directoryBlock.data, geometry.blockSize);
+        }
 
-        /** Clean routing table of Directory Block */
-        Block directoryBlock;
-        for(uint32_t j = 0; j < Config::DIR_PER_BLOCK; j++) {
-            directoryBlock.directories[j] = directory;
+        for(uint64_t i = (blocks - dirBlocks); i < blocks; i += geometry.batchBlocks) {
+            uint32_t count = (uint32_t)std::min((uint64_t)geometry.batchBlocks, blocks - i);
+            disk->writeBlocks(i, count, batch.data());
         }
 
-        /** Write down change */
-        disk->writeBlock(i, directoryBlock.data);
+        if (!checksums.empty()) {
+            uint32_t emptyDirectorySum = checksums.sum(directoryBlock.data);
+            for(uint64_t i = (blocks - dirBlocks); i < blocks; i++) {
+                checksums.set(i, emptyDirectorySum);
+            }
+        }
     }
 
     /**
      *  Recreate root 
      **/
     Directory root;
+    memset(&root, 0, sizeof(root));
     strcpy(root.name, "/");
     root.inumber = 0;
     root.available = 1;
@@ -113,11 +241,33 @@ bool MyFS::format(Volume *disk) {
     memcpy(&(root.table[1]), &entry, sizeof(DirEntry));
 
     /**
-     *   Empty the directories 
+     *   Root goes first in the last Directory Block
      **/
-    Block dirBlock;
-    memcpy(&(dirBlock.directories[0]), &root, sizeof(root));
-    disk->writeBlock(blocks - 1, dirBlock.data);
+    memcpy(&(directoryBlock.directories[0]), &root, sizeof(root));
+    disk->writeBlock(blocks - 1, directoryBlock.data);
+
+    /** Only the Checksum Blocks with the sums of what was written above differ from zeros */
+    if (!checksums.empty()) {
+        checksums.set(blocks - 1, checksums.sum(directoryBlock.data));
+        checksums.set(0, checksums.sum(block.data));
+
+        std::vector<uint32_t> dirty;
+        checksums.takeDirty(dirty);
+
+        Block sums(geometry.blockSize);
+        uint32_t checksumStart = 1 + block.metaBlock->inodeBlocks + blockBitmapBlocks + inodeBitmapBlocks 
+            + block.metaBlock->fingerprintBlocks;
+        for(size_t i = 0; i < dirty.size(); i++) {
+            size_t first = (size_t)dirty[i] * geometry.checksumsPerBlock;
+            size_t count = std::min((size_t)geometry.checksumsPerBlock, checksums.size() - first);
+            memset(sums.data, 0, geometry.blockSize);
+            memcpy(sums.data, checksums.data() + first, count * sizeof(uint32_t));
+            disk->writeBlock(checksumStart + dirty[i], sums.data);
+        }
+    }
+
+    /** Meta Block goes last, the volume is not valid until everything else is in place */
+    disk->writeBlock(0, block.data);
 
     return true;
 }
@@ -127,19 +277,66 @@ bool MyFS::mount(Volume *disk) {
         return false;
     }
 
-    /** Read and check superblock */
-    Block block;
+    /** Read and check superblock, the Meta Block always fits the smallest block size */
+    disk->setBlockSize(Config::BLOCK_SIZE);
+    Block block(Config::BLOCK_SIZE);
+    disk->readBlock(0, block.data);
+    if (block.metaBlock->magicNumber != Config::MAGIC_NUMBER) {
+        return false;
+    }
+
+    /** Switch the volume to its recorded block size before going further */
+    size_t blockSize = block.metaBlock->blockSize ? block.metaBlock->blockSize : Config::BLOCK_SIZE;
+    if (!Geometry::isValid(blockSize)) {
+        return false;
+    }
+    disk->setBlockSize(blockSize);
+    block = Block(blockSize);
     disk->readBlock(0, block.data);
-    if (block.metaBlock.magicNumber != Config::MAGIC_NUMBER
-        || block.metaBlock.inodeBlocks != std::ceil((block.metaBlock.blocks * 1.00)/10)
-        || block.metaBlock.inodes != (block.metaBlock.inodeBlocks * Config::INODES_PER_BLOCK)
-        || block.metaBlock.dirBlocks != (uint32_t)std::ceil((int(block.metaBlock.blocks) * 1.00)/100)) 
+
+    /** Inode slots are as large as recorded, compact on older volumes */
+    size_t inodeSize = block.metaBlock->inodeSize ? block.metaBlock->inodeSize : Config::COMPACT_INODE_SIZE;
+    if (!Geometry::isValidInode(inodeSize, blockSize)) {
+        return false;
+    }
+    geometry = Geometry(blockSize, inodeSize);
+
+    if (block.metaBlock->inodeBlocks != inodeTableBlocks(block.metaBlock->blocks, geometry)
+        || block.metaBlock->inodes != (block.metaBlock->inodeBlocks * geometry.inodesPerBlock)
+        || block.metaBlock->dirBlocks != directoryTableBlocks(block.metaBlock->blocks)
+        || block.metaBlock->uninitInodeBlocks > block.metaBlock->inodeBlocks
+        || block.metaBlock->uninitDirBlocks >= block.metaBlock->dirBlocks
+        || block.metaBlock->compression > MetaBlock::LZ) 
+    {
+        return false;
+    }
+
+    /** Bitmaps, when there are some, cover the whole volume and every inode */
+    if (block.metaBlock->blockBitmapBlocks 
+        && (block.metaBlock->blockBitmapBlocks != bitmapBlocks(block.metaBlock->blocks, geometry)
+            || block.metaBlock->inodeBitmapBlocks != bitmapBlocks(block.metaBlock->inodes, geometry)))
+    {
+        return false;
+    }
+
+    /** So does the fingerprint index, which needs the bitmaps */
+    if (block.metaBlock->fingerprintBlocks
+        && (!block.metaBlock->blockBitmapBlocks || block.metaBlock->compression
+            || block.metaBlock->fingerprintBlocks != fingerprintTableBlocks(block.metaBlock->blocks, geometry)))
+    {
+        return false;
+    }
+
+    /** The checksum table too, it relies on the bitmaps to tell a clean volume */
+    if (block.metaBlock->checksumBlocks
+        && (!block.metaBlock->blockBitmapBlocks
+            || block.metaBlock->checksumBlocks != checksumTableBlocks(block.metaBlock->blocks, geometry)))
     {
         return false;
     }
 
     /** Handle Password Protection */
-    if(block.metaBlock.protect) {
+    if(block.metaBlock->protect) {
         char pass[1000], line[1000];
 
     	printf("Enter password: ");
@@ -150,621 +347,2548 @@ bool MyFS::mount(Volume *disk) {
 
         Hasher hasher;
         hasher.update(pass);
-        uint8_t * digest = hasher.digest();
+        uint8_t digest[Hasher::DIGEST_SIZE];
+        hasher.digest(digest);
 
-        if(Hasher::toString(digest) == std::string(block.metaBlock.password)){
+        if(Hasher::toString(digest) == std::string(block.metaBlock->password)){
             printf("Disk Unlocked\n");
             return true;
         } else {
             printf("Password Failed. Exiting...\n");
             return false;
         }
-        delete[] digest;
     }
 
     disk->mount();
     mountedDisk = disk;
+    readAhead.reset(-1);
+    writeStream.reset(-1, NULL);
 
     /** copy metadata */
-    metaData = block.metaBlock;
+    metaData = *block.metaBlock;
 
     /** allocate free block, inode bitmap */ 
-    freeBlocks.resize(metaData.blocks, false);
-    inodeCounter.resize(metaData.inodeBlocks, 0);
+    freeBlocks.resize(metaData.blocks);
+    usedInodes.resize(metaData.inodes);
+    inodeCounter.assign(metaData.inodeBlocks, 0);
+    dirtyBitmaps.clear();
+    inodeCache.clear();
+    inodeHint = 1;
+
+    /** Sums are trusted on a clean volume only, after a crash they are counted again below */
+    checksumsValid = false;
+    if (metaData.checksumBlocks) {
+        loadChecksums();
+        checksumsValid = metaData.state == MetaBlock::CLEAN;
+        verifyBlock(0, block.data);
+    } else {
+        checksums.clear();
+    }
+
+    if (metaData.fingerprintBlocks) {
+        loadFingerprints();
+    } else {
+        fingerprints.clear();
+    }
+
+    /** A clean volume has its bitmaps on disk, any other one is scanned */
+    if (metaData.blockBitmapBlocks && metaData.state == MetaBlock::CLEAN) {
+        loadBitmaps();
+    } else if (!scanTables()) {
+        return false;
+    }
 
     /** setting free bit map node 0 to true for superblock */
-    freeBlocks[0] = true;
+    freeBlocks.set(0);
+
+    if (metaData.checksumBlocks && !checksumsValid) {
+        rebuildChecksums();
+    }
+
+    /** Until exit() the bitmaps on disk may fall behind, a crash leaves the volume to be scanned */
+    if (metaData.blockBitmapBlocks) {
+        metaData.state = 0;
+        syncMetaBlock();
+    }
+
+    /** Allocate dir_counter */
+    dirCounter.assign(metaData.dirBlocks, 0);
+    countDirectories();
+
+    mounted = true;
+
+    return true;
+}
+
+bool MyFS::scanTables() {
+    counters.tableScans++;
+
+    /** Inode Blocks are read in batches, uninitialized ones hold no inode */
+    uint32_t tableBlocks = metaData.inodeBlocks - metaData.uninitInodeBlocks;
+    size_t batches = (tableBlocks + geometry.batchBlocks - 1) / geometry.batchBlocks;
 
-    /** read inode blocks */
-    for(uint32_t i = 1; i <= metaData.inodeBlocks; i++) {
-        disk->readBlock(i, block.data);
+    /** Workers mark both bitmaps together, their summaries are rebuilt once all of them are done */
+    ThreadPool &pool = ThreadPool::shared();
+    size_t workers = std::min(pool.size(), batches);
+    std::atomic<size_t> nextBatch(0);
+    std::atomic<bool> valid(true);
 
-        for(uint32_t j = 0; j < Config::INODES_PER_BLOCK; j++) {
-            if (block.inodes[j].available) {
+    pool.run(workers, [&](size_t) {
+        std::vector<char> buffer((size_t)geometry.batchBlocks * geometry.blockSize);
+        Inode node;
+
+        for(size_t batch = nextBatch++; batch < batches && valid; batch = nextBatch++) {
+            uint32_t first = 1 + batch * geometry.batchBlocks;
+            uint32_t count = std::min(geometry.batchBlocks, tableBlocks + 1 - first);
+            readBlocks(first, count, buffer.data());
+
+            for(size_t k = 0; k < (size_t)count * geometry.inodesPerBlock; k++) {
+                loadSlot(buffer.data(), k, geometry, node);
+                if (!node.available) {
+                    continue;
+                }
+
+                /** each Inode Block belongs to one batch, so its counter to one worker */
+                uint32_t i = first + k / geometry.inodesPerBlock;
                 inodeCounter[i-1] += 1;
+                usedInodes.mark((size_t)(first - 1) * geometry.inodesPerBlock + k);
 
                 /** set free bit map for inode blocks */
-                if(block.inodes[j].available) {
-                    freeBlocks[i] = true;
+                freeBlocks.mark(i);
+
+                if (!markBlocks(node, freeBlocks)) {
+                    valid = false;
+                    break;
+                }
+            }
+        }
+    });
+
+    if (!valid) {
+        return false;
+    }
+
+    freeBlocks.rebuild();
+    usedInodes.rebuild();
+
+    /** the Bitmap Blocks are rewritten from what was found */
+    for(uint32_t i = 0; i < metaData.blockBitmapBlocks + metaData.inodeBitmapBlocks; i++) {
+        dirtyBitmaps.insert(1 + metaData.inodeBlocks + i);
+    }
+    syncBitmaps();
+
+    if (metaData.fingerprintBlocks) {
+        recountFingerprints();
+        syncFingerprints();
+    }
+
+    return true;
+}
+
+void MyFS::countDirectories() {
+    /** Directory Blocks grow down from the end of the volume, a batch is read with one call */
+    uint32_t tableBlocks = metaData.dirBlocks - metaData.uninitDirBlocks;
+    size_t batches = (tableBlocks + geometry.batchBlocks - 1) / geometry.batchBlocks;
+
+    ThreadPool &pool = ThreadPool::shared();
+    std::atomic<size_t> nextBatch(0);
+
+    pool.run(std::min(pool.size(), batches), [&](size_t) {
+        std::vector<char> buffer((size_t)geometry.batchBlocks * geometry.blockSize);
+
+        for(size_t batch = nextBatch++; batch < batches; batch = nextBatch++) {
+            uint32_t first = batch * geometry.batchBlocks;
+            uint32_t end = std::min(first + geometry.batchBlocks, tableBlocks);
+            readBlocks(metaData.blocks - end, end - first, buffer.data());
+
+            for(uint32_t dirs = first; dirs < end; dirs++) {
+                const Directory *directories = (const Directory*)&buffer[(size_t)(end - 1 - dirs) * geometry.blockSize];
+
+                for(uint32_t offset = 0; offset < geometry.dirPerBlock; offset++){
+                    if(directories[offset].available == 1) {
+                        dirCounter[dirs]++;
+                    }
+                }
+
+                if (dirs == 0){
+                    currentDir = directories[0];
+                }
+            }
+        }
+    });
+}
+
+void MyFS::loadBitmaps() {
+    size_t wordsPerBlock = geometry.blockSize / sizeof(uint64_t);
+    uint32_t count = metaData.blockBitmapBlocks + metaData.inodeBitmapBlocks;
+
+    /** both bitmaps are read with a single call */
+    std::vector<uint64_t> words(count * wordsPerBlock);
+    readBlocks(1 + metaData.inodeBlocks, count, (char*)words.data());
+
+    freeBlocks.assign(words.data(), metaData.blockBitmapBlocks * wordsPerBlock);
+    usedInodes.assign(words.data() + metaData.blockBitmapBlocks * wordsPerBlock, 
+        metaData.inodeBitmapBlocks * wordsPerBlock);
+
+    /** inodes in use per Inode Block follow from the inode bitmap */
+    for(uint32_t i = 0; i < metaData.inodeBlocks; i++) {
+        inodeCounter[i] = usedInodes.count(i * geometry.inodesPerBlock, (i + 1) * geometry.inodesPerBlock);
+    }
+}
+
+void MyFS::syncBitmaps() {
+    if(dirtyBitmaps.empty()) {
+        return;
+    }
+
+    uint32_t blockBitmapStart = 1 + metaData.inodeBlocks;
+    uint32_t inodeBitmapStart = blockBitmapStart + metaData.blockBitmapBlocks;
+
+    /** dirty blocks come sorted, the ones of the block bitmap first */
+    std::vector<uint32_t> dirty[2];
+    for(std::set<uint32_t>::iterator it = dirtyBitmaps.begin(); it != dirtyBitmaps.end(); ++it) {
+        bool inodes = *it >= inodeBitmapStart;
+        dirty[inodes].push_back(*it - (inodes ? inodeBitmapStart : blockBitmapStart));
+    }
+
+    counters.bitmapWrites += writeTable(blockBitmapStart, dirty[0], freeBlocks.words(), 
+        geometry.blockSize, freeBlocks.wordCount() * sizeof(uint64_t));
+    counters.bitmapWrites += writeTable(inodeBitmapStart, dirty[1], usedInodes.words(), 
+        geometry.blockSize, usedInodes.wordCount() * sizeof(uint64_t));
+    dirtyBitmaps.clear();
+}
+
+size_t MyFS::writeTable(uint32_t start, const std::vector<uint32_t> &dirty, const void *table, 
+    size_t bytesPerBlock, size_t tableBytes) 
+{
+    if(dirty.empty()) {
+        return 0;
+    }
+
+    std::vector<Block> buffers;
+    std::vector<BlockRequest> requests;
+    buffers.reserve(dirty.size());
+
+    for(size_t i = 0; i < dirty.size(); i++) {
+        size_t first = (size_t)dirty[i] * bytesPerBlock;
+        size_t count = std::min(bytesPerBlock, tableBytes - first);
+
+        buffers.push_back(Block(geometry.blockSize));
+        memset(buffers.back().data, 0, geometry.blockSize);
+        memcpy(buffers.back().data, (const char*)table + first, count);
+
+        BlockRequest request = { start + dirty[i], buffers.back().data };
+        requests.push_back(request);
+    }
+
+    /** contiguous blocks are written with a single call */
+    writeBlocks(requests);
+    return requests.size();
+}
+
+void MyFS::loadFingerprints() {
+    /** the whole index is read with a single call */
+    std::vector<char> buffer((size_t)metaData.fingerprintBlocks * geometry.blockSize);
+    readBlocks(fingerprintStart(), metaData.fingerprintBlocks, buffer.data());
+
+    std::vector<Fingerprint> entries;
+    entries.reserve((size_t)metaData.fingerprintBlocks * geometry.fingerprintsPerBlock);
+    for(uint32_t i = 0; i < metaData.fingerprintBlocks; i++) {
+        const Fingerprint *stored = (const Fingerprint*)&buffer[(size_t)i * geometry.blockSize];
+        entries.insert(entries.end(), stored, stored + geometry.fingerprintsPerBlock);
+    }
+
+    fingerprints.assign(entries.data(), entries.size(), geometry.fingerprintsPerBlock);
+}
+
+void MyFS::syncFingerprints() {
+    std::vector<uint32_t> dirty;
+    fingerprints.takeDirty(dirty);
+    counters.fingerprintWrites += writeTable(fingerprintStart(), dirty, fingerprints.data(), 
+        geometry.fingerprintsPerBlock * sizeof(Fingerprint), fingerprints.capacity() * sizeof(Fingerprint));
+}
+
+bool MyFS::holdsData(uint32_t blockNumber) const {
+    if (!hasChecksum(blockNumber)) {
+        return false;
+    }
+
+    /** Skipped table blocks are holes, read as empty without any I/O until written */
+    if (blockNumber > metaData.inodeBlocks - metaData.uninitInodeBlocks && blockNumber <= metaData.inodeBlocks) {
+        return false;
+    }
+
+    uint32_t blockId = metaData.blocks - 1 - blockNumber;
+    if (blockId < metaData.dirBlocks && blockId >= metaData.dirBlocks - metaData.uninitDirBlocks) {
+        return false;
+    }
+
+    if (blockNumber >= dataStart() && blockNumber < metaData.blocks - metaData.dirBlocks) {
+        return freeBlocks.test(blockNumber);
+    }
+
+    return true;
+}
+
+bool MyFS::readBlock(uint64_t blockNumber, char *data) {
+    mountedDisk->readBlock(blockNumber, data);
+    return verifyBlock(blockNumber, data);
+}
+
+bool MyFS::readBlocks(uint64_t start, size_t count, char *data) {
+    mountedDisk->readBlocks(start, count, data);
+
+    bool intact = true;
+    for(size_t i = 0; i < count; i++) {
+        if(!verifyBlock(start + i, data + i * geometry.blockSize)) {
+            intact = false;
+        }
+    }
+
+    return intact;
+}
+
+bool MyFS::readBlocks(std::vector<BlockRequest> &requests) {
+    mountedDisk->readBlocks(requests);
+
+    bool intact = true;
+    for(size_t i = 0; i < requests.size(); i++) {
+        if(!verifyBlock(requests[i].blockNumber, requests[i].data)) {
+            intact = false;
+        }
+    }
+
+    return intact;
+}
+
+void MyFS::writeBlock(uint64_t blockNumber, char *data) {
+    if(!hasChecksum(blockNumber)) {
+        mountedDisk->writeBlock(blockNumber, data);
+        return;
+    }
+
+    uint32_t sum = checksums.sum(data);
+    std::lock_guard<std::mutex> guard(checksumLock);
+    checksums.set(blockNumber, sum);
+    mountedDisk->writeBlock(blockNumber, data);
+}
+
+void MyFS::writeBlocks(std::vector<BlockRequest> &requests) {
+    if(checksums.empty()) {
+        mountedDisk->writeBlocks(requests);
+        return;
+    }
+
+    /** sums are taken before the lock, which only covers recording them and the write */
+    std::vector<uint32_t> sums(requests.size());
+    for(size_t i = 0; i < requests.size(); i++) {
+        if(hasChecksum(requests[i].blockNumber)) {
+            sums[i] = checksums.sum(requests[i].data);
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(checksumLock);
+    for(size_t i = 0; i < requests.size(); i++) {
+        if(hasChecksum(requests[i].blockNumber)) {
+            checksums.set(requests[i].blockNumber, sums[i]);
+        }
+    }
+    mountedDisk->writeBlocks(requests);
+}
+
+bool MyFS::verifyBlock(uint64_t blockNumber, const char *data) {
+    if(!checksumsValid || !hasChecksum(blockNumber) || checksums.verify(blockNumber, data)) {
+        return true;
+    }
+
+    /** reads of the mount run on several threads */
+    std::lock_guard<std::mutex> guard(checksumLock);
+    counters.checksumErrors++;
+    fprintf(stderr, "[!] Block %lu does not match its checksum\n", (unsigned long)blockNumber);
+
+    return false;
+}
+
+void MyFS::loadChecksums() {
+    /** the whole table is read with a single call */
+    std::vector<uint32_t> sums((size_t)metaData.checksumBlocks * geometry.checksumsPerBlock);
+    mountedDisk->readBlocks(checksumStart(), metaData.checksumBlocks, (char*)sums.data());
+
+    checksums.assign(sums.data(), metaData.blocks, geometry.blockSize);
+}
+
+void MyFS::syncChecksums() {
+    std::vector<uint32_t> dirty;
+    {
+        std::lock_guard<std::mutex> guard(checksumLock);
+        checksums.takeDirty(dirty);
+    }
+
+    /** Checksum Blocks have no sums of their own, writing them records none */
+    counters.checksumWrites += writeTable(checksumStart(), dirty, checksums.data(), 
+        geometry.checksumsPerBlock * sizeof(uint32_t), checksums.size() * sizeof(uint32_t));
+}
+
+void MyFS::rebuildChecksums() {
+    std::vector<uint32_t> sums(checksums.data(), checksums.data() + checksums.size());
+
+    /** Batches of the volume are read in runs of the blocks holding data, free ones keep their sums */
+    size_t batches = ((size_t)metaData.blocks + geometry.batchBlocks - 1) / geometry.batchBlocks;
+
+    ThreadPool &pool = ThreadPool::shared();
+    std::atomic<size_t> nextBatch(0);
+
+    pool.run(std::min(pool.size(), batches), [&](size_t) {
+        std::vector<char> buffer((size_t)geometry.batchBlocks * geometry.blockSize);
+
+        for(size_t batch = nextBatch++; batch < batches; batch = nextBatch++) {
+            uint32_t first = batch * geometry.batchBlocks;
+            uint32_t end = (uint32_t)std::min((uint64_t)first + geometry.batchBlocks, (uint64_t)metaData.blocks);
+
+            for(uint32_t start = first; start < end; ) {
+                if(!holdsData(start)) {
+                    start++;
+                    continue;
+                }
+
+                uint32_t stop = start + 1;
+                while(stop < end && holdsData(stop)) {
+                    stop++;
+                }
+
+                mountedDisk->readBlocks(start, stop - start, buffer.data());
+                for(uint32_t b = start; b < stop; b++) {
+                    sums[b] = checksums.sum(&buffer[(size_t)(b - start) * geometry.blockSize]);
                 }
+                start = stop;
+            }
+        }
+    });
+
+    checksums.assign(sums.data(), sums.size(), geometry.blockSize, true);
+    checksumsValid = true;
+    syncChecksums();
+}
+
+MyFS::~MyFS() {
+    stopScrub();
+}
+
+bool MyFS::scrub(size_t rate) {
+    if(!mounted || checksums.empty() || !checksumsValid || scrubber.running || rate == 0) {
+        return false;
+    }
+
+    /** a finished scrub leaves its thread to be joined */
+    stopScrub();
+
+    /** Blocks in use now, as runs; blocks taken later are left to the next scrub */
+    std::vector<std::pair<uint32_t, uint32_t> > runs;
+    uint64_t total = 0;
+    for(uint32_t b = 0; b < metaData.blocks; b++) {
+        if(!holdsData(b)) {
+            continue;
+        }
+
+        if(!runs.empty() && runs.back().first + runs.back().second == b) {
+            runs.back().second++;
+        } else {
+            runs.push_back(std::make_pair(b, (uint32_t)1));
+        }
+        total++;
+    }
+
+    scrubber.stop = false;
+    scrubber.running = true;
+    scrubber.total = total;
+    scrubber.scrubbed = 0;
+    scrubber.corrupt = 0;
+    scrubber.worker = std::thread(&MyFS::scrubRuns, this, runs, rate);
+
+    return true;
+}
+
+void MyFS::stopScrub() {
+    scrubber.stop = true;
+    if(scrubber.worker.joinable()) {
+        scrubber.worker.join();
+    }
+}
+
+ScrubStats MyFS::scrubStats() const {
+    ScrubStats stats;
+    stats.running = scrubber.running;
+    stats.blocksTotal = scrubber.total;
+    stats.blocksScrubbed = scrubber.scrubbed;
+    stats.blocksCorrupt = scrubber.corrupt;
+    return stats;
+}
+
+void MyFS::scrubRuns(std::vector<std::pair<uint32_t, uint32_t> > runs, size_t rate) {
+    /** a batch is at most a second of reading, so the rate holds for small ones too */
+    uint32_t batchBlocks = (uint32_t)std::max((size_t)1, std::min((size_t)geometry.batchBlocks, rate / geometry.blockSize));
+    std::vector<char> buffer((size_t)batchBlocks * geometry.blockSize), block(geometry.blockSize);
+    std::vector<uint32_t> expected(batchBlocks), found(batchBlocks);
+
+    Stopwatch watch;
+    uint64_t bytes = 0;
+
+    for(size_t r = 0; r < runs.size() && !scrubber.stop; r++) {
+        uint32_t end = runs[r].first + runs[r].second;
+        for(uint32_t start = runs[r].first; start < end && !scrubber.stop; start += batchBlocks) {
+            uint32_t count = std::min(batchBlocks, end - start);
+
+            {
+                std::lock_guard<std::mutex> guard(checksumLock);
+                for(uint32_t k = 0; k < count; k++) {
+                    expected[k] = checksums.at(start + k);
+                }
+            }
+
+            mountedDisk->readBlocks(start, count, buffer.data());
+            for(uint32_t k = 0; k < count; k++) {
+                found[k] = checksums.sum(&buffer[(size_t)k * geometry.blockSize]);
+            }
+
+            /** 
+             * a block written meanwhile has a new sum, and what was read may be half of it or 
+             * miss a copy the cache wrote back, so a mismatch is read again with the sums held
+             **/
+            for(uint32_t k = 0; k < count; k++) {
+                if(found[k] == expected[k]) {
+                    continue;
+                }
+
+                std::lock_guard<std::mutex> guard(checksumLock);
+                mountedDisk->readBlock(start + k, block.data());
+                if(checksums.sum(block.data()) != checksums.at(start + k)) {
+                    scrubber.corrupt++;
+                    fprintf(stderr, "[!] Scrub: block %u does not match its checksum\n", start + k);
+                }
+            }
+            scrubber.scrubbed += count;
+
+            /** sleep until the bytes read so far fit the rate, waking up to see a stop */
+            bytes += (uint64_t)count * geometry.blockSize;
+            uint64_t due = bytes * 1000000000ull / rate;
+            for(uint64_t now = watch.elapsed(); !scrubber.stop && now < due; now = watch.elapsed()) {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(std::min(due - now, (uint64_t)50000000)));
+            }
+        }
+    }
+
+    if(!scrubber.stop) {
+        fprintf(stderr, "[*] Scrub done: %lu blocks checked, %lu corrupt\n", 
+            (unsigned long)scrubber.scrubbed, (unsigned long)scrubber.corrupt);
+    }
+    scrubber.running = false;
+}
+
+void MyFS::recountFingerprints() {
+    /** every pointer of every tree-mapped file, to a block of the index or not */
+    std::vector<uint32_t> references(fingerprints.capacity(), 0);
+    for(size_t inumber = 1; inumber < metaData.inodes; inumber++) {
+        if(!usedInodes.test(inumber)) {
+            continue;
+        }
+
+        Inode *node = pinInode(inumber);
+        if(node && node->available && (node->flags & Inode::TREE)) {
+            walkTree(*node, [&](uint32_t blockNumber) {
+                ssize_t entry = fingerprints.findBlock(blockNumber);
+                if(entry >= 0) {
+                    references[entry]++;
+                }
+            });
+        }
+        unpinInode(inumber, false);
+    }
+
+    /** an entry written before its block was freed and reused is keyed again by what the block holds */
+    Block block(geometry.blockSize);
+    for(size_t entry = 0; entry < fingerprints.capacity(); entry++) {
+        uint32_t blockNumber = fingerprints.at(entry).blockNumber;
+        if(!blockNumber) {
+            continue;
+        }
+
+        if(!references[entry]) {
+            fingerprints.erase(entry);
+            continue;
+        }
+
+        readBlock(blockNumber, block.data);
+        Hasher hasher;
+        hasher.update((const uint8_t*)block.data, geometry.blockSize);
+        uint8_t digest[Hasher::DIGEST_SIZE];
+        hasher.digest(digest);
+
+        /** the lowest free entry is taken again, so no entry still to be checked moves */
+        if(memcmp(digest, fingerprints.at(entry).digest, sizeof(fingerprints.at(entry).digest))) {
+            fingerprints.erase(entry);
+            ssize_t rekeyed = fingerprints.insert(digest, blockNumber);
+            fingerprints.setReferences(rekeyed, references[entry]);
+        } else if(fingerprints.at(entry).references != references[entry]) {
+            fingerprints.setReferences(entry, references[entry]);
+        }
+    }
+}
+
+void MyFS::bitmapChanged(bool inodes, size_t bit) {
+    if(!metaData.blockBitmapBlocks) {
+        return;
+    }
+
+    uint32_t bitsPerBlock = geometry.blockSize * 8;
+    uint32_t start = 1 + metaData.inodeBlocks + (inodes ? metaData.blockBitmapBlocks : 0);
+    dirtyBitmaps.insert(start + bit / bitsPerBlock);
+}
+
+void MyFS::useBlock(uint32_t blockNumber) {
+    freeBlocks.set(blockNumber);
+    bitmapChanged(false, blockNumber);
+}
+
+void MyFS::releaseBlock(uint32_t blockNumber) {
+    freeBlocks.reset(blockNumber);
+    bitmapChanged(false, blockNumber);
+}
+
+void MyFS::dropBlock(uint32_t blockNumber) {
+    ssize_t entry = fingerprints.findBlock(blockNumber);
+    if(entry >= 0 && fingerprints.release(entry) > 0) {
+        return;
+    }
+
+    releaseBlock(blockNumber);
+}
+
+void MyFS::useInode(size_t inumber) {
+    usedInodes.set(inumber);
+    bitmapChanged(true, inumber);
+
+    /** the Inode Block holding it is in use from its first inode on */
+    inodeCounter[inumber / geometry.inodesPerBlock]++;
+    useBlock(inumber / geometry.inodesPerBlock + 1);
+}
+
+void MyFS::releaseInode(size_t inumber) {
+    usedInodes.reset(inumber);
+    bitmapChanged(true, inumber);
+    inodeHint = std::min(inodeHint, inumber);
+
+    /** 
+     * Decrement the corresponding inode block in inode counter 
+     * if the inode counter decreases to 0, then set the free bit map to false */ 
+    if(!(--inodeCounter[inumber / geometry.inodesPerBlock])) {
+        releaseBlock(inumber / geometry.inodesPerBlock + 1);
+    }
+}
+
+bool MyFS::readTableBlock(uint32_t blockNumber, Block &block) {
+    /** Uninitialized Inode Blocks are the last ones of the inode table */
+    if (blockNumber <= metaData.inodeBlocks 
+        && blockNumber > metaData.inodeBlocks - metaData.uninitInodeBlocks) 
+    {
+        memset(block.data, 0, geometry.blockSize);
+        return true;
+    }
+
+    /** Directory table grows down from the end of the volume */
+    uint32_t blockId = metaData.blocks - 1 - blockNumber;
+    if (blockId < metaData.dirBlocks && blockId >= metaData.dirBlocks - metaData.uninitDirBlocks) {
+        emptyDirectories(block, geometry);
+        return true;
+    }
+
+    counters.tableReads++;
+    return readBlock(blockNumber, block.data);
+}
+
+void MyFS::writeTableBlock(uint32_t blockNumber, Block &block) {
+    bool initialized = false;
+
+    /** Skipped Inode Blocks are holes, which already read as empty inodes */
+    if (blockNumber <= metaData.inodeBlocks 
+        && blockNumber > metaData.inodeBlocks - metaData.uninitInodeBlocks) 
+    {
+        metaData.uninitInodeBlocks = metaData.inodeBlocks - blockNumber;
+        initialized = true;
+    }
+
+    /** Skipped Directory Blocks get their empty routing tables */
+    uint32_t blockId = metaData.blocks - 1 - blockNumber;
+    if (blockId < metaData.dirBlocks && blockId >= metaData.dirBlocks - metaData.uninitDirBlocks) {
+        Block empty(geometry.blockSize);
+        emptyDirectories(empty, geometry);
+
+        for(uint32_t id = metaData.dirBlocks - metaData.uninitDirBlocks; id < blockId; id++) {
+            writeBlock(metaData.blocks - 1 - id, empty.data);
+        }
+
+        metaData.uninitDirBlocks = metaData.dirBlocks - blockId - 1;
+        initialized = true;
+    }
+
+    counters.tableWrites++;
+    writeBlock(blockNumber, block.data);
+
+    if (initialized) {
+        syncMetaBlock();
+    }
+}
+
+void MyFS::syncMetaBlock() {
+    Block block(geometry.blockSize);
+    memset(block.data, 0, geometry.blockSize);
+
+    *block.metaBlock = metaData;
+
+    /** its sum is on disk first, so a Meta Block marked clean always matches it */
+    if (hasChecksum(0)) {
+        {
+            std::lock_guard<std::mutex> guard(checksumLock);
+            checksums.set(0, checksums.sum(block.data));
+        }
+        syncChecksums();
+    }
+
+    writeBlock(0, block.data);
+    counters.metaBlockSyncs++;
+}
+
+bool MyFS::markBlocks(const Inode &node, Bitmap &blocks) {
+    if (node.flags & Inode::INLINE) {
+        return true;
+    }
+
+    if (node.flags & Inode::TREE) {
+        return walkTree(node, [&](uint32_t blockNumber) { blocks.mark(blockNumber); });
+    }
+
+    if (node.flags & Inode::EXTENTS) {
+        if (node.extentCount > Config::EXTENTS_PER_INODE + geometry.extentsPerBlock) {
+            return false;
+        }
+
+        if (node.extentCount > Config::EXTENTS_PER_INODE) {
+            if (!node.extentBlock || node.extentBlock >= metaData.blocks) {
+                return false;
+            }
+            blocks.mark(node.extentBlock);
+        }
+
+        std::vector<Extent> extents;
+        if (!loadExtents(node, extents)) {
+            return false;
+        }
+        for(size_t k = 0; k < extents.size(); k++) {
+            if (!extents[k].start || extents[k].start >= metaData.blocks
+                || extents[k].length > metaData.blocks - extents[k].start) {
+                return false;
+            }
+
+            for(uint32_t dataBlock = extents[k].start; dataBlock < extents[k].start + extents[k].length; dataBlock++) {
+                blocks.mark(dataBlock);
+            }
+        }
+
+        return true;
+    }
+
+    /** set free bit map for direct pointers */
+    for(uint32_t k = 0; k < Config::POINTERS_PER_INODE; k++) {
+        uint32_t dataBlock = node.directBlocks[k];
+
+        if (dataBlock) {
+            if (dataBlock < metaData.blocks) {
+                blocks.mark(dataBlock);
+            } else {
+                return false;
+            }
+        }
+    }
+
+    /** set free bit map for indirect pointers */
+    if (node.indirectBlock){
+        if (node.indirectBlock < metaData.blocks) {
+            blocks.mark(node.indirectBlock);
+
+            Block indirect(geometry.blockSize);
+            if (!readBlock(node.indirectBlock, indirect.data)) {
+                return false;
+            }
+
+            for(uint32_t k = 0; k < geometry.pointersPerBlock; k++) {
+                if (indirect.pointers[k] < metaData.blocks) {
+                    blocks.mark(indirect.pointers[k]);
+                } else {
+                    return false;
+                }
+            }
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+ssize_t MyFS::createInode() {
+    if(!mounted) {
+        return false;
+    }
+
+    /** lowest free inode from the hint on; inode 0 cannot be loaded, so it is never handed out */
+    size_t inumber = usedInodes.find(std::max(inodeHint, (size_t)1), metaData.inodes);
+    if (inumber == Bitmap::npos) {
+        return -1;
+    }
+    inodeHint = inumber + 1;
+
+    Inode node;
+    initInode(node);
+    useInode(inumber);
+
+    /** the Inode Block is written with the next write-back */
+    inodeCache.insert(inumber, node, true);
+    unpinInode(inumber, true);
+    counters.inodeAllocations++;
+
+    return inumber;
+}
+
+bool MyFS::loadInode(size_t inumber, Inode *node) {
+    if(!mounted) {
+        return false;
+    }
+
+    Inode *cached = pinInode(inumber);
+    if(!cached) {
+        return false;
+    }
+
+    bool available = cached->available;
+    if(available) {
+        *node = *cached;
+    }
+    unpinInode(inumber, false);
+
+    return available;
+}
+
+Inode* MyFS::pinInode(size_t inumber) {
+    if(inumber < 1 || inumber >= metaData.inodes) { 
+        return NULL;
+    }
+
+    Inode *node = inodeCache.acquire(inumber);
+    if(node) {
+        counters.inodeCacheHits++;
+        return node;
+    }
+
+    /** find index of inode in the inode table */
+    int blockId = inumber / geometry.inodesPerBlock;
+    int blockOffset = inumber % geometry.inodesPerBlock;
+
+    /** an Inode Block without any inode in use is not read, its inodes are all free */
+    Block block(geometry.blockSize);
+    if(inodeCounter[blockId]) {
+        counters.inodeLoads++;
+        if(!readTableBlock(blockId + 1, block)) {
+            return NULL;
+        }
+    } else {
+        memset(block.data, 0, geometry.blockSize);
+    }
+
+    Inode loaded;
+    loadSlot(block.data, blockOffset, geometry, loaded);
+    return inodeCache.insert(inumber, loaded, false);
+}
+
+void MyFS::initInode(Inode &node) {
+    /** 
+     * set the inode to default values, new files are inline while they fit, 
+     * then mapped by extents or, on volumes with compression, compressed by clusters
+     **/
+    memset(&node, 0, sizeof(Inode));
+    node.available = true;
+    if(geometry.inlineBytes) {
+        node.flags = Inode::INLINE;
+    } else if(metaData.compression) {
+        node.flags = Inode::TREE | Inode::COMPRESSED;
+    } else {
+        node.flags = metaData.fingerprintBlocks ? Inode::TREE : Inode::EXTENTS;
+    }
+}
+
+void MyFS::unpinInode(size_t inumber, bool dirty) {
+    inodeCache.release(inumber, dirty);
+
+    if(inodeCache.full()) {
+        flushInodes();
+        inodeCache.trim();
+    }
+}
+
+void MyFS::flushInodes() {
+    /** an open stream stores its block map first, so the inode points at a whole file */
+    syncStream();
+
+    std::vector<std::pair<size_t, Inode> > dirty;
+    inodeCache.takeDirty(dirty);
+
+    /** dirty inodes come sorted, so the ones sharing an Inode Block are adjacent */
+    Block block(geometry.blockSize);
+    for(size_t i = 0; i < dirty.size(); ) {
+        uint32_t blockNumber = dirty[i].first / geometry.inodesPerBlock + 1;
+        bool intact = readTableBlock(blockNumber, block);
+
+        for(; i < dirty.size() && dirty[i].first / geometry.inodesPerBlock + 1 == blockNumber; i++) {
+            storeSlot(block.data, dirty[i].first % geometry.inodesPerBlock, geometry, dirty[i].second);
+        }
+
+        /** an Inode Block failing its sum is left as it is, rewriting it would give the damage a fresh sum */
+        if(intact) {
+            writeTableBlock(blockNumber, block);
+        }
+    }
+    counters.inodeStores += dirty.size();
+
+    syncBitmaps();
+    syncFingerprints();
+    syncChecksums();
+}
+
+void MyFS::flush() {
+    if(!mounted) {
+        return;
+    }
+
+    flushInodes();
+}
+
+bool MyFS::removeInode(size_t inumber) {
+    if(!mounted) {
+        return false;
+    }
+
+    Inode node;
+
+    if((ssize_t)inumber == readAhead.inumber) {
+        readAhead.reset(-1);
+    }
+
+    if((ssize_t)inumber == writeStream.inumber) {
+        closeStream();
+    }
+
+    /** check if the node is valid; if yes, then load the inode */
+    if(loadInode(inumber, &node)) {
+        /** 
+         * The block map is read whole before anything is freed:
+         * pointer blocks failing their sums are not followed, the file is then kept.
+         **/
+        std::vector<uint32_t> mapped;
+        std::vector<Extent> extents;
+        Block indirect(geometry.blockSize);
+        bool readable = true;
+        if(node.flags & Inode::TREE) {
+            readable = walkTree(node, [&](uint32_t blockNumber) { mapped.push_back(blockNumber); });
+        } else if(node.flags & Inode::EXTENTS) {
+            readable = loadExtents(node, extents);
+        } else if(!(node.flags & Inode::INLINE) && node.indirectBlock) {
+            readable = readBlock(node.indirectBlock, indirect.data);
+        }
+
+        if(!readable) {
+            return false;
+        }
+
+        node.available = false;
+        node.size = 0;
+
+        releaseInode(inumber);
+
+        if(node.flags & Inode::INLINE) {
+            /** Inline data has no block to free */
+            memset(node.inlineData, 0, sizeof(node.inlineData));
+        } else if(node.flags & Inode::TREE) {
+            /** Free every pointer block of the trees, and every Data Block no other file shares */
+            for(size_t i = 0; i < mapped.size(); i++) {
+                dropBlock(mapped[i]);
+            }
+
+            node.sizeHigh = 0;
+            for(uint32_t i = 0; i < Config::TREE_DIRECT_POINTERS; i++) {
+                node.treeDirect[i] = 0;
+            }
+            for(uint32_t i = 0; i < Config::TREE_LEVELS; i++) {
+                node.treeRoots[i] = 0;
+            }
+        } else if(node.flags & Inode::EXTENTS) {
+            /** Free extents and the Extent Block */
+            for(size_t i = 0; i < extents.size(); i++) {
+                for(uint32_t j = 0; j < extents[i].length; j++) {
+                    releaseBlock(extents[i].start + j);
+                }
+            }
+
+            if(node.extentCount > Config::EXTENTS_PER_INODE) {
+                releaseBlock(node.extentBlock);
+            }
+            node.extentCount = 0;
+            node.extentBlock = 0;
+        } else {
+            /** Free direct blocks */
+            for(uint32_t i = 0; i < Config::POINTERS_PER_INODE; i++) {
+                if(node.directBlocks[i]) {
+                    releaseBlock(node.directBlocks[i]);
+                }
+                node.directBlocks[i] = 0;
+            }
+
+            /** Free indirect blocks */
+            if(node.indirectBlock) {
+                releaseBlock(node.indirectBlock);
+                node.indirectBlock = 0;
+
+                for(uint32_t i = 0; i < geometry.pointersPerBlock; i++) {
+                    if(indirect.pointers[i]) {
+                        releaseBlock(indirect.pointers[i]);
+                    }
+                }
+            }
+        }
+
+        inodeCache.insert(inumber, node, true);
+        unpinInode(inumber, true);
+        counters.inodeFrees++;
+
+        return true;
+    }
+    
+    return false;
+}
+
+ssize_t MyFS::stat(size_t inumber) {
+    if(!mounted) {
+        return -1; 
+    }
+
+    /** load inode; if valid, return its size */
+    Inode node;
+    if(loadInode(inumber, &node)) {
+        return node.fileSize();
+    }
+
+    return -1;
+}
+
+ssize_t MyFS::read(size_t inumber, char *data, int length, size_t offset) {
+
+    /** sanity check */
+    if (!mounted) {
+        return -1;
+    }
+
+    /** a file being streamed into is read through the block map the stream holds */
+    if((ssize_t)inumber == writeStream.inumber) {
+        syncStream();
+    }
+
+    /** load inode; if invalid, return error */
+    Inode node;
+    if(!loadInode(inumber, &node)) {
+        return -1;
+    }
+
+    /** IMPORTANT: start reading from index = offset */
+    size_t size_inode = node.fileSize();
+    
+    /** if offset is greater than size of inode, then no data can be read 
+     * if length + offset exceeds the size of inode, adjust length accordingly
+    **/
+    if(length <= 0 || offset >= size_inode) {
+        return 0;
+    } else if(length + offset > size_inode) {
+        length = size_inode - offset;
+    }
+
+    /** inline data came with the inode */
+    if(node.flags & Inode::INLINE) {
+        memcpy(data, node.inlineData + offset, length);
+        return length;
+    }
+
+    if(node.flags & Inode::COMPRESSED) {
+        return readCompressed(inumber, node, data, length, offset);
+    }
+
+    /** A read that continues the previous one widens the read-ahead window */
+    if((ssize_t)inumber == readAhead.inumber && offset == readAhead.nextOffset) {
+        uint32_t smallest = std::max((size_t)1, Config::READ_AHEAD_MIN / geometry.blockSize);
+        uint32_t largest = std::max((size_t)1, Config::READ_AHEAD_MAX / geometry.blockSize);
+        readAhead.window = readAhead.window ? std::min(readAhead.window * 2, largest) : smallest;
+    } else {
+        readAhead.reset(inumber);
+    }
+
+    /** 
+     * Whole blocks are read straight into data.
+     * The partial first and last blocks go through a bounce block.
+     **/
+    Block bounce[2] = { Block(geometry.blockSize), Block(geometry.blockSize) };
+    std::vector<BlockRequest> requests;
+    char *partialTarget[2] = { NULL, NULL };
+    size_t partialBegin[2] = { 0, 0 }, partialLength[2] = { 0, 0 };
+
+    uint64_t first = offset / geometry.blockSize;
+    uint64_t last = (offset + length - 1) / geometry.blockSize;
+    int readByte = 0;
+
+    for(uint64_t i = first; i <= last; i++) {
+        uint32_t blocknum = mapBlock(node, i, true);
+        if(blocknum == UNREADABLE) {
+            return -1;
+        }
+
+        size_t begin = (i == first) ? offset % geometry.blockSize : 0;
+        size_t end = (i == last) ? (offset + length - 1) % geometry.blockSize + 1 : geometry.blockSize;
+
+        /** holes of a tree-mapped file read as zeros, elsewhere data is exhausted */
+        if(!blocknum) {
+            if(!(node.flags & Inode::TREE)) {
+                break;
+            }
+
+            memset(data + readByte, 0, end - begin);
+            readByte += end - begin;
+            continue;
+        }
+
+        if(begin == 0 && end == geometry.blockSize) {
+            BlockRequest request = { blocknum, data + readByte };
+            requests.push_back(request);
+        } else {
+            int slot = (i == first) ? 0 : 1;
+            BlockRequest request = { blocknum, bounce[slot].data };
+            requests.push_back(request);
+
+            partialTarget[slot] = data + readByte;
+            partialBegin[slot] = begin;
+            partialLength[slot] = end - begin;
+        }
+
+        readByte += end - begin;
+    }
+
+    /** contiguous blocks are fetched with a single call, data that fails its sum is not handed out */
+    bool intact = readBlocks(requests);
+    counters.dataBlocksRead += requests.size();
+    if(!intact) {
+        return -1;
+    }
+
+    for(int slot = 0; slot < 2; slot++) {
+        if(partialTarget[slot]) {
+            memcpy(partialTarget[slot], bounce[slot].data + partialBegin[slot], partialLength[slot]);
+        }
+    }
+
+    /** The next window is read while the caller works on this one */
+    readAhead.nextOffset = offset + readByte;
+    if(readAhead.window) {
+        prefetch(node, last + 1);
+    }
+
+    return readByte;
+}
+
+uint32_t MyFS::mapBlock(const Inode &node, uint64_t index, bool load) {
+    if(node.flags & Inode::TREE) {
+        /** pointer blocks stay in the cursor while a sequential scan goes through them */
+        return lookupTree(node, index, readAhead.tree, load);
+    }
+
+    if(node.flags & Inode::EXTENTS) {
+        /** the extents are read once per sequential scan, then searched by file block */
+        if(readAhead.extents.empty()) {
+            if(!load) {
+                return 0;
+            }
+
+            if(!loadExtents(node, readAhead.extents)) {
+                readAhead.extents.clear();
+                return UNREADABLE;
+            }
+            uint32_t first = 0;
+            for(size_t i = 0; i < readAhead.extents.size(); i++) {
+                readAhead.firsts.push_back(first);
+                first += readAhead.extents[i].length;
+            }
+        }
+
+        size_t i = std::upper_bound(readAhead.firsts.begin(), readAhead.firsts.end(), index) - readAhead.firsts.begin();
+        if(i == 0 || index - readAhead.firsts[i - 1] >= readAhead.extents[i - 1].length) {
+            return 0;
+        }
+
+        return readAhead.extents[i - 1].start + (index - readAhead.firsts[i - 1]);
+    }
+
+    if(index < Config::POINTERS_PER_INODE) {
+        return node.directBlocks[index];
+    }
+
+    index -= Config::POINTERS_PER_INODE;
+    if(!node.indirectBlock || index >= geometry.pointersPerBlock) {
+        return 0;
+    }
+
+    /** the indirect block is read once per sequential scan */
+    if(readAhead.indirect.empty()) {
+        if(!load) {
+            return 0;
+        }
+
+        Block indirect(geometry.blockSize);
+        if(!readBlock(node.indirectBlock, indirect.data)) {
+            return UNREADABLE;
+        }
+        readAhead.indirect.assign(indirect.pointers, indirect.pointers + geometry.pointersPerBlock);
+    }
+
+    return readAhead.indirect[index];
+}
+
+void MyFS::prefetch(const Inode &node, uint64_t from) {
+    uint64_t fileBlocks = (node.fileSize() + geometry.blockSize - 1) / geometry.blockSize;
+    uint64_t begin = std::max(from, readAhead.until);
+    uint64_t end = std::min(fileBlocks, from + readAhead.window);
+
+    std::vector<uint64_t> wanted;
+    uint64_t i = begin;
+    for(; i < end; i++) {
+        /** Pointers past the direct ones need the indirect block: it comes first, its data next time */
+        if(!(node.flags & (Inode::EXTENTS | Inode::TREE)) && i >= Config::POINTERS_PER_INODE 
+            && readAhead.indirect.empty() && !readAhead.indirectRequested) {
+            if(node.indirectBlock) {
+                wanted.push_back(node.indirectBlock);
+                readAhead.indirectRequested = true;
+            }
+            break;
+        }
+
+        /** a hole ends the window, so does a block map failing its sum */
+        uint32_t blocknum = mapBlock(node, i, true);
+        if(!blocknum || blocknum == UNREADABLE) {
+            break;
+        }
+        wanted.push_back(blocknum);
+    }
+
+    readAhead.until = std::max(readAhead.until, i);
+    if(!wanted.empty()) {
+        mountedDisk->prefetch(wanted);
+        counters.blocksPrefetched += wanted.size();
+    }
+}
+
+uint32_t MyFS::allocateBlock() {
+    if(!mounted) {
+        return 0;
+    } 
+
+    /** Next free data block after the last one allocated; directory blocks sit at the end */
+    size_t block = freeBlocks.allocate(dataStart(), metaData.blocks - metaData.dirBlocks);
+    if (block == Bitmap::npos) {
+        /** Volume is full */
+        return 0;
+    }
+
+    bitmapChanged(false, block);
+
+    counters.blockAllocations++;
+    return (uint32_t)block;
+}
+
+uint32_t MyFS::allocateBlocks(uint32_t count) {
+    if(!mounted) {
+        return 0;
+    }
+
+    size_t first = freeBlocks.allocateRun(count, dataStart(), metaData.blocks - metaData.dirBlocks);
+    if (first == Bitmap::npos) {
+        return 0;
+    }
+
+    /** a long run spans several Bitmap Blocks */
+    for(size_t bit = first; bit < first + count; bit += geometry.blockSize * 8) {
+        bitmapChanged(false, bit);
+    }
+    bitmapChanged(false, first + count - 1);
+
+    counters.blockAllocations += count;
+    return (uint32_t)first;
+}
+
+bool MyFS::loadExtents(const Inode &node, std::vector<Extent> &extents) {
+    uint32_t inlined = std::min(node.extentCount, (uint32_t)Config::EXTENTS_PER_INODE);
+    extents.assign(node.extents, node.extents + inlined);
+
+    if(node.extentCount > Config::EXTENTS_PER_INODE) {
+        Block block(geometry.blockSize);
+        if(!readBlock(node.extentBlock, block.data)) {
+            return false;
+        }
+
+        uint32_t count = std::min(node.extentCount - Config::EXTENTS_PER_INODE, geometry.extentsPerBlock);
+        extents.insert(extents.end(), block.extents, block.extents + count);
+    }
+
+    return true;
+}
+
+void MyFS::storeExtents(Inode &node, const std::vector<Extent> &extents) {
+    node.extentCount = extents.size();
+    for(size_t i = 0; i < Config::EXTENTS_PER_INODE; i++) {
+        if(i < extents.size()) {
+            node.extents[i] = extents[i];
+        } else {
+            node.extents[i].start = node.extents[i].length = 0;
+        }
+    }
+
+    if(extents.size() > Config::EXTENTS_PER_INODE) {
+        Block block(geometry.blockSize);
+        memset(block.data, 0, geometry.blockSize);
+        std::copy(extents.begin() + Config::EXTENTS_PER_INODE, extents.end(), block.extents);
+        writeBlock(node.extentBlock, block.data);
+    }
+}
+
+uint32_t MyFS::growExtents(Inode &node, std::vector<Extent> &extents, uint32_t count) {
+    uint32_t dataEnd = metaData.blocks - metaData.dirBlocks;
+    uint32_t obtained = 0;
+
+    while(obtained < count) {
+        /** blocks right after the last extent make it longer */
+        if(!extents.empty()) {
+            Extent &last = extents.back();
+            uint32_t next = last.start + last.length;
+
+            if(next < dataEnd && !freeBlocks.test(next)) {
+                useBlock(next);
+                counters.blockAllocations++;
+                last.length++;
+                obtained++;
+                continue;
+            }
+        }
+
+        /** a new extent, which may need the Extent Block first */
+        if(extents.size() == Config::EXTENTS_PER_INODE + geometry.extentsPerBlock) {
+            break;
+        }
+
+        if(extents.size() >= Config::EXTENTS_PER_INODE && node.extentCount <= Config::EXTENTS_PER_INODE 
+            && !node.extentBlock) 
+        {
+            node.extentBlock = allocateBlock();
+            if(!node.extentBlock) {
+                break;
+            }
+        }
+
+        /** the longest free run up to what is still missing */
+        uint32_t length = count - obtained;
+        uint32_t start = 0;
+        while(length && !(start = allocateBlocks(length))) {
+            length /= 2;
+        }
+
+        if(!start) {
+            break;
+        }
+
+        Extent extent = { start, length };
+        extents.push_back(extent);
+        obtained += length;
+    }
+
+    return obtained;
+}
+
+ssize_t MyFS::writeExtents(Inode &node, WriteStream &state, char *data, int length, size_t offset) {
+    std::vector<Extent> &extents = state.extents;
+    if(!state.extentsLoaded) {
+        if(!loadExtents(node, extents)) {
+            return -1;
+        }
+        state.extentsLoaded = true;
+    }
+
+    uint32_t allocated = 0;
+    for(size_t i = 0; i < extents.size(); i++) {
+        allocated += extents[i].length;
+    }
+
+    /** the partial first and last blocks already allocated are read before the file grows */
+    uint32_t first = offset / geometry.blockSize;
+    uint32_t last = (offset + length - 1) / geometry.blockSize;
+    Block bounce[2] = { Block(geometry.blockSize), Block(geometry.blockSize) };
+    uint32_t mapped[2] = { 0, 0 };
+    bool held[2] = { false, false };
+    for(int slot = 0; length > 0 && slot < 2; slot++) {
+        uint32_t index = slot ? last : first;
+        for(size_t e = 0; e < extents.size() && !mapped[slot]; e++) {
+            if(index < extents[e].length) {
+                mapped[slot] = extents[e].start + index;
+            }
+            index -= extents[e].length;
+        }
+    }
+    if(length > 0 && !readEdges(offset, length, mapped, bounce, held)) {
+        return -1;
+    }
+
+    /** the file grows up to the last block written, blocks in between are zeroed */
+    uint32_t previous = allocated;
+    if(length > 0 && last >= allocated) {
+        allocated += growExtents(node, extents, last + 1 - allocated);
+        state.extentsDirty = true;
+    }
+
+    /** a full volume ends the write early */
+    size_t end = std::min(offset + length, (size_t)allocated * geometry.blockSize);
+    int written = end > offset ? end - offset : 0;
+    if(written > 0) {
+        node.size = std::max((size_t)node.size, end);
+    }
+
+    /** 
+     * Whole blocks are written straight from data.
+     * The partial first and last blocks keep what they held around the new data.
+     **/
+    Block zero(geometry.blockSize);
+    memset(zero.data, 0, geometry.blockSize);
+    std::vector<BlockRequest> &requests = state.requests;
+    requests.clear();
+
+    size_t extent = 0;
+    uint32_t extentFirst = 0;
+    for(uint32_t i = std::min(first, previous); i < allocated && i <= last; i++) {
+        while(i >= extentFirst + extents[extent].length) {
+            extentFirst += extents[extent++].length;
+        }
+        uint32_t blocknum = extents[extent].start + (i - extentFirst);
+
+        if(i < first) {
+            BlockRequest request = { blocknum, zero.data };
+            requests.push_back(request);
+            continue;
+        }
+
+        size_t begin = (i == first) ? offset % geometry.blockSize : 0;
+        size_t stop = (i == last) ? (offset + length - 1) % geometry.blockSize + 1 : geometry.blockSize;
+        char *source = data + ((size_t)i * geometry.blockSize + begin - offset);
+
+        if(begin == 0 && stop == geometry.blockSize) {
+            BlockRequest request = { blocknum, source };
+            requests.push_back(request);
+        } else {
+            int slot = (i == first) ? 0 : 1;
+            Block &partial = bounce[slot];
+            if(!held[slot]) {
+                memset(partial.data, 0, geometry.blockSize);
+            }
+
+            memcpy(partial.data + begin, source, stop - begin);
+            BlockRequest request = { blocknum, partial.data };
+            requests.push_back(request);
+        }
+    }
+
+    /** data first, the extents and the inode that point to it go with storeStream() */
+    writeBlocks(requests);
+    counters.dataBlocksWritten += requests.size();
+
+    return written;
+}
+
+
+uint64_t MyFS::treeCapacity() const {
+    uint64_t capacity = Config::TREE_DIRECT_POINTERS;
+    uint64_t span = 1;
+    for(uint32_t depth = 1; depth <= Config::TREE_LEVELS; depth++) {
+        span *= geometry.pointersPerBlock;
+        capacity += span;
+    }
+
+    return capacity;
+}
+
+bool MyFS::treePath(uint64_t index, uint32_t &depth, uint32_t slots[]) const {
+    if(index < Config::TREE_DIRECT_POINTERS) {
+        depth = 0;
+        slots[0] = index;
+        return true;
+    }
+
+    /** each tree covers pointersPerBlock times more blocks than the one before */
+    index -= Config::TREE_DIRECT_POINTERS;
+    uint64_t span = 1;
+    for(depth = 1; depth <= Config::TREE_LEVELS; depth++) {
+        span *= geometry.pointersPerBlock;
+        if(index < span) {
+            for(uint32_t level = depth; level-- > 0; ) {
+                slots[level] = index % geometry.pointersPerBlock;
+                index /= geometry.pointersPerBlock;
+            }
+            return true;
+        }
+        index -= span;
+    }
+
+    return false;
+}
+
+bool MyFS::loadTreeLevel(TreeCursor &cursor, uint32_t level, uint32_t blockNumber, bool fresh) {
+    if(cursor.blocks[level] == blockNumber && !fresh) {
+        return true;
+    }
+
+    Block block(geometry.blockSize);
+    if(cursor.dirty[level]) {
+        std::copy(cursor.pointers[level].begin(), cursor.pointers[level].end(), block.pointers);
+        writeBlock(cursor.blocks[level], block.data);
+    }
+
+    if(fresh) {
+        cursor.pointers[level].assign(geometry.pointersPerBlock, 0);
+    } else {
+        counters.pointerReads++;
+        if(!readBlock(blockNumber, block.data)) {
+            cursor.blocks[level] = 0;
+            cursor.dirty[level] = false;
+            return false;
+        }
+        cursor.pointers[level].assign(block.pointers, block.pointers + geometry.pointersPerBlock);
+    }
+
+    cursor.blocks[level] = blockNumber;
+    cursor.dirty[level] = fresh;
+    return true;
+}
+
+void MyFS::storeTree(TreeCursor &cursor) {
+    Block block(geometry.blockSize);
+    for(uint32_t level = 0; level < Config::TREE_LEVELS; level++) {
+        if(cursor.dirty[level]) {
+            std::copy(cursor.pointers[level].begin(), cursor.pointers[level].end(), block.pointers);
+            writeBlock(cursor.blocks[level], block.data);
+            cursor.dirty[level] = false;
+        }
+    }
+}
+
+uint32_t MyFS::lookupTree(const Inode &node, uint64_t index, TreeCursor &cursor, bool load) {
+    uint32_t depth;
+    uint32_t slots[Config::TREE_LEVELS];
+    if(!treePath(index, depth, slots)) {
+        return 0;
+    }
+
+    if(depth == 0) {
+        return node.treeDirect[slots[0]];
+    }
+
+    /** at most one read per level, none where the path is the one walked last */
+    uint32_t blockNumber = node.treeRoots[depth - 1];
+    for(uint32_t level = 0; level < depth; level++) {
+        if(!blockNumber) {
+            return 0;
+        }
+
+        if(cursor.blocks[level] != blockNumber) {
+            if(!load) {
+                return 0;
+            }
+            if(!loadTreeLevel(cursor, level, blockNumber, false)) {
+                return UNREADABLE;
+            }
+        }
+        blockNumber = cursor.pointers[level][slots[level]];
+    }
+
+    return blockNumber;
+}
+
+bool MyFS::placeTree(Inode &node, uint64_t index, uint32_t blockNumber, TreeCursor &cursor) {
+    uint32_t depth;
+    uint32_t slots[Config::TREE_LEVELS];
+    if(!treePath(index, depth, slots)) {
+        return false;
+    }
+
+    if(depth == 0) {
+        node.treeDirect[slots[0]] = blockNumber;
+        return true;
+    }
+
+    /** missing pointer blocks are allocated on the way down, their parent changes with them */
+    uint32_t *parent = &node.treeRoots[depth - 1];
+    for(uint32_t level = 0; level < depth; level++) {
+        if(!*parent) {
+            uint32_t fresh = allocateBlock();
+            if(!fresh) {
+                return false;
+            }
+
+            *parent = fresh;
+            if(level > 0) {
+                cursor.dirty[level - 1] = true;
+            }
+            loadTreeLevel(cursor, level, fresh, true);
+        } else if(!loadTreeLevel(cursor, level, *parent, false)) {
+            return false;
+        }
+        parent = &cursor.pointers[level][slots[level]];
+    }
+
+    *parent = blockNumber;
+    cursor.dirty[depth - 1] = true;
+    return true;
+}
+
+bool MyFS::walkTree(const Inode &node, const std::function<void(uint32_t)> &visit) {
+    /** the direct slots of a compressed inode hold the run of its first cluster */
+    bool runs = node.flags & Inode::COMPRESSED;
+    if(runs) {
+        if(!walkRun(node.treeDirect[0], node.treeDirect[1], visit)) {
+            return false;
+        }
+    } else {
+        for(uint32_t i = 0; i < Config::TREE_DIRECT_POINTERS; i++) {
+            if(node.treeDirect[i] && !walkPointers(node.treeDirect[i], 0, false, visit)) {
+                return false;
+            }
+        }
+    }
+
+    for(uint32_t i = 0; i < Config::TREE_LEVELS; i++) {
+        if(node.treeRoots[i] && !walkPointers(node.treeRoots[i], i + 1, runs, visit)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool MyFS::walkPointers(uint32_t blockNumber, uint32_t depth, bool runs, const std::function<void(uint32_t)> &visit) {
+    if(blockNumber >= metaData.blocks) {
+        return false;
+    }
+
+    visit(blockNumber);
+    if(depth == 0) {
+        return true;
+    }
+
+    Block block(geometry.blockSize);
+    if(!readBlock(blockNumber, block.data)) {
+        return false;
+    }
+
+    if(runs && depth == 1) {
+        for(uint32_t k = 0; k + 1 < geometry.pointersPerBlock; k += 2) {
+            if(!walkRun(block.pointers[k], block.pointers[k + 1], visit)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    for(uint32_t k = 0; k < geometry.pointersPerBlock; k++) {
+        if(block.pointers[k] && !walkPointers(block.pointers[k], depth - 1, runs, visit)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool MyFS::walkRun(uint32_t start, uint32_t length, const std::function<void(uint32_t)> &visit) {
+    if(!start) {
+        return true;
+    }
+
+    uint32_t blocks = length & ~Inode::RAW_CLUSTER;
+    if(!blocks || blocks > geometry.clusterBlocks || start >= metaData.blocks || blocks > metaData.blocks - start) {
+        return false;
+    }
+
+    for(uint32_t k = 0; k < blocks; k++) {
+        visit(start + k);
+    }
+
+    return true;
+}
+
+bool MyFS::convertToTree(Inode &node) {
+    /** the Data Blocks of the file in order, 0 for the ones never written */
+    std::vector<uint32_t> blocks;
+    uint32_t mapBlockNumber = 0;
+
+    if(node.flags & Inode::EXTENTS) {
+        std::vector<Extent> extents;
+        if(!loadExtents(node, extents)) {
+            return false;
+        }
+        for(size_t i = 0; i < extents.size(); i++) {
+            for(uint32_t j = 0; j < extents[i].length; j++) {
+                blocks.push_back(extents[i].start + j);
+            }
+        }
+
+        if(node.extentCount > Config::EXTENTS_PER_INODE) {
+            mapBlockNumber = node.extentBlock;
+        }
+    } else {
+        blocks.assign(node.directBlocks, node.directBlocks + Config::POINTERS_PER_INODE);
+
+        if(node.indirectBlock) {
+            Block indirect(geometry.blockSize);
+            if(!readBlock(node.indirectBlock, indirect.data)) {
+                return false;
+            }
+            blocks.insert(blocks.end(), indirect.pointers, indirect.pointers + geometry.pointersPerBlock);
+            mapBlockNumber = node.indirectBlock;
+        }
+    }
+
+    /** every pointer block the trees may need has to be free before anything moves */
+    uint64_t pointerBlocks = Config::TREE_LEVELS * (blocks.size() / geometry.pointersPerBlock + 2);
+    uint32_t dataEnd = metaData.blocks - metaData.dirBlocks;
+    if(blocks.size() > treeCapacity() 
+        || dataEnd - dataStart() - freeBlocks.count(dataStart(), dataEnd) < pointerBlocks) 
+    {
+        return false;
+    }
+
+    Inode tree;
+    memset(&tree, 0, sizeof(Inode));
+    tree.available = node.available;
+    tree.flags = Inode::TREE;
+    tree.setFileSize(node.size);
+
+    TreeCursor cursor;
+    for(size_t i = 0; i < blocks.size(); i++) {
+        if(blocks[i] && !placeTree(tree, i, blocks[i], cursor)) {
+            return false;
+        }
+    }
+    storeTree(cursor);
+
+    /** the Extent Block or the indirect block is no longer needed */
+    if(mapBlockNumber) {
+        releaseBlock(mapBlockNumber);
+    }
+
+    node = tree;
+    return true;
+}
+
+bool MyFS::readEdges(size_t offset, int length, const uint32_t mapped[2], Block bounce[2], bool held[2]) {
+    uint64_t first = offset / geometry.blockSize;
+    uint64_t last = (offset + length - 1) / geometry.blockSize;
+    size_t tail = (offset + length) % geometry.blockSize;
+
+    /** the first block is partial if the write starts or ends inside it, the last one if the write ends inside it */
+    bool partial[2] = { offset % geometry.blockSize != 0 || (first == last && tail != 0), first != last && tail != 0 };
+
+    for(int slot = 0; slot < 2; slot++) {
+        held[slot] = partial[slot] && mapped[slot];
+        if(held[slot] && !readBlock(mapped[slot], bounce[slot].data)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+ssize_t MyFS::writeTree(Inode &node, WriteStream &state, char *data, int length, size_t offset) {
+    int written = 0;
+    if(length <= 0) {
+        return written;
+    }
+
+    /**
+     * Whole blocks are written straight from data.
+     * Partial blocks keep what they held around the new data, new ones start zeroed.
+     **/
+    Block bounce[2] = { Block(geometry.blockSize), Block(geometry.blockSize) };
+    std::vector<BlockRequest> &requests = state.requests;
+    TreeCursor &cursor = state.tree;
+    requests.clear();
+
+    /** the partial blocks are read before anything is allocated */
+    uint64_t first = offset / geometry.blockSize;
+    uint64_t last = (offset + length - 1) / geometry.blockSize;
+    uint32_t mapped[2] = { lookupTree(node, first, cursor, true), lookupTree(node, last, cursor, true) };
+    bool held[2];
+    if(mapped[0] == UNREADABLE || mapped[1] == UNREADABLE || !readEdges(offset, length, mapped, bounce, held)) {
+        return -1;
+    }
+
+    for(uint64_t i = first; i <= last; i++) {
+        /** a pointer block failing its sum ends the write early */
+        uint32_t blocknum = lookupTree(node, i, cursor, true);
+        if(blocknum == UNREADABLE) {
+            break;
+        }
+        bool fresh = !blocknum;
+
+        /** a full volume or the end of the trees ends the write early */
+        if(fresh) {
+            blocknum = allocateBlock();
+            if(!blocknum) {
+                break;
+            }
+
+            if(!placeTree(node, i, blocknum, cursor)) {
+                releaseBlock(blocknum);
+                break;
+            }
+        }
+
+        size_t begin = (i == first) ? offset % geometry.blockSize : 0;
+        size_t stop = (i == last) ? (offset + length - 1) % geometry.blockSize + 1 : geometry.blockSize;
+        char *source = data + written;
+
+        if(begin == 0 && stop == geometry.blockSize) {
+            BlockRequest request = { blocknum, source };
+            requests.push_back(request);
+        } else {
+            int slot = (i == first) ? 0 : 1;
+            Block &partial = bounce[slot];
+            if(!held[slot]) {
+                memset(partial.data, 0, geometry.blockSize);
+            }
+
+            memcpy(partial.data + begin, source, stop - begin);
+            BlockRequest request = { blocknum, partial.data };
+            requests.push_back(request);
+        }
+
+        written += stop - begin;
+    }
+
+    /** data first, the pointer blocks and the inode that point to it go with storeStream() */
+    writeBlocks(requests);
+    counters.dataBlocksWritten += requests.size();
+
+    if(written > 0) {
+        node.setFileSize(std::max(node.fileSize(), (uint64_t)offset + written));
+    }
+
+    return written;
+}
+
+uint32_t MyFS::dedupBlock(uint32_t current, const uint8_t *digest, bool &write) {
+    write = false;
+
+    ssize_t match = fingerprints.find(digest);
+    if(match >= 0) {
+        uint32_t shared = fingerprints.at(match).blockNumber;
+        if(shared != current) {
+            fingerprints.reference(match);
+            counters.blocksDeduplicated++;
+        }
+        return shared;
+    }
+
+    /** a block no other pointer shares is rewritten in place, a shared one is copied on write */
+    write = true;
+    ssize_t own = current ? fingerprints.findBlock(current) : -1;
+    if(current && (own < 0 || fingerprints.at(own).references == 1)) {
+        if(own >= 0) {
+            fingerprints.erase(own);
+        }
+        fingerprints.insert(digest, current);
+        return current;
+    }
+
+    /** with the index full, a new block is written without an entry and never shared */
+    uint32_t fresh = allocateBlock();
+    if(fresh) {
+        fingerprints.insert(digest, fresh);
+    }
+
+    return fresh;
+}
+
+ssize_t MyFS::writeDeduplicated(Inode &node, WriteStream &state, char *data, int length, size_t offset) {
+    int written = 0;
+    if(length <= 0) {
+        return written;
+    }
+
+    /**
+     * Every block is hashed as it will be: whole blocks straight from data,
+     * partial ones with what they held around the new data. The digests of a write
+     * are taken together, then only new contents are written.
+     **/
+    Block bounce[2] = { Block(geometry.blockSize), Block(geometry.blockSize) };
+    std::vector<BlockRequest> &requests = state.requests;
+    std::vector<const uint8_t*> &contents = state.contents;
+    TreeCursor &cursor = state.tree;
+    requests.clear();
+    contents.clear();
+
+    /** the partial blocks are read before anything is allocated */
+    uint64_t first = offset / geometry.blockSize;
+    uint64_t last = (offset + length - 1) / geometry.blockSize;
+    uint32_t mapped[2] = { lookupTree(node, first, cursor, true), lookupTree(node, last, cursor, true) };
+    bool held[2];
+    if(mapped[0] == UNREADABLE || mapped[1] == UNREADABLE || !readEdges(offset, length, mapped, bounce, held)) {
+        return -1;
+    }
+
+    size_t taken = 0;
+    for(uint64_t i = first; i <= last; i++) {
+        uint32_t current = lookupTree(node, i, cursor, true);
+
+        /** the pointer blocks on the way are made first, so placing the block below cannot fail */
+        if(current == UNREADABLE || (!current && !placeTree(node, i, 0, cursor))) {
+            break;
+        }
+
+        size_t begin = (i == first) ? offset % geometry.blockSize : 0;
+        size_t stop = (i == last) ? (offset + length - 1) % geometry.blockSize + 1 : geometry.blockSize;
+        char *content = data + taken;
+        taken += stop - begin;
+
+        if(begin != 0 || stop != geometry.blockSize) {
+            int slot = (i == first) ? 0 : 1;
+            Block &partial = bounce[slot];
+            if(!held[slot]) {
+                memset(partial.data, 0, geometry.blockSize);
+            }
+
+            memcpy(partial.data + begin, content, stop - begin);
+            content = partial.data;
+        }
+
+        contents.push_back((const uint8_t*)content);
+    }
+
+    state.digests.resize(contents.size() * Hasher::DIGEST_SIZE);
+    Hasher::digestMany(contents.data(), geometry.blockSize, contents.size(), state.digests.data());
+
+    for(size_t k = 0; k < contents.size(); k++) {
+        uint64_t i = first + k;
+        uint32_t current = lookupTree(node, i, cursor, true);
+        if(current == UNREADABLE) {
+            break;
+        }
+
+        bool write;
+        uint32_t blocknum = dedupBlock(current, &state.digests[k * Hasher::DIGEST_SIZE], write);
+
+        /** a full volume ends the write early */
+        if(!blocknum) {
+            break;
+        }
+
+        if(write) {
+            BlockRequest request = { blocknum, (char*)contents[k] };
+            requests.push_back(request);
+        }
+
+        if(blocknum != current) {
+            placeTree(node, i, blocknum, cursor);
+            if(current) {
+                dropBlock(current);
+            }
+        }
+
+        size_t begin = (i == first) ? offset % geometry.blockSize : 0;
+        size_t stop = (i == last) ? (offset + length - 1) % geometry.blockSize + 1 : geometry.blockSize;
+        written += stop - begin;
+    }
+
+    /** data first, the pointer blocks, the index and the inode that point to it go later */
+    writeBlocks(requests);
+    counters.dataBlocksWritten += requests.size();
+
+    if(written > 0) {
+        node.setFileSize(std::max(node.fileSize(), (uint64_t)offset + written));
+    }
+
+    return written;
+}
+
+bool MyFS::loadCluster(const Inode &node, uint64_t cluster, char *target, TreeCursor &cursor) {
+    size_t clusterBytes = (size_t)geometry.clusterBlocks * geometry.blockSize;
+    memset(target, 0, clusterBytes);
+
+    uint64_t first = cluster * clusterBytes;
+    if(first >= node.fileSize()) {
+        return true;
+    }
+
+    uint32_t start = lookupTree(node, 2 * cluster, cursor, true);
+    uint32_t length = lookupTree(node, 2 * cluster + 1, cursor, true);
+    if(start == UNREADABLE || length == UNREADABLE) {
+        return false;
+    }
+    if(!start) {
+        return true;
+    }
+
+    uint32_t blocks = length & ~Inode::RAW_CLUSTER;
+    if(!blocks || blocks > geometry.clusterBlocks) {
+        return false;
+    }
+
+    /** the run is contiguous, so it comes in with a single call */
+    Block packed(clusterBytes);
+    std::vector<BlockRequest> requests(blocks);
+    for(uint32_t k = 0; k < blocks; k++) {
+        requests[k].blockNumber = start + k;
+        requests[k].data = packed.data + (size_t)k * geometry.blockSize;
+    }
+    bool intact = readBlocks(requests);
+    counters.dataBlocksRead += blocks;
+    if(!intact) {
+        return false;
+    }
+
+    size_t bytes = std::min((uint64_t)clusterBytes, node.fileSize() - first);
+    if(length & Inode::RAW_CLUSTER) {
+        memcpy(target, packed.data, std::min(bytes, (size_t)blocks * geometry.blockSize));
+        return true;
+    }
+
+    /** a compressed run starts with the length of its stream */
+    uint32_t streamLength;
+    memcpy(&streamLength, packed.data, sizeof(streamLength));
+    if(streamLength > (size_t)blocks * geometry.blockSize - sizeof(streamLength)) {
+        return false;
+    }
+
+    return LzCodec::decompress(packed.data + sizeof(streamLength), streamLength, target, clusterBytes) > 0;
+}
+
+bool MyFS::storeCluster(Inode &node, WriteStream &state) {
+    if(!state.clusterDirty) {
+        return true;
+    }
 
-                /** set free bit map for direct pointers */
-                for(uint32_t k = 0; k < Config::POINTERS_PER_INODE; k++) {
-                    uint32_t dataBlock = block.inodes[j].directBlocks[k];
+    /** 
+     * A cluster is only kept compressed when that saves a block,
+     * so the stream must fit one block short of the bytes as they are.
+     **/
+    size_t clusterBytes = (size_t)geometry.clusterBlocks * geometry.blockSize;
+    uint32_t rawBlocks = (state.clusterEnd + geometry.blockSize - 1) / geometry.blockSize;
+    Block packed(clusterBytes);
+
+    uint32_t blocks = rawBlocks;
+    uint32_t length = rawBlocks | Inode::RAW_CLUSTER;
+    uint32_t streamLength = 0;
+    if(rawBlocks > 1) {
+        size_t capacity = (size_t)(rawBlocks - 1) * geometry.blockSize - sizeof(streamLength);
+        streamLength = LzCodec::compress(state.clusterData.data(), state.clusterEnd, 
+            packed.data + sizeof(streamLength), capacity);
+    }
+
+    if(streamLength) {
+        memcpy(packed.data, &streamLength, sizeof(streamLength));
+        blocks = (sizeof(streamLength) + streamLength + geometry.blockSize - 1) / geometry.blockSize;
+        length = blocks;
+        memset(packed.data + sizeof(streamLength) + streamLength, 0, 
+            (size_t)blocks * geometry.blockSize - sizeof(streamLength) - streamLength);
+    } else {
+        memcpy(packed.data, state.clusterData.data(), state.clusterEnd);
+        memset(packed.data + state.clusterEnd, 0, (size_t)blocks * geometry.blockSize - state.clusterEnd);
+    }
 
-                    if (dataBlock) {
-                        if (dataBlock < metaData.blocks) {
-                            freeBlocks[dataBlock] = true;
-                        } else {
-                            return false;
-                        }
-                    }
-                }
+    /** the old run is rewritten in place when the cluster still fits, its tail is freed */
+    uint32_t oldStart = lookupTree(node, 2 * state.cluster, state.tree, true);
+    uint32_t oldLength = oldStart ? lookupTree(node, 2 * state.cluster + 1, state.tree, true) : 0;
+    if(oldStart == UNREADABLE || oldLength == UNREADABLE) {
+        return false;
+    }
 
-                /** set free bit map for indirect pointers */
-                if (block.inodes[j].indirectBlock){
-                    if (block.inodes[j].indirectBlock < metaData.blocks) {
-                        freeBlocks[block.inodes[j].indirectBlock] = true;
-
-                        Block indirect;
-                        mountedDisk->readBlock(block.inodes[j].indirectBlock, indirect.data);
-
-                        for(uint32_t k = 0; k < Config::POINTERS_PER_BLOCK; k++) {
-                            if (indirect.pointers[k] < metaData.blocks) {
-                                freeBlocks[indirect.pointers[k]] = true;
-                            } else {
-                                return false;
-                            }
-                        }
-                    } else {
-                        return false;
-                    }
-                }
-            }
+    uint32_t oldBlocks = oldLength & ~Inode::RAW_CLUSTER;
+    uint32_t start = oldStart;
+    if(blocks > oldBlocks) {
+        start = allocateBlocks(blocks);
+        if(!start) {
+            return false;
         }
     }
 
-    /** Allocate dir_counter */
-    dirCounter.resize(metaData.dirBlocks, 0);
-
-    Block dirBlock;
-    for(uint32_t dirs = 0; dirs < metaData.dirBlocks; dirs++){
-        disk->readBlock(metaData.blocks - 1 - dirs, dirBlock.data);
+    std::vector<BlockRequest> requests(blocks);
+    for(uint32_t k = 0; k < blocks; k++) {
+        requests[k].blockNumber = start + k;
+        requests[k].data = packed.data + (size_t)k * geometry.blockSize;
+    }
+    writeBlocks(requests);
+    counters.dataBlocksWritten += blocks;
 
-        for(uint32_t offset = 0; offset < Config::DIR_PER_BLOCK; offset++){
-            if(dirBlock.directories[offset].available == 1) {
-                dirCounter[dirs]++;
+    /** data first, then the run that points to it */
+    if(!placeTree(node, 2 * state.cluster, start, state.tree) 
+        || !placeTree(node, 2 * state.cluster + 1, length, state.tree)) 
+    {
+        if(start != oldStart) {
+            for(uint32_t k = 0; k < blocks; k++) {
+                releaseBlock(start + k);
             }
         }
-        
-        if (dirs == 0){
-            currentDir = dirBlock.directories[0];
-        }
+        return false;
     }
 
-    mounted = true;
+    uint32_t keep = (start == oldStart) ? blocks : 0;
+    for(uint32_t k = keep; k < oldBlocks; k++) {
+        releaseBlock(oldStart + k);
+    }
+
+    if(streamLength) {
+        counters.clustersCompressed++;
+        counters.blocksSaved += rawBlocks - blocks;
+    } else {
+        counters.clustersRaw++;
+    }
+
+    node.setFileSize(std::max(node.fileSize(), state.cluster * clusterBytes + state.clusterEnd));
+    state.clusterDirty = false;
 
     return true;
 }
 
-ssize_t MyFS::createInode() {
-    if(!mounted) {
-        return false;
-    }
-
-    /** read the superblock */
-    Block block;
-    mountedDisk->readBlock(0, block.data);
+ssize_t MyFS::writeCompressed(Inode &node, WriteStream &state, char *data, int length, size_t offset) {
+    size_t clusterBytes = (size_t)geometry.clusterBlocks * geometry.blockSize;
+    int written = 0;
 
-    /** locate free inode in inode table */    
-    for(uint32_t i = 1; i <= metaData.inodeBlocks; i++) {
-        /** check if inode block is full */
-        if (inodeCounter[i-1] == Config::INODES_PER_BLOCK) {
-            continue;
-        } else {
-            mountedDisk->readBlock(i, block.data);
-        }
-        
-        /** find the first empty inode */
-        for(uint32_t j = 0; j < Config::INODES_PER_BLOCK; j++) {
-            /** set the inode to default values */
-            if(!block.inodes[j].available) {
-                block.inodes[j].available = true;
-                block.inodes[j].size = 0;
-                block.inodes[j].indirectBlock = 0;
-
-                for(int ii = 0; ii < 5; ii++) {
-                    block.inodes[j].directBlocks[ii] = 0;
-                }
+    /** where this write started on the cluster being filled, it is undone if the cluster cannot be stored */
+    int clusterWritten = 0;
 
-                freeBlocks[i] = true;
-                inodeCounter[i - 1]++;
+    while(written < length) {
+        uint64_t position = offset + written;
+        uint64_t cluster = position / clusterBytes;
+        size_t begin = position % clusterBytes;
+        size_t count = std::min((size_t)(length - written), clusterBytes - begin);
 
-                mountedDisk->writeBlock(i, block.data);
+        if(cluster != state.cluster) {
+            if(!storeCluster(node, state)) {
+                return clusterWritten;
+            }
 
-                return (((i-1) * Config::INODES_PER_BLOCK) + j);
+            /** a cluster the write covers up to the end of the file is not read back */
+            uint64_t first = cluster * clusterBytes;
+            state.clusterData.resize(clusterBytes);
+            if(begin == 0 && (count == clusterBytes || first + count >= node.fileSize())) {
+                memset(state.clusterData.data() + count, 0, clusterBytes - count);
+            } else if(!loadCluster(node, cluster, state.clusterData.data(), state.tree)) {
+                state.cluster = UINT64_MAX;
+                return written ? written : -1;
             }
-        }
-    }
 
-    return -1;
-}
+            state.cluster = cluster;
+            state.clusterEnd = first < node.fileSize() ? std::min((uint64_t)clusterBytes, node.fileSize() - first) : 0;
+            clusterWritten = written;
+        }
 
-bool MyFS::loadInode(size_t inumber, Inode *node) {
-    if(!mounted) {
-        return false;
+        memcpy(state.clusterData.data() + begin, data + written, count);
+        state.clusterEnd = std::max(state.clusterEnd, begin + count);
+        state.clusterDirty = true;
+        written += count;
     }
 
-    if(inumber < 1 || inumber > metaData.inodes) { 
-        return false;
+    /** a write of its own stores its last cluster now, a stream once it moves on */
+    if(state.inumber < 0 && !storeCluster(node, state)) {
+        return clusterWritten;
     }
 
-    /** find index of inode in the inode table */
-    int blockId = inumber / Config::INODES_PER_BLOCK;
-    int blockOffset = inumber % Config::INODES_PER_BLOCK;
-
-    /** load the inode into Inode *node */
-    Block block;
-    if(inodeCounter[blockId]) {
-        mountedDisk->readBlock(blockId + 1, block.data);
+    return written;
+}
 
-        if(block.inodes[blockOffset].available) {
-            *node = block.inodes[blockOffset];
-            return true;
+ssize_t MyFS::readCompressed(size_t inumber, const Inode &node, char *data, int length, size_t offset) {
+    if((ssize_t)inumber != readAhead.inumber) {
+        readAhead.reset(inumber);
+    }
+
+    size_t clusterBytes = (size_t)geometry.clusterBlocks * geometry.blockSize;
+    int readByte = 0;
+    while(readByte < length) {
+        uint64_t position = offset + readByte;
+        uint64_t cluster = position / clusterBytes;
+        size_t begin = position % clusterBytes;
+        size_t count = std::min((size_t)(length - readByte), clusterBytes - begin);
+
+        /** a sequential scan decodes each cluster once */
+        if(cluster != readAhead.cluster) {
+            readAhead.clusterData.resize(clusterBytes);
+            if(!loadCluster(node, cluster, readAhead.clusterData.data(), readAhead.tree)) {
+                readAhead.cluster = UINT64_MAX;
+                return readByte ? readByte : -1;
+            }
+            readAhead.cluster = cluster;
         }
+
+        memcpy(data + readByte, readAhead.clusterData.data() + begin, count);
+        readByte += count;
     }
 
-    return false;
+    return readByte;
 }
 
-bool MyFS::removeInode(size_t inumber) {
-    if(!mounted) {
-        return false;
-    }
+ssize_t MyFS::writeInline(Inode &node, char *data, int length, size_t offset) {
+    memcpy(node.inlineData + offset, data, length);
+    node.size = std::max((size_t)node.size, offset + length);
 
-    Inode node;
+    return length;
+}
 
-    /** check if the node is valid; if yes, then load the inode */
-    if(loadInode(inumber, &node)) {
-        node.available = false;
-        node.size = 0;
+bool MyFS::promoteInline(Inode &node, WriteStream &state) {
+    Inode inlined = node;
 
-        /** 
-         * Decrement the corresponding inode block in inode counter 
-         * if the inode counter decreases to 0, then set the free bit map to false */ 
-        if(!(--inodeCounter[inumber / Config::INODES_PER_BLOCK])) {
-            freeBlocks[inumber / Config::INODES_PER_BLOCK + 1] = false;
-        }
+    /** the inline bytes start the first cluster, stored right away so a full volume leaves them inline */
+    if(metaData.compression) {
+        memset(node.inlineData, 0, sizeof(node.inlineData));
+        node.flags = Inode::TREE | Inode::COMPRESSED;
+        node.setFileSize(0);
 
-        /** Free direct blocks */
-        for(uint32_t i = 0; i < Config::POINTERS_PER_INODE; i++) {
-            freeBlocks[node.directBlocks[i]] = false;
-            node.directBlocks[i] = 0;
-        }
+        state.clusterData.assign((size_t)geometry.clusterBlocks * geometry.blockSize, 0);
+        memcpy(state.clusterData.data(), inlined.inlineData, inlined.size);
+        state.cluster = 0;
+        state.clusterEnd = inlined.size;
+        state.clusterDirty = inlined.size > 0;
 
-        /** Free indirect blocks */
-        if(node.indirectBlock) {
-            Block indirect;
-            mountedDisk->readBlock(node.indirectBlock, indirect.data);
-            freeBlocks[node.indirectBlock] = false;
-            node.indirectBlock = 0;
-
-            for(uint32_t i = 0; i < Config::POINTERS_PER_BLOCK; i++) {
-                if(indirect.pointers[i]) {
-                    freeBlocks[indirect.pointers[i]] = false;
-                }
-            }
+        if(!storeCluster(node, state)) {
+            node = inlined;
+            state.forget();
+            return false;
         }
 
-        Block block;
-        mountedDisk->readBlock(inumber / Config::INODES_PER_BLOCK + 1, block.data);
-        block.inodes[inumber % Config::INODES_PER_BLOCK] = node;
-        mountedDisk->writeBlock(inumber / Config::INODES_PER_BLOCK + 1, block.data);
-
         return true;
     }
-    
-    return false;
-}
 
-ssize_t MyFS::stat(size_t inumber) {
-    if(!mounted) {
-        return -1; 
-    }
+    /** with deduplication every block gets its own pointer, the inline bytes go through the trees */
+    if(metaData.fingerprintBlocks) {
+        memset(node.inlineData, 0, sizeof(node.inlineData));
+        node.flags = Inode::TREE;
+        node.setFileSize(0);
 
-    /** load inode; if valid, return its size */
-    Inode node;
-    if(loadInode(inumber, &node)) {
-        return node.size;
+        if(writeDeduplicated(node, state, inlined.inlineData, inlined.size, 0) < (ssize_t)inlined.size) {
+            node = inlined;
+            return false;
+        }
+
+        return true;
     }
 
-    return -1;
-}
+    node.flags = Inode::EXTENTS;
+    memset(node.inlineData, 0, sizeof(node.inlineData));
+    if(!inlined.size) {
+        return true;
+    }
 
-void MyFS::readDataFromOffset(uint32_t blocknum, int offset, int *length, char **data, char **ptr) {
-    /** read the block from disk and change the pointers accordingly */
-    mountedDisk->readBlock(blocknum, *ptr);
+    std::vector<Extent> extents;
+    if(!growExtents(node, extents, 1)) {
+        node = inlined;
+        return false;
+    }
 
-    *data += offset;
-    *ptr += Config::BLOCK_SIZE;
-    *length -= (Config::BLOCK_SIZE - offset);
+    Block block(geometry.blockSize);
+    memset(block.data, 0, geometry.blockSize);
+    memcpy(block.data, inlined.inlineData, inlined.size);
+    writeBlock(extents[0].start, block.data);
+    counters.dataBlocksWritten++;
+    storeExtents(node, extents);
 
-    return;
+    return true;
 }
 
-ssize_t MyFS::read(size_t inumber, char *data, int length, size_t offset) {
-
-    /** sanity check */
-    if (!mounted) {
-        return -1;
-    }
-
-    /** IMPORTANT: start reading from index = offset */
-    int size_inode = stat(inumber);
-    
-    /** if offset is greater than size of inode, then no data can be read 
-     * if length + offset exceeds the size of inode, adjust length accordingly
-    **/
-    if((int)offset >= size_inode) {
-        return 0;
-    } else if(length + (int)offset > size_inode) {
-        length = size_inode - offset;
+ssize_t MyFS::writePointers(Inode &node, WriteStream &state, char *data, int length, size_t offset) {
+    int written = 0;
+    if(length <= 0) {
+        return written;
     }
 
-    /** 
-     * Data is head. 
-     * ptr is tail. 
+    /**
+     * Whole blocks are written straight from data.
+     * Partial blocks keep what they held around the new data, new ones start zeroed.
      **/
-    char *ptr = data;     
-    int readByte = length;
-
-    /** load inode; if invalid, return error */
-    Inode node;
-    if(loadInode(inumber, &node)) {
-        /** the offset is within direct pointers */
-        if(offset < Config::POINTERS_PER_INODE * Config::BLOCK_SIZE) {
-            /** calculate the node to start reading from */
-            uint32_t direct_node = offset / Config::BLOCK_SIZE;
-            offset %= Config::BLOCK_SIZE;
-
-            /** check if the direct node is valid */ 
-            if(node.directBlocks[direct_node]) {
-                readDataFromOffset(node.directBlocks[direct_node++], offset, &length, &data, &ptr);
-                /** read the direct blocks */
-                while(length > 0 && direct_node < Config::POINTERS_PER_INODE && node.directBlocks[direct_node]) {
-                    readDataFromOffset(node.directBlocks[direct_node++], 0, &length, &data, &ptr);
-                }
-
-                /** if length <= 0, then enough data has been read */
-                if(length <= 0) {
-                    return readByte;
-                } else {
+    Block zero(geometry.blockSize);
+    memset(zero.data, 0, geometry.blockSize);
+    Block bounce[2] = { Block(geometry.blockSize), Block(geometry.blockSize) };
+    std::vector<BlockRequest> &requests = state.requests;
+    requests.clear();
+
+    /** the indirect block is read once per stream, then the partial blocks, all before anything is allocated */
+    uint64_t first = offset / geometry.blockSize;
+    uint64_t last = (offset + length - 1) / geometry.blockSize;
+    if(last >= Config::POINTERS_PER_INODE && !state.indirectLoaded && node.indirectBlock) {
+        Block indirect(geometry.blockSize);
+        if(!readBlock(node.indirectBlock, indirect.data)) {
+            return -1;
+        }
+        state.indirect.assign(indirect.pointers, indirect.pointers + geometry.pointersPerBlock);
+        state.indirectLoaded = true;
+    }
+
+    uint32_t mapped[2] = { 0, 0 };
+    bool held[2];
+    for(int slot = 0; slot < 2; slot++) {
+        uint64_t i = slot ? last : first;
+        if(i < Config::POINTERS_PER_INODE) {
+            mapped[slot] = node.directBlocks[i];
+        } else if(state.indirectLoaded) {
+            mapped[slot] = state.indirect[i - Config::POINTERS_PER_INODE];
+        }
+    }
+    if(!readEdges(offset, length, mapped, bounce, held)) {
+        return -1;
+    }
 
-                    /** check if all the direct nodes have been read completely 
-                     *  and if the indirect pointer is valid
-                    */
-                    if (direct_node == Config::POINTERS_PER_INODE && node.indirectBlock) {
-                        Block indirect;
-                        mountedDisk->readBlock(node.indirectBlock, indirect.data);
-
-                        /** read the indirect nodes */
-                        for(uint32_t i = 0; i < Config::POINTERS_PER_BLOCK; i++) {
-                            if(indirect.pointers[i] && length > 0) {
-                                readDataFromOffset(indirect.pointers[i], 0, &length, &data, &ptr);
-                            }
-                            else break;
-                        }
-
-                        /** if length <= 0, then enough data has been read */
-                        if(length <= 0) {
-                            return readByte;
-                        } else {
-                            /** data exhausted but the length requested was more */
-                            /** logically, this should never print */
-                            return (readByte - length);
-                        }
-                    }
-                    else {
-                        /** data exhausted but the length requested was more */
-                        /** logically, this should never print */
-                        return (readByte - length);
-                    }
+    /** blocks between the end of the file and the write are zeroed, reads stop at the first missing one */
+    uint64_t end = ((uint64_t)node.size + geometry.blockSize - 1) / geometry.blockSize;
+    for(uint64_t i = std::min(first, end); i <= last; i++) {
+        uint32_t *pointer;
+        if(i < Config::POINTERS_PER_INODE) {
+            pointer = &node.directBlocks[i];
+        } else {
+            /** a file without an indirect block starts one */
+            if(!state.indirectLoaded) {
+                node.indirectBlock = allocateBlock();
+                if(!node.indirectBlock) {
+                    break;
                 }
+                state.indirect.assign(geometry.pointersPerBlock, 0);
+                state.indirectDirty = true;
+                state.indirectLoaded = true;
             }
-            else {
-                /** inode has no stored data */
-                return 0;
+            pointer = &state.indirect[i - Config::POINTERS_PER_INODE];
+        }
+
+        /** a full volume ends the write early */
+        bool fresh = !*pointer;
+        if(fresh) {
+            *pointer = allocateBlock();
+            if(!*pointer) {
+                break;
             }
-        } else {
-            /** offset begins in the indirect block */
-            /** check if the indirect node is valid */
-            if(node.indirectBlock) {
-                /** change offset accordingly and find the indirect node to start reading from */
-                offset -= (Config::POINTERS_PER_INODE * Config::BLOCK_SIZE);
-                uint32_t indirect_node = offset / Config::BLOCK_SIZE;
-                offset %= Config::BLOCK_SIZE;
+            state.indirectDirty |= i >= Config::POINTERS_PER_INODE;
+        }
 
-                Block indirect;
-                mountedDisk->readBlock(node.indirectBlock, indirect.data);
+        if(i < first) {
+            if(fresh) {
+                BlockRequest request = { *pointer, zero.data };
+                requests.push_back(request);
+            }
+            continue;
+        }
 
-                if(indirect.pointers[indirect_node] && length > 0) {
-                    readDataFromOffset(indirect.pointers[indirect_node++], offset, &length, &data, &ptr);
-                }
+        size_t begin = (i == first) ? offset % geometry.blockSize : 0;
+        size_t stop = (i == last) ? (offset + length - 1) % geometry.blockSize + 1 : geometry.blockSize;
+        char *source = data + written;
 
-                /** Iterate through the indirect nodes */
-                for(uint32_t i = indirect_node; i < Config::POINTERS_PER_BLOCK; i++) {
-                    if(indirect.pointers[i] && length > 0) {
-                        readDataFromOffset(indirect.pointers[i], 0, &length, &data, &ptr);
-                    }
-                    else break;
-                }
-                
-                /** if length <= 0, then enough data has been read */
-                if(length <= 0) {
-                    return readByte;
-                } else {
-                    /** data exhausted but the length requested was more */
-                    /** logically, this should never print */
-                    return (readByte - length);
-                }
-            }
-            else {
-                /** the indirect node is invalid */
-                return 0;
+        if(begin == 0 && stop == geometry.blockSize) {
+            BlockRequest request = { *pointer, source };
+            requests.push_back(request);
+        } else {
+            int slot = (i == first) ? 0 : 1;
+            Block &partial = bounce[slot];
+            if(!held[slot]) {
+                memset(partial.data, 0, geometry.blockSize);
             }
-        }
-    }
 
-    return -1;
-}
+            memcpy(partial.data + begin, source, stop - begin);
+            BlockRequest request = { *pointer, partial.data };
+            requests.push_back(request);
+        }
 
-uint32_t MyFS::allocateBlock() {
-    if(!mounted) {
-        return 0;
-    } 
+        written += stop - begin;
+    }
 
-    /** Loop through the free bit map and allocate the first free block */
-    for(uint32_t i = metaData.inodeBlocks + 1; i < metaData.blocks; i++) {
-        if (freeBlocks[i] == 0) {
-            freeBlocks[i] = true;
+    /** data first, the indirect block and the inode that point to it go with storeStream() */
+    writeBlocks(requests);
+    counters.dataBlocksWritten += requests.size();
 
-            return (uint32_t)i;
-        }
+    if(written > 0) {
+        node.size = std::max((size_t)node.size, offset + written);
     }
 
-    /** Volume is full */
-    return 0;
+    return written;
 }
 
+bool MyFS::storeStream(WriteStream &state, Inode &node) {
+    /** the cluster goes first, it may change the trees */
+    bool stored = storeCluster(node, state);
 
-ssize_t MyFS::writeAndReturnSize(size_t inumber, Inode* node, int ret) {
-    if(!mounted) {
-        return -1;
+    if(state.extentsDirty) {
+        storeExtents(node, state.extents);
+        state.extentsDirty = false;
     }
 
-    /** Find index of inode in the inode table */
-    int blockId = inumber / Config::INODES_PER_BLOCK;
-    int blockOffset = inumber % Config::INODES_PER_BLOCK;
-
-    /** store the node into the block */
-    Block block;
-    mountedDisk->readBlock(blockId + 1, block.data);
+    if(state.indirectDirty) {
+        Block indirect(geometry.blockSize);
+        std::copy(state.indirect.begin(), state.indirect.end(), indirect.pointers);
+        writeBlock(node.indirectBlock, indirect.data);
+        state.indirectDirty = false;
+    }
 
-    block.inodes[blockOffset] = *node;
-    mountedDisk->writeBlock(blockId + 1, block.data);
+    storeTree(state.tree);
 
-    return (ssize_t)ret;
+    return stored;
 }
 
-
-void MyFS::readBuffer(int offset, int *read, int length, char *data, uint32_t blockId) {
-    if(!mounted) {
+void MyFS::syncStream() {
+    if(writeStream.inumber < 0) {
         return;
     }
-    
-    /** allocate memory to ptr which acts as buffer for reading from disk */
-    char* ptr = (char *)calloc(Config::BLOCK_SIZE, sizeof(char));
-
-    /** read data into ptr and change pointers accordingly */ 
-    for(int i = offset; i < (int)Config::BLOCK_SIZE && *read < length; i++) {
-        ptr[i] = data[*read];
-        *read = *read + 1;
-    }
-    mountedDisk->writeBlock(blockId, ptr);
 
-    /** free the allocated memory */
-    free(ptr);
+    storeStream(writeStream, *writeStream.node);
 
-    return;
+    /** the inode stays pinned: a second reference, dropped dirty, queues it for write-back */
+    inodeCache.acquire(writeStream.inumber);
+    inodeCache.release(writeStream.inumber, true);
 }
 
-
-bool MyFS::checkAllocation(Inode* node, int read, int offset, uint32_t &blocknum, 
-        bool write_indirect, Block indirect) {
+bool MyFS::openStream(size_t inumber) {
     if(!mounted) {
         return false;
     }
-    
-    /** if blocknum is 0, then allocate a new block */
-    if(!blocknum) {
-        blocknum = allocateBlock();
 
-        /** set size of node and write back to disk if it is an indirect node */
-        if (!blocknum) {
-            node->size = read + offset;
+    closeStream();
 
-            if(write_indirect) {
-                mountedDisk->writeBlock(node->indirectBlock, indirect.data);
-            }
+    Inode *node = pinInode(inumber);
+    if(!node) {
+        return false;
+    }
 
-            return false;
-        }
+    if(!node->available) {
+        initInode(*node);
+        useInode(inumber);
     }
 
+    writeStream.reset(inumber, node);
     return true;
 }
 
-
-ssize_t MyFS::write(size_t inumber, char *data, int length, size_t offset) {
-    if(!mounted) {
-        return -1;
+bool MyFS::closeStream() {
+    if(writeStream.inumber < 0) {
+        return true;
     }
-    
-    Inode node;
-    Block indirect;
-    int read = 0;
-    int orig_offset = offset;
 
-    /** insufficient size */
-    if (length + offset > (Config::POINTERS_PER_BLOCK + Config::POINTERS_PER_INODE) * Config::BLOCK_SIZE) {
-        return -1;
-    }
+    size_t inumber = writeStream.inumber;
+    bool stored = storeStream(writeStream, *writeStream.node);
 
-    /**
-     *  if the inode is invalid, allocate inode.
-     *  need not write to disk right now; will be taken care of in write_ret()
-     */
-    if (!loadInode(inumber, &node)) {
-        node.available = true;
-        node.size = length + offset;
-        for(uint32_t ii = 0; ii < Config::POINTERS_PER_INODE; ii++) {
-            node.directBlocks[ii] = 0;
-        }
-        node.indirectBlock = 0;
-        inodeCounter[inumber / Config::INODES_PER_BLOCK]++;
-        freeBlocks[inumber / Config::INODES_PER_BLOCK + 1] = true;
-    }
-    else {
-        /** set size of the node */
-        node.size = std::max((int)node.size, length + (int)offset);
-    }
-
-    /** check if the offset is within direct pointers */
-    if(offset < Config::POINTERS_PER_INODE * Config::BLOCK_SIZE) {
-        /** find the first node to start writing at and change offset accordingly */
-        int direct_node = offset / Config::BLOCK_SIZE;
-        offset %= Config::BLOCK_SIZE;
-
-        /** check if the node is valid; if invalid; allocates a block and if no block is available, returns false */
-        if(!checkAllocation(&node, read, orig_offset, node.directBlocks[direct_node], false, indirect)) { 
-            return writeAndReturnSize(inumber, &node, read);
-        }
-        /** read from data buffer */       
-        readBuffer(offset, &read, length, data, node.directBlocks[direct_node++]);
-
-        /** enough data has been read from data buffer */
-        if(read == length) {
-            return writeAndReturnSize(inumber, &node, length);
-        } else {
-            /**
-             * Store in direct pointers till either one of the two things happen:
-             * 1. all the data is stored in the direct pointers
-             * 2. the data is stored in indirect pointers
-            **/
-
-            /** start writing into direct nodes */
-            for(int i = direct_node; i < (int)Config::POINTERS_PER_INODE; i++) {
-                /** check if the node is valid; if invalid; allocates a block and if no block is available, returns false */
-                if(!checkAllocation(&node, read, orig_offset, node.directBlocks[direct_node], false, indirect)) { 
-                    return writeAndReturnSize(inumber, &node, read);
-                }
-                readBuffer(0, &read, length, data, node.directBlocks[direct_node++]);
+    /** reset first: unpinning may flush, and the flush must not find the stream open */
+    writeStream.reset(-1, NULL);
+    unpinInode(inumber, true);
 
-                /** enough data has been read from data buffer */
-                if(read == length) {
-                    return writeAndReturnSize(inumber, &node, length);
-                }
-            }
+    return stored;
+}
 
-            /** check if the indirect node is valid */
-            if(node.indirectBlock) {
-                mountedDisk->readBlock(node.indirectBlock, indirect.data);
-            } else {
-                /** check if the node is valid; if invalid; allocates a block and if no block is available, returns false */
-                if(!checkAllocation(&node, read, orig_offset, node.indirectBlock, false, indirect)) { 
-                    return writeAndReturnSize(inumber, &node, read);
-                }
-                mountedDisk->readBlock(node.indirectBlock, indirect.data);
+ssize_t MyFS::writeData(Inode &node, WriteStream &state, char *data, int length, size_t offset) {
+    /** a file that outgrows its inode moves its data to a Data Block first */
+    if (node.flags & Inode::INLINE) {
+        if (offset + length <= geometry.inlineBytes) {
+            return writeInline(node, data, length, offset);
+        }
 
-                /** initialise the indirect nodes */
-                for(int i = 0; i < (int)Config::POINTERS_PER_BLOCK; i++) {
-                    indirect.pointers[i] = 0;
-                }
-            }
-            
-            /** write into indirect nodes */
-            for (int j = 0; j < (int)Config::POINTERS_PER_BLOCK; j++) {
-                /** check if the node is valid; if invalid; allocates a block and if no block is available, returns false */
-                if(!checkAllocation(&node, read, orig_offset, indirect.pointers[j], true, indirect)) { 
-                    return writeAndReturnSize(inumber, &node, read);
-                }
-                readBuffer(0, &read, length, data, indirect.pointers[j]);
+        if (!promoteInline(node, state)) {
+            return -1;
+        }
+    }
 
-                /** enough data has been read from data buffer */
-                if(read == length) {
-                    mountedDisk->writeBlock(node.indirectBlock, indirect.data);
-                    return writeAndReturnSize(inumber, &node, length);
-                }
-            }
+    if (node.flags & Inode::COMPRESSED) {
+        return writeCompressed(node, state, data, length, offset);
+    }
 
-            /** space exhausted */
-            mountedDisk->writeBlock(node.indirectBlock, indirect.data);
-            return writeAndReturnSize(inumber, &node, read);
+    /** 
+     * Files outgrow their extents past 32-bit sizes or once the extent table is full,
+     * and their block pointers past the indirect block: they move to tree-mapped inodes.
+     **/
+    ssize_t done = 0;
+    if ((node.flags & Inode::EXTENTS) && offset + length <= UINT32_MAX) {
+        done = writeExtents(node, state, data, length, offset);
+        if (done < 0 || done == length 
+            || state.extents.size() < Config::EXTENTS_PER_INODE + geometry.extentsPerBlock) {
+            return done;
         }
-    } else {
-        /** find the first indirect node to write into and change offset accordingly */
-        offset -= (Config::BLOCK_SIZE * Config::POINTERS_PER_INODE);
-        int indirect_node = offset / Config::BLOCK_SIZE;
-        offset %= Config::BLOCK_SIZE;
 
-        /** check if the indirect node is valid */
-        if(node.indirectBlock) {
-            mountedDisk->readBlock(node.indirectBlock, indirect.data);
-        } else {
-            /** check if the node is valid; if invalid; allocates a block and if no block is available, returns false */
-            if(!checkAllocation(&node, read, orig_offset, node.indirectBlock, false, indirect)) { 
-                return writeAndReturnSize(inumber, &node, read);
-            }
-            mountedDisk->readBlock(node.indirectBlock, indirect.data);
+        data += done;
+        length -= done;
+        offset += done;
+    }
 
-            /** initialise the indirect nodes */
-            for(int i = 0; i < (int)Config::POINTERS_PER_BLOCK; i++) {
-                indirect.pointers[i] = 0;
-            }
+    if (!(node.flags & Inode::TREE) && ((node.flags & Inode::EXTENTS)
+        || length + offset > (geometry.pointersPerBlock + Config::POINTERS_PER_INODE) * geometry.blockSize)) 
+    {
+        /** the conversion reads the block map back from the volume */
+        storeStream(state, node);
+        if (!convertToTree(node)) {
+            return done ? done : -1;
         }
+        state.forget();
+    }
 
-        /** check if the node is valid; if invalid; allocates a block and if no block is available, returns false */
-        if(!checkAllocation(&node, read, orig_offset, indirect.pointers[indirect_node], true, indirect)) { 
-            return writeAndReturnSize(inumber, &node, read);
+    if (node.flags & Inode::TREE) {
+        ssize_t rest = metaData.fingerprintBlocks ? writeDeduplicated(node, state, data, length, offset)
+            : writeTree(node, state, data, length, offset);
+        if (rest < 0) {
+            return done ? done : -1;
         }
-        readBuffer(offset, &read, length, data, indirect.pointers[indirect_node++]);
+        return done + rest;
+    }
 
-        /** enough data has been read from data buffer */
-        if(read == length) {
-            mountedDisk->writeBlock(node.indirectBlock, indirect.data);
-            return writeAndReturnSize(inumber, &node, length);
-        } else {
-            for(int j = indirect_node; j < (int)Config::POINTERS_PER_BLOCK; j++) {
-                /** check if the node is valid; if invalid; allocates a block and if no block is available, returns false */
-                if(!checkAllocation(&node, read, orig_offset, indirect.pointers[j], true, indirect)) { 
-                    return writeAndReturnSize(inumber, &node, read);
-                }
-                readBuffer(0, &read, length, data, indirect.pointers[j]);
+    return writePointers(node, state, data, length, offset);
+}
 
-                /** enough data has been read from data buffer */
-                if(read == length) {
-                    mountedDisk->writeBlock(node.indirectBlock, indirect.data);
-                    return writeAndReturnSize(inumber, &node, length);
-                }
-            }
+ssize_t MyFS::write(size_t inumber, char *data, int length, size_t offset) {
+    if(!mounted) {
+        return -1;
+    }
 
-            /** space exhausted */
-            mountedDisk->writeBlock(node.indirectBlock, indirect.data);
-            return writeAndReturnSize(inumber, &node, read);
-        }
+    /** Block pointers read ahead for this file may be about to change */
+    if((ssize_t)inumber == readAhead.inumber) {
+        readAhead.reset(-1);
     }
-  
-    return -1;
+
+    /** the open stream already holds the inode and its block map */
+    if((ssize_t)inumber == writeStream.inumber) {
+        return writeData(*writeStream.node, writeStream, data, length, offset);
+    }
+
+    /** 
+     * Any other write is a stream of its own: the inode is changed in the inode cache,
+     * where it waits for the next write-back, and its block map is stored right away.
+     **/
+    Inode *node = pinInode(inumber);
+    if(!node) {
+        return -1;
+    }
+
+    if(!node->available) {
+        initInode(*node);
+        useInode(inumber);
+    }
+
+    WriteStream single;
+    ssize_t done = writeData(*node, single, data, length, offset);
+    storeStream(single, *node);
+    unpinInode(inumber, true);
+
+    return done;
 }
 
 bool MyFS::setPassword(){
@@ -777,7 +2901,6 @@ bool MyFS::setPassword(){
     }
 
     char pass[1000], line[1000];
-    Block block;
 
     /**  Effort to get new password  */
     printf("Enter new password: ");
@@ -789,15 +2912,14 @@ bool MyFS::setPassword(){
     /**  Using SHA-256 to hashing password  */
     Hasher hasher;
     hasher.update(pass);
-    uint8_t * digest = hasher.digest();
+    uint8_t digest[Hasher::DIGEST_SIZE];
+    hasher.digest(digest);
     
     metaData.protect = 1;
     strcpy(metaData.password, Hasher::toString(digest).c_str());
-    delete[] digest;
     
     /** Save changed file system to Volume */
-    block.metaBlock = metaData;
-    mountedDisk->writeBlock(0, block.data);
+    syncMetaBlock();
     printf("New password set.\n");
 
     return true;
@@ -818,13 +2940,13 @@ bool MyFS::changePassword(){
         
         Hasher hasher;
         hasher.update(pass);
-        uint8_t * digest = hasher.digest();
+        uint8_t digest[Hasher::DIGEST_SIZE];
+        hasher.digest(digest);
 
         if(Hasher::toString(digest) != std::string(metaData.password)){
             printf("Old password incorrect.\n");
             return false;
         }
-        delete[] digest;
 
         metaData.protect = 0;
     }
@@ -840,7 +2962,6 @@ bool MyFS::removePassword(){
     if (metaData.protect){
         /**  Initializations  */
         char pass[1000], line[1000];
-        Block block;
         
         /**  Get current password  */
         printf("Enter old password: ");
@@ -849,21 +2970,20 @@ bool MyFS::removePassword(){
 
         Hasher hasher;
         hasher.update(pass);
-        uint8_t * digest = hasher.digest();
+        uint8_t digest[Hasher::DIGEST_SIZE];
+        hasher.digest(digest);
         
         /**  Curr password incorrect. Error  */
         if(Hasher::toString(digest) != std::string(metaData.password)){
             printf("Old password incorrect.\n");
             return false;
         }
-        delete[] digest;
         
         /**  Update cached MetaData  */
         metaData.protect = 0;
         
         /**  Write back the changes  */
-        block.metaBlock = metaData;
-        mountedDisk->writeBlock(0, block.data);   
+        syncMetaBlock();
         printf("Password removed successfully.\n");
         
         return true;
@@ -992,12 +3112,16 @@ Directory MyFS::readDirFromOffset(uint32_t offset){
 
     /**   Get offsets and indexes  */
     uint32_t inumber = currentDir.table[offset].inumber;
-    uint32_t blockId = inumber / Config::DIR_PER_BLOCK;
-    uint32_t blockOffset = inumber % Config::DIR_PER_BLOCK;
+    uint32_t blockId = inumber / geometry.dirPerBlock;
+    uint32_t blockOffset = inumber % geometry.dirPerBlock;
     
     /**   Read Block  */
-    Block block;
-    mountedDisk->readBlock(metaData.blocks - 1 - blockId, block.data);
+    Block block(geometry.blockSize);
+    if(!readTableBlock(metaData.blocks - 1 - blockId, block)) {
+        Directory emptyDir; 
+        emptyDir.available = 0;
+        return emptyDir;
+    }
 
     return (block.directories[blockOffset]);
 }
@@ -1006,16 +3130,19 @@ void MyFS::syncDirectory(Directory directory){
     /**   
      * Calculate offset and index  
      **/
-    uint32_t blockId = directory.inumber / Config::DIR_PER_BLOCK;
-    uint32_t blockOffset = directory.inumber % Config::DIR_PER_BLOCK;
+    uint32_t blockId = directory.inumber / geometry.dirPerBlock;
+    uint32_t blockOffset = directory.inumber % geometry.dirPerBlock;
 
-    /**   Get Block from Volume  */
-    Block block;
-    mountedDisk->readBlock(metaData.blocks - 1 - blockId, block.data);
+    /**   Get Block from Volume, a Directory Block failing its sum is not rewritten over  */
+    Block block(geometry.blockSize);
+    if(!readTableBlock(metaData.blocks - 1 - blockId, block)) {
+        return;
+    }
     block.directories[blockOffset] = directory;
 
     /**   Save change of Directory Block  */
-    mountedDisk->writeBlock(metaData.blocks - 1 - blockId, block.data);
+    writeTableBlock(metaData.blocks - 1 - blockId, block);
+    counters.directorySyncs++;
 }
 
 int MyFS::dirLookup(Directory directory,char name[]){
@@ -1044,7 +3171,7 @@ bool MyFS::mkdir(char name[Config::NAME_SIZE]){
     /**   Find empty dirblock  */
     uint32_t blockId = 0;
     for(; blockId < metaData.dirBlocks; blockId++) {
-        if(dirCounter[blockId] < Config::DIR_PER_BLOCK)
+        if(dirCounter[blockId] < geometry.dirPerBlock)
             break;
     }
 
@@ -1054,18 +3181,20 @@ bool MyFS::mkdir(char name[Config::NAME_SIZE]){
     }
 
     /**   Read empty dirblock  */
-    Block block;
-    mountedDisk->readBlock(metaData.blocks - 1 - blockId, block.data);
+    Block block(geometry.blockSize);
+    if(!readTableBlock(metaData.blocks - 1 - blockId, block)) {
+        return false;
+    }
 
     /**   Find empty directory in dirblock  */
     uint32_t offset = 0;
-    for(; offset < Config::DIR_PER_BLOCK; offset++) {
+    for(; offset < geometry.dirPerBlock; offset++) {
         if(block.directories[offset].available == 0) {
             break;
         }
     }
     
-    if(offset == Config::DIR_PER_BLOCK) { 
+    if(offset == geometry.dirPerBlock) { 
         printf("Error in creating directory.\n"); 
         return false;
     }
@@ -1073,7 +3202,7 @@ bool MyFS::mkdir(char name[Config::NAME_SIZE]){
     /**   Create new directory  */
     Directory newDirectory, temp;
     memset(&newDirectory, 0, sizeof(Directory));
-    newDirectory.inumber = blockId * Config::DIR_PER_BLOCK + offset;
+    newDirectory.inumber = blockId * geometry.dirPerBlock + offset;
     newDirectory.available = 1;
     strcpy(newDirectory.name, name);
     
@@ -1131,11 +3260,14 @@ Directory MyFS::removeDirectory(Directory parent, char name[]) {
 
     /**  Get block  */
     uint32_t inumber = parent.table[offset].inumber;
-    uint32_t blockId = inumber / Config::DIR_PER_BLOCK;
-    uint32_t blockOffset = inumber % Config::DIR_PER_BLOCK;
+    uint32_t blockId = inumber / geometry.dirPerBlock;
+    uint32_t blockOffset = inumber % geometry.dirPerBlock;
 
-    Block block;
-    mountedDisk->readBlock(metaData.blocks - 1 - blockId, block.data);
+    Block block(geometry.blockSize);
+    if(!readTableBlock(metaData.blocks - 1 - blockId, block)) {
+        dir.available = 0; 
+        return dir;
+    }
 
     /**  Check Directory  */
     dir = block.directories[blockOffset];
@@ -1167,12 +3299,15 @@ Directory MyFS::removeDirectory(Directory parent, char name[]) {
     }
 
     /**  Read the block again, because the block may have changed by DirEntry  */
-    mountedDisk->readBlock(metaData.blocks - 1 - blockId, block.data);
+    if(!readTableBlock(metaData.blocks - 1 - blockId, block)) {
+        dir.available = 0; 
+        return dir;
+    }
 
     /**  Write down change of directory  */
     dir.available = 0;
     block.directories[blockOffset] = dir;
-    mountedDisk->writeBlock(metaData.blocks - 1 - blockId, block.data);
+    writeTableBlock(metaData.blocks - 1 - blockId, block);
 
     /**  Remove it from the parent  */
     parent.table[offset].available = 0;
@@ -1341,6 +3476,17 @@ void MyFS::exit(){
         return;
     }
 
+    stopScrub();
+    closeStream();
+    flushInodes();
+    inodeCache.clear();
+
+    /** with every inode and bitmap written back the next mount can skip the scan */
+    if(metaData.blockBitmapBlocks) {
+        metaData.state = MetaBlock::CLEAN;
+        syncMetaBlock();
+    }
+
     mountedDisk->unmount();
     mounted = false;
     mountedDisk = nullptr;
@@ -1368,20 +3514,28 @@ bool MyFS::outport(char name[],const char *path) {
     	return false;
     }
 
-    /** Read from the inode and write it to the File */
-    char buffer[4*BUFSIZ] = { 0 };
+    /** Read from the inode and write it to the File, through an aligned buffer */
+    PooledBuffer pooled(4 * BUFSIZ);
+    char *buffer = pooled.data();
     uint32_t inumber = currentDir.table[offset].inumber;
-    offset = 0;
+    size_t copied = 0;
     while (true) {
-    	ssize_t result = read(inumber, buffer, sizeof(buffer), offset);
-    	if (result <= 0) {
+    	ssize_t result = read(inumber, buffer, pooled.size(), copied);
+    	if (result < 0) {
+    	    /** A block failed its checksum, it was reported by the read: leave no partial copy behind */
+    	    fprintf(stderr, "Unable to copy %s: corrupt block at byte %zu\n", name, copied);
+    	    fclose(stream);
+    	    unlink(path);
+    	    return false;
+    	}
+    	if (result == 0) {
     	    break;
 		}
 		fwrite(buffer, 1, result, stream);
-		offset += result;
+		copied += result;
     }
     
-    printf("%d bytes copied\n", offset);
+    printf("%zu bytes copied\n", copied);
     fclose(stream);
 
     return true;
@@ -1411,31 +3565,43 @@ bool MyFS::import(const char *path, char name[]) {
     	return false;
     }
 
-    /** Read File and get the Data */
-    char buffer[4 * BUFSIZ] = {0};
+    /** 
+     * Read File and get the Data, through an aligned buffer.
+     * The inode and its block map stay in memory until the whole File is in.
+     **/
+    PooledBuffer pooled(4 * BUFSIZ);
+    char *buffer = pooled.data();
     uint32_t inumber = currentDir.table[offset].inumber;
-    offset = 0;
+    if (!openStream(inumber)) {
+        fclose(stream);
+        return false;
+    }
+
+    size_t copied = 0;
     while (true) {
-    	ssize_t result = fread(buffer, 1, sizeof(buffer), stream);
+    	ssize_t result = fread(buffer, 1, pooled.size(), stream);
     	if (result <= 0) {
     	    break;
 	    }
 
-        ssize_t actual = write(inumber, buffer, result, offset);
+        ssize_t actual = write(inumber, buffer, result, copied);
         if (actual < 0) {
             fprintf(stderr, "fs.write returned invalid result %ld\n", actual);
             break;
         }
 
         /** Checks to ensure proper write */
-        offset += actual;
+        copied += actual;
         if (actual != result) {
             fprintf(stderr, "fs.write only wrote %ld bytes, not %ld bytes\n", actual, result);
             break;
         }
     }
     
-    printf("%d bytes copied\n", offset);
+    if (!closeStream()) {
+        fprintf(stderr, "fs.write could not store the end of the file, the volume is full\n");
+    }
+    printf("%zu bytes copied\n", copied);
     fclose(stream);
     
     return true;
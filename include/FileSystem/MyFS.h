@@ -1,36 +1,417 @@
 #ifndef FILE_SYSTEM_H
 #define FILE_SYSTEM_H
 
+#include <atomic>
 #include <cstring>
+#include <functional>
+#include <mutex>
 #include <stdint.h>
+#include <set>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include "VolumeEmulator/Volume.h"
+#include "DataStructure/Bitmap.h"
 #include "DataStructure/Block.h"
+#include "DataStructure/Geometry.h"
+#include "FileSystem/ChecksumTable.h"
+#include "FileSystem/FingerprintIndex.h"
+#include "FileSystem/InodeCache.h"
+
+/**
+ * @brief Counters of the file system, to tell metadata traffic from data I/O.
+ **/
+struct FsStats
+{
+    uint64_t inodeLoads;        // Inodes read from the inode table
+    uint64_t inodeStores;       // Inodes written back to the inode table
+    uint64_t inodeCacheHits;    // Inodes found in the inode cache
+    uint64_t inodeAllocations;
+    uint64_t inodeFrees;
+    uint64_t blockAllocations;
+    uint64_t directorySyncs;    // Directories rewritten in the directory table
+    uint64_t metaBlockSyncs;
+    uint64_t tableReads;        // Inode and Directory Blocks read from the volume
+    uint64_t tableWrites;       // Inode and Directory Blocks written to the volume
+    uint64_t dataBlocksRead;
+    uint64_t dataBlocksWritten;
+    uint64_t blocksPrefetched;  // Data and indirect blocks asked for ahead of sequential reads
+    uint64_t pointerReads;      // Pointer blocks read while walking tree-mapped inodes
+    uint64_t bitmapWrites;      // Bitmap Blocks written back
+    uint64_t tableScans;        // Mounts that had to rebuild the bitmaps from the inode table
+    uint64_t clustersCompressed;    // Clusters of compressed files written compressed
+    uint64_t clustersRaw;           // Clusters written as they are, they did not compress
+    uint64_t blocksSaved;           // Data Blocks compression spared the clusters written
+    uint64_t blocksDeduplicated;    // Data Blocks pointed at a block already holding their data, not written
+    uint64_t fingerprintWrites;     // Fingerprint Blocks written back
+    uint64_t checksumErrors;        // Blocks read that did not match their sum
+    uint64_t checksumWrites;        // Checksum Blocks written back
+
+    FsStats() { reset(); }
+
+    void reset() { memset(this, 0, sizeof(FsStats)); }
+};
+
+/**
+ * @brief Progress of the background scrub started last.
+ **/
+struct ScrubStats
+{
+    bool running;
+    uint64_t blocksTotal;       // Blocks in use when it started
+    uint64_t blocksScrubbed;
+    uint64_t blocksCorrupt;     // Blocks that did not match their sum
+};
 
 class MyFS {
 private:
+    /**
+     * @brief Pointer blocks on the path last walked down the trees of a tree-mapped inode, one per level.
+     * @brief A walk only reads the levels where its path leaves the previous one.
+     **/
+    struct TreeCursor
+    {
+        uint32_t blocks[Config::TREE_LEVELS];               // Pointer block held at each level, 0 for none
+        bool dirty[Config::TREE_LEVELS];                    // Changed since it was read
+        std::vector<uint32_t> pointers[Config::TREE_LEVELS];
+
+        TreeCursor() { reset(); }
+
+        void reset() {
+            for(uint32_t level = 0; level < Config::TREE_LEVELS; level++) {
+                blocks[level] = 0;
+                dirty[level] = false;
+            }
+        }
+    };
+
+    /**
+     * @brief Sequential access detection for the file read last.
+     **/
+    struct ReadAhead
+    {
+        ssize_t inumber;
+        size_t nextOffset;              // Where the next read continues a sequential scan
+        uint32_t window;                // Blocks read ahead, doubled by every sequential read
+        uint64_t until;                 // First file block not asked for yet
+        bool indirectRequested;         // The indirect block is on its way
+        std::vector<uint32_t> indirect; // Pointers of the indirect block, once read
+        std::vector<Extent> extents;    // Extents of an extent-mapped file, once read
+        std::vector<uint32_t> firsts;   // First file block of each extent
+        TreeCursor tree;                // Pointer blocks of a tree-mapped file
+        uint64_t cluster;               // Cluster of a compressed file held decoded, UINT64_MAX for none
+        std::vector<char> clusterData;
+
+        ReadAhead() { reset(-1); }
+
+        void reset(ssize_t inumber) {
+            this->inumber = inumber;
+            nextOffset = 0;
+            window = 0;
+            until = 0;
+            indirectRequested = false;
+            indirect.clear();
+            extents.clear();
+            firsts.clear();
+            tree.reset();
+            cluster = UINT64_MAX;
+        }
+    };
+
+    /**
+     * @brief Block map of the file being written, kept in memory between writes.
+     * @brief A write loads what it needs, storeStream() writes back what changed.
+     **/
+    struct WriteStream
+    {
+        ssize_t inumber;                    // File held open by openStream(), -1 for a single write
+        Inode *node;                        // Its inode, pinned in the inode cache
+        bool extentsLoaded;
+        bool extentsDirty;
+        std::vector<Extent> extents;        // Extents of an extent-mapped file
+        bool indirectLoaded;
+        bool indirectDirty;
+        std::vector<uint32_t> indirect;     // Pointers of the indirect block of a block-mapped file
+        TreeCursor tree;                    // Pointer blocks of a tree-mapped file
+        uint64_t cluster;                   // Cluster of a compressed file being filled, UINT64_MAX for none
+        size_t clusterEnd;                  // Bytes of the cluster that belong to the file
+        bool clusterDirty;
+        std::vector<char> clusterData;      // Its bytes, compressed once the writes leave it
+        std::vector<BlockRequest> requests; // Data Blocks of one write, reused by the next
+        std::vector<const uint8_t*> contents; // Data Blocks of one write to a deduplicated file, as they will read
+        std::vector<uint8_t> digests;       // and their digests
+
+        WriteStream() { reset(-1, NULL); }
+
+        void reset(ssize_t inumber, Inode *node) {
+            this->inumber = inumber;
+            this->node = node;
+            forget();
+        }
+
+        /** Drop the block map, once stored, when the file changes how it is mapped */
+        void forget() {
+            extentsLoaded = extentsDirty = false;
+            indirectLoaded = indirectDirty = false;
+            extents.clear();
+            indirect.clear();
+            tree.reset();
+            cluster = UINT64_MAX;
+            clusterEnd = 0;
+            clusterDirty = false;
+        }
+    };
+
     /** MyFS.Dat */
     Volume* mountedDisk;
 
     /** Metadata for File System */
     MetaBlock metaData;
 
+    /** Layout derived from the block size of the mounted volume */
+    Geometry geometry;
+
     /** Check if file system has mounted */
     bool mounted;
 
-    /** Inode Bitmap emulator **/
-    std::vector<bool> freeBlocks;
+    /** Block bitmap, a set bit marks a block in use **/
+    Bitmap freeBlocks;
     std::vector<int> inodeCounter;
 
+    /** Inode bitmap, a set bit marks an inode in use **/
+    Bitmap usedInodes;
+
+    /** No inode below it is free */
+    size_t inodeHint;
+
+    /** Bitmap Blocks that changed since they were last written */
+    std::set<uint32_t> dirtyBitmaps;
+
+    /** Digests and sharing of the Data Blocks, on volumes with deduplication */
+    FingerprintIndex fingerprints;
+
+    /** Sum of every block, on volumes with a checksum table */
+    ChecksumTable checksums;
+
+    /** Reads are checked against the sums, except while a crash recovery counts them again */
+    bool checksumsValid;
+
+    /** Taken to change a sum and write its block, so the scrub never sees one without the other */
+    std::mutex checksumLock;
+
+    /** Background scrub, which only reads the sums */
+    struct Scrub
+    {
+        std::thread worker;
+        std::atomic<bool> stop;
+        std::atomic<bool> running;
+        std::atomic<uint64_t> total;
+        std::atomic<uint64_t> scrubbed;
+        std::atomic<uint64_t> corrupt;
+
+        Scrub() : stop(false), running(false), total(0), scrubbed(0), corrupt(0) {}
+    } scrubber;
+
+    /** Inodes read from or waiting to go to the inode table */
+    InodeCache inodeCache;
+
     /** Current directory in travel */
     Directory currentDir;
 
     /** Map for bookkepping existed directory */
     std::vector<uint32_t> dirCounter;
 
+    /** Operations done since mount or the last reset */
+    FsStats counters;
+
+    /** Read-ahead state of the file read last */
+    ReadAhead readAhead;
+
+    /** File held open for a run of writes, see openStream() */
+    WriteStream writeStream;
+
+    /**
+     * @brief Read a block of the inode or directory table.
+     * @brief Blocks left uninitialized by a lazy format come back empty without any I/O.
+     * @return false if the block fails its checksum.
+     **/
+    bool readTableBlock(uint32_t blockNumber, Block &block);
+
+    /**
+     * @brief Write a block of the inode or directory table, initializing the table up to it first.
+     **/
+    void writeTableBlock(uint32_t blockNumber, Block &block);
+
+    /**
+     * @brief Write the cached Meta Block back to the volume.
+     **/
+    void syncMetaBlock();
+
     /**
-     * @brief Create new empty inode.
+     * @brief First Fingerprint Block, right after the bitmaps.
+     **/
+    uint32_t fingerprintStart() const {
+        return 1 + metaData.inodeBlocks + metaData.blockBitmapBlocks + metaData.inodeBitmapBlocks;
+    }
+
+    /**
+     * @brief First Checksum Block, right after the fingerprint index.
+     **/
+    uint32_t checksumStart() const {
+        return fingerprintStart() + metaData.fingerprintBlocks;
+    }
+
+    /**
+     * @brief First block that may hold data, after the inode table, the bitmaps, the fingerprint index
+     * @brief and the checksum table.
+     **/
+    uint32_t dataStart() const {
+        return checksumStart() + metaData.checksumBlocks;
+    }
+
+    /**
+     * @brief Check if a block has a sum: the volume has a checksum table, which does not cover itself.
+     **/
+    bool hasChecksum(uint64_t blockNumber) const {
+        return !checksums.empty() 
+            && (blockNumber < checksumStart() || blockNumber >= checksumStart() + metaData.checksumBlocks);
+    }
+
+    /**
+     * @brief Check if a block holds something a sum must match: metadata written so far
+     * @brief and Data Blocks in use. Skipped table blocks and free Data Blocks do not.
+     **/
+    bool holdsData(uint32_t blockNumber) const;
+
+    /**
+     * @brief Read blocks from the volume and check them against their sums, reporting any mismatch.
+     * @return false if a block did not match, its data is still read.
+     **/
+    bool readBlock(uint64_t blockNumber, char *data);
+    bool readBlocks(uint64_t start, size_t count, char *data);
+    bool readBlocks(std::vector<BlockRequest> &requests);
+
+    /**
+     * @brief Write blocks to the volume, recording their sums.
+     **/
+    void writeBlock(uint64_t blockNumber, char *data);
+    void writeBlocks(std::vector<BlockRequest> &requests);
+
+    /**
+     * @brief Check a block just read against its sum.
+     **/
+    bool verifyBlock(uint64_t blockNumber, const char *data);
+
+    /**
+     * @brief Read the checksum table back from its Checksum Blocks.
+     **/
+    void loadChecksums();
+
+    /**
+     * @brief Write the Checksum Blocks that changed.
+     **/
+    void syncChecksums();
+
+    /**
+     * @brief Sum again every block holding data, the recovery path of mount: 
+     * @brief the table on disk may be older or newer than the blocks. Batches go over the shared thread pool.
+     **/
+    void rebuildChecksums();
+
+    /**
+     * @brief Body of the scrub thread: read runs of blocks at rate bytes per second and check them.
+     **/
+    void scrubRuns(std::vector<std::pair<uint32_t, uint32_t> > runs, size_t rate);
+
+    /**
+     * @brief Rebuild both bitmaps by reading every inode, the recovery path of mount.
+     * @brief Batches of Inode Blocks are spread over the shared thread pool.
+     * @return false if an inode points outside the volume.
+     **/
+    bool scanTables();
+
+    /**
+     * @brief Count the directories of every Directory Block, over the shared thread pool.
+     **/
+    void countDirectories();
+
+    /**
+     * @brief Read both bitmaps back from their Bitmap Blocks.
+     **/
+    void loadBitmaps();
+
+    /**
+     * @brief Write blocks of a table held in memory, each holding bytesPerBlock bytes of it
+     * @brief and padded with zeros. Contiguous ones go with a single call.
+     * @param start First block of the table on the volume.
+     * @param dirty Blocks to write, counted from start, in order.
+     * @param tableBytes Length of table, the last block holds what is left of it.
+     * @return The number of blocks written.
+     **/
+    size_t writeTable(uint32_t start, const std::vector<uint32_t> &dirty, const void *table, 
+        size_t bytesPerBlock, size_t tableBytes);
+
+    /**
+     * @brief Write the Bitmap Blocks that changed.
+     **/
+    void syncBitmaps();
+
+    /**
+     * @brief Read the fingerprint index back from its Fingerprint Blocks.
+     **/
+    void loadFingerprints();
+
+    /**
+     * @brief Write the Fingerprint Blocks that changed.
+     **/
+    void syncFingerprints();
+
+    /**
+     * @brief Count again the pointers to every block of the fingerprint index and hash the block again,
+     * @brief the recovery path of mount: the index on disk may be older than the files.
+     **/
+    void recountFingerprints();
+
+    /**
+     * @brief Drop a pointer to a block, freeing it once no other pointer shares it.
+     **/
+    void dropBlock(uint32_t blockNumber);
+
+    /**
+     * @brief Block a file block with this digest should be in, now pointing at current.
+     * @brief A block already holding the data is shared, else current is rewritten in place
+     * @brief when nothing else points to it, else a new block is allocated.
+     * @param write Set when the data has to be written to the block returned.
+     * @return 0 when the volume is full.
+     **/
+    uint32_t dedupBlock(uint32_t current, const uint8_t *digest, bool &write);
+
+    /**
+     * @brief Remember that the Bitmap Block holding bit of the block or inode bitmap changed.
+     **/
+    void bitmapChanged(bool inodes, size_t bit);
+
+    /**
+     * @brief Mark a block used or free in the block bitmap.
+     **/
+    void useBlock(uint32_t blockNumber);
+    void releaseBlock(uint32_t blockNumber);
+
+    /**
+     * @brief Mark an inode used or free, with the Inode Block that holds it.
+     **/
+    void useInode(size_t inumber);
+    void releaseInode(size_t inumber);
+
+    /**
+     * @brief Mark the blocks used by an inode in blocks, a block bitmap.
+     * @return false if the inode points outside the volume.
+     **/
+    bool markBlocks(const Inode &node, Bitmap &blocks);
+
+    /**
+     * @brief Create new empty inode, the lowest free one.
      **/
     ssize_t createInode();
 
@@ -49,40 +430,238 @@ private:
      **/
     ssize_t read(size_t inumber, char *data, int length, size_t offset);
 
+    /** Block number mapping lookups return when a pointer block on the way fails its checksum */
+    static const uint32_t UNREADABLE = UINT32_MAX;
+
+    /**
+     * @brief Data Block holding block index of a file, 0 when there is none.
+     * @param load Read the indirect block if its pointers are not known yet.
+     * @return UNREADABLE if the block map could not be read.
+     **/
+    uint32_t mapBlock(const Inode &node, uint64_t index, bool load);
+
+    /**
+     * @brief Number of Data Blocks a tree-mapped inode can address.
+     **/
+    uint64_t treeCapacity() const;
+
+    /**
+     * @brief Where block index of a tree-mapped file sits: depth 0 is treeDirect[slots[0]],
+     * @brief else slots[level] is the pointer to follow at each level of treeRoots[depth - 1].
+     * @return false if the index is past treeCapacity().
+     **/
+    bool treePath(uint64_t index, uint32_t &depth, uint32_t slots[]) const;
+
+    /**
+     * @brief Hold blockNumber at level of the cursor, writing back the pointer block it replaces.
+     * @param fresh The block is new: it starts zeroed instead of being read.
+     * @return false if the block fails its checksum, the level then holds nothing.
+     **/
+    bool loadTreeLevel(TreeCursor &cursor, uint32_t level, uint32_t blockNumber, bool fresh);
+
+    /**
+     * @brief Write back the pointer blocks of the cursor that changed.
+     **/
+    void storeTree(TreeCursor &cursor);
+
+    /**
+     * @brief Data Block holding block index of a tree-mapped file, 0 for a hole.
+     * @param load Read pointer blocks the cursor does not hold, else stop at the first one.
+     * @return UNREADABLE if a pointer block on the way fails its checksum.
+     **/
+    uint32_t lookupTree(const Inode &node, uint64_t index, TreeCursor &cursor, bool load);
+
+    /**
+     * @brief Point block index of a tree-mapped file at blockNumber, allocating missing pointer blocks.
+     * @return false if the volume is full, the index is past treeCapacity() or a pointer block fails its checksum.
+     **/
+    bool placeTree(Inode &node, uint64_t index, uint32_t blockNumber, TreeCursor &cursor);
+
+    /**
+     * @brief Call visit on every pointer and Data Block of a tree-mapped inode.
+     * @return false if a pointer is outside the volume or a pointer block fails its checksum, the walk stops there.
+     **/
+    bool walkTree(const Inode &node, const std::function<void(uint32_t)> &visit);
+
+    /**
+     * @brief Call visit on blockNumber and, below depth levels of pointer blocks, on everything it points to.
+     * @param runs The last level holds the runs of compressed clusters rather than Data Blocks.
+     **/
+    bool walkPointers(uint32_t blockNumber, uint32_t depth, bool runs, const std::function<void(uint32_t)> &visit);
+
+    /**
+     * @brief Call visit on every block of the run of a compressed cluster, none for a hole.
+     * @return false if the run is longer than a cluster or leaves the volume.
+     **/
+    bool walkRun(uint32_t start, uint32_t length, const std::function<void(uint32_t)> &visit);
+
+    /**
+     * @brief Decode a cluster of a compressed file into target, clusterBlocks blocks long.
+     * @brief Holes and bytes past the end of the file read as zeros.
+     * @return false if the cluster is corrupt.
+     **/
+    bool loadCluster(const Inode &node, uint64_t cluster, char *target, TreeCursor &cursor);
+
+    /**
+     * @brief Compress the cluster a stream is filling into as few blocks as it takes, then map it.
+     * @brief Its old run is reused when long enough, else it moves to a new one.
+     * @return false if the volume has no free run long enough.
+     **/
+    bool storeCluster(Inode &node, WriteStream &state);
+
+    /**
+     * @brief Write data to a tree-mapped inode on a volume with deduplication,
+     * @brief hashing every block and writing only the ones no block holds yet.
+     **/
+    ssize_t writeDeduplicated(Inode &node, WriteStream &state, char *data, int length, size_t offset);
+
+    /**
+     * @brief Write data to a compressed inode, a cluster at a time.
+     **/
+    ssize_t writeCompressed(Inode &node, WriteStream &state, char *data, int length, size_t offset);
+
+    /**
+     * @brief Read data from a compressed inode, through the cluster held decoded by the read-ahead state.
+     **/
+    ssize_t readCompressed(size_t inumber, const Inode &node, char *data, int length, size_t offset);
+
+    /**
+     * @brief Move the blocks of an extent-mapped or block-mapped inode into the trees of a tree-mapped one.
+     * @return false, leaving the inode alone, if the file does not fit or the volume is full.
+     **/
+    bool convertToTree(Inode &node);
+
+    /**
+     * @brief Read the partial first and last blocks of a write into bounce before anything changes,
+     * @brief so one failing its checksum refuses the write rather than being rewritten with a fresh sum.
+     * @param mapped Block number of the first and the last block of the write, 0 for a new one.
+     * @param held Set for each bounce block read from the volume, the others are left to zero.
+     * @return false if a block fails its checksum.
+     **/
+    bool readEdges(size_t offset, int length, const uint32_t mapped[2], Block bounce[2], bool held[2]);
+
+    /**
+     * @brief Write data to a tree-mapped inode, holes before it stay unallocated.
+     **/
+    ssize_t writeTree(Inode &node, WriteStream &state, char *data, int length, size_t offset);
+
+    /**
+     * @brief Read every extent of an extent-mapped inode.
+     * @return false if the Extent Block fails its checksum.
+     **/
+    bool loadExtents(const Inode &node, std::vector<Extent> &extents);
+
+    /**
+     * @brief Store extents into the inode, the ones that do not fit going to its Extent Block.
+     **/
+    void storeExtents(Inode &node, const std::vector<Extent> &extents);
+
+    /**
+     * @brief Allocate count more blocks at the end of a file, extending its last extent
+     * @brief in place when the next blocks are free, else as long runs as possible.
+     * @return The number of blocks obtained, less than count when the volume or the extent table is full.
+     **/
+    uint32_t growExtents(Inode &node, std::vector<Extent> &extents, uint32_t count);
+
+    /**
+     * @brief Write data to an extent-mapped inode, with whole blocks going straight from data.
+     **/
+    ssize_t writeExtents(Inode &node, WriteStream &state, char *data, int length, size_t offset);
+
+    /**
+     * @brief Write data to a block-mapped inode, through its direct pointers and indirect block.
+     **/
+    ssize_t writePointers(Inode &node, WriteStream &state, char *data, int length, size_t offset);
+
+    /**
+     * @brief Write data to a pinned inode, moving it to a wider mapping when it outgrows its own.
+     **/
+    ssize_t writeData(Inode &node, WriteStream &state, char *data, int length, size_t offset);
+
+    /**
+     * @brief Write back the parts of the block map a stream changed; the inode itself stays pinned.
+     * @return false if the cluster being filled could not be stored.
+     **/
+    bool storeStream(WriteStream &state, Inode &node);
+
+    /**
+     * @brief Store the block map of the open stream and leave its inode dirty, so a flush sees a whole file.
+     **/
+    void syncStream();
+
+    /**
+     * @brief Ask the volume for the blocks of the read-ahead window that starts at block from.
+     **/
+    void prefetch(const Inode &node, uint64_t from);
+
     /**
      * @brief Write data to Data Block by inumber.
      **/
     ssize_t write(size_t inumber, char *data, int length, size_t offset);
 
+    /**
+     * @brief Pin an inode and keep its block map in memory across the writes that follow,
+     * @brief until closeStream(). Only the partial first and last blocks of a write are read.
+     * @return false if inumber is out of range.
+     **/
+    bool openStream(size_t inumber);
+
+    /**
+     * @brief Write back the block map of the open stream and unpin its inode, dirty.
+     * @return false if the end of the data could not be stored.
+     **/
+    bool closeStream();
+
+    /**
+     * @brief Write data into an inline inode, which it fits.
+     **/
+    ssize_t writeInline(Inode &node, char *data, int length, size_t offset);
+
+    /**
+     * @brief Move the data of an inline inode to a Data Block and map the inode by extents,
+     * @brief or to the first cluster of a compressed inode on volumes with compression.
+     * @return false, leaving the inode alone, if the volume is full.
+     **/
+    bool promoteInline(Inode &node, WriteStream &state);
+
+    /**
+     * @brief Set up a new, empty inode: inline when the inodes of the volume have room for data.
+     **/
+    void initInode(Inode &node);
+
     /**
      * @brief Get Inode Block by inumber.
      **/
     bool loadInode(size_t inumber, Inode* inode);
 
     /**
-     * @brief Read data of Data Block with length size from offset.
+     * @brief Take a reference to the cached inode, reading its Inode Block on a miss.
+     * @return NULL if inumber is out of range.
      **/
-    void readDataFromOffset(uint32_t blocknum, int offset, int *length, char **data, char **ptr);
+    Inode* pinInode(size_t inumber);
+
     /**
-     * @brief Write data to Data Block and return length data.
+     * @brief Drop a reference taken by pinInode, writing inodes back once the cache overflows.
+     * @param dirty The inode was changed through the reference.
      **/
-    ssize_t writeAndReturnSize(size_t inumber, Inode* node, int ret);
-    
+    void unpinInode(size_t inumber, bool dirty);
+
     /**
-     * @brief Read data of Data Block with length size from offset.
+     * @brief Write every dirty inode back, one read-modify-write per Inode Block, then the bitmaps.
      **/
-    void readBuffer(int offset, int *read, int length, char *data, uint32_t blocknum);
+    void flushInodes();
 
     /**
-     * @brief Check if inumber of Block is valid.
+     * @brief Allocate the next empty block after the last allocation.
+     * @return 0 when the volume is full.
      **/
-    bool checkAllocation(Inode *node, int read, int orig_offset, uint32_t &blocknum, bool 
-            write_indirect, Block indirect);
+    uint32_t allocateBlock();
 
     /**
-     * @brief Allocate first empty block.
+     * @brief Allocate count contiguous empty blocks.
+     * @return The first block of the run, 0 when no free run is long enough.
      **/
-    uint32_t allocateBlock();
+    uint32_t allocateBlocks(uint32_t count);
 
     /**
      * @brief Insert entry to directory.
@@ -115,16 +694,51 @@ private:
     Directory remove(Directory parent, char name[]);
 
 public:
+    MyFS() : mountedDisk(nullptr), mounted(false), checksumsValid(false) {}
+
+    ~MyFS();
+
     /**
-     * @brief Format the volume.
+     * @brief Format the volume with blocks of blockSize bytes.
+     * @param lazy Only write the Meta Block and the root directory, the rest of the
+     *             volume becomes holes in the image and the tables are initialized on demand.
+     * @param compression Codec the Data Blocks of every new file are compressed with, see MetaBlock.
+     * @param dedup Keep a fingerprint index so blocks with the same data are stored once.
+     *              Not with compression: clusters are not shared.
+     * A checksum table of every block follows the bitmaps whenever the volume has room for both.
+     * @return false, suggesting a block size that fits, if the image holds more than 2^32 blocks.
      **/
-    static bool format(Volume *disk);
+    static bool format(Volume *disk, size_t blockSize = Config::BLOCK_SIZE, bool lazy = true, 
+        uint32_t compression = MetaBlock::NONE, bool dedup = false);
 
     /**
      * @brief Mount the volume to File System.
      **/
     bool mount(Volume *disk);
 
+    const FsStats& stats() const { return counters; }
+
+    void resetStats() { counters.reset(); }
+
+    /**
+     * @brief Write back the dirty inodes and the bitmaps.
+     **/
+    void flush();
+
+    /**
+     * @brief Start checking every block in use against its sum in the background,
+     * @brief reading rate bytes per second. Mismatches are reported as they are found.
+     * @return false if the volume has no checksum table or a scrub is running.
+     **/
+    bool scrub(size_t rate = Config::SCRUB_RATE);
+
+    /**
+     * @brief Stop the running scrub, if any, and wait for it.
+     **/
+    void stopScrub();
+
+    ScrubStats scrubStats() const;
+
     /**
      * @brief Create password for Volume.
      **/
@@ -0,0 +1,125 @@
+#include "Crc32c.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define CRC32C_X86
+#endif
+
+/** Reflected Castagnoli polynomial */
+static const uint32_t POLYNOMIAL = 0x82f63b78;
+
+/**
+ * @brief Tables of slicing-by-8: table[k][b] is the CRC of byte b followed by k zero bytes.
+ **/
+struct SlicingTables {
+	uint32_t table[8][256];
+
+	SlicingTables() {
+		for (uint32_t b = 0; b < 256; b++) {
+			uint32_t crc = b;
+			for (int bit = 0; bit < 8; bit++) {
+				crc = (crc >> 1) ^ (POLYNOMIAL & (0 - (crc & 1)));
+			}
+			table[0][b] = crc;
+		}
+
+		for (uint32_t b = 0; b < 256; b++) {
+			for (int k = 1; k < 8; k++) {
+				table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xff];
+			}
+		}
+	}
+};
+
+static const SlicingTables& slicingTables() {
+	static const SlicingTables tables;
+	return tables;
+}
+
+uint32_t Crc32c::update(uint32_t crc, const void * data, size_t length) {
+	if (hardware()) {
+		return updateSse42(crc, (const uint8_t *) data, length);
+	}
+
+	return updateSlicing(crc, (const uint8_t *) data, length);
+}
+
+bool Crc32c::hardware() {
+#ifdef CRC32C_X86
+	static const bool sse42 = [] {
+		unsigned int eax, ebx, ecx, edx;
+		return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1u << 20));
+	}();
+	return sse42;
+#else
+	return false;
+#endif
+}
+
+const char * Crc32c::kernel() {
+	return hardware() ? "sse4.2" : "slicing-by-8";
+}
+
+uint32_t Crc32c::updateSlicing(uint32_t crc, const uint8_t * data, size_t length) {
+	const uint32_t (*table)[256] = slicingTables().table;
+	crc = ~crc;
+
+	// Eight bytes a step, loaded as a little-endian word
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	for (; length >= 8; length -= 8, data += 8) {
+		uint64_t word;
+		memcpy(&word, data, sizeof(word));
+		word ^= crc;
+
+		crc = table[7][word & 0xff] ^ table[6][(word >> 8) & 0xff]
+			^ table[5][(word >> 16) & 0xff] ^ table[4][(word >> 24) & 0xff]
+			^ table[3][(word >> 32) & 0xff] ^ table[2][(word >> 40) & 0xff]
+			^ table[1][(word >> 48) & 0xff] ^ table[0][word >> 56];
+	}
+#endif
+
+	for (; length > 0; length--, data++) {
+		crc = table[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+	}
+
+	return ~crc;
+}
+
+#ifdef CRC32C_X86
+
+__attribute__((target("sse4.2")))
+uint32_t Crc32c::updateSse42(uint32_t crc, const uint8_t * data, size_t length) {
+	crc = ~crc;
+
+#ifdef __x86_64__
+	uint64_t wide = crc;
+	for (; length >= 8; length -= 8, data += 8) {
+		uint64_t word;
+		memcpy(&word, data, sizeof(word));
+		wide = _mm_crc32_u64(wide, word);
+	}
+	crc = (uint32_t) wide;
+#endif
+
+	for (; length >= 4; length -= 4, data += 4) {
+		uint32_t word;
+		memcpy(&word, data, sizeof(word));
+		crc = _mm_crc32_u32(crc, word);
+	}
+
+	for (; length > 0; length--, data++) {
+		crc = _mm_crc32_u8(crc, *data);
+	}
+
+	return ~crc;
+}
+
+#else
+
+uint32_t Crc32c::updateSse42(uint32_t crc, const uint8_t * data, size_t length) {
+	return updateSlicing(crc, data, length);
+}
+
+#endif
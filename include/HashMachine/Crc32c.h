@@ -0,0 +1,37 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief CRC-32C (Castagnoli), the checksum of the blocks of a volume.
+ * @brief Runs on the SSE4.2 crc32 instruction when the CPU has it, picked once by CPUID,
+ * @brief else slicing-by-8 over tables.
+ **/
+class Crc32c {
+
+public:
+	/**
+	 * @brief Checksum of length bytes of data.
+	 **/
+	static uint32_t compute(const void * data, size_t length) { return update(0, data, length); }
+
+	/**
+	 * @brief Extend crc, the checksum of the bytes before, over length more bytes.
+	 **/
+	static uint32_t update(uint32_t crc, const void * data, size_t length);
+
+	/**
+	 * @brief Name of the kernel in use: "sse4.2" or "slicing-by-8".
+	 **/
+	static const char * kernel();
+
+private:
+	static bool hardware();
+
+	static uint32_t updateSse42(uint32_t crc, const uint8_t * data, size_t length);
+	static uint32_t updateSlicing(uint32_t crc, const uint8_t * data, size_t length);
+};
+
+#endif
@@ -1,43 +1,131 @@
 #include "Hasher.h"
+#include <algorithm>
 #include <cstring>
-#include <sstream>
-#include <iomanip>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define HASHER_X86
+#endif
+
+static const uint32_t K[64] = {
+	0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,
+	0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+	0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,
+	0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+	0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,
+	0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+	0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,
+	0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+	0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,
+	0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+	0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,
+	0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+	0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,
+	0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+	0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,
+	0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
+};
+
+static uint32_t loadBig(const uint8_t * p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
 
 Hasher::Hasher(): m_blocklen(0), m_bitlen(0) {
-	m_state[0] = 0x6a09e667;
-	m_state[1] = 0xbb67ae85;
-	m_state[2] = 0x3c6ef372;
-	m_state[3] = 0xa54ff53a;
-	m_state[4] = 0x510e527f;
-	m_state[5] = 0x9b05688c;
-	m_state[6] = 0x1f83d9ab;
-	m_state[7] = 0x5be0cd19;
+	init(m_state);
 }
 
-void Hasher::update(const uint8_t * data, size_t length) {
-	for (size_t i = 0 ; i < length ; i++) {
-		m_data[m_blocklen++] = data[i];
-		if (m_blocklen == 64) {
-			transform();
+void Hasher::init(uint32_t * state) {
+	state[0] = 0x6a09e667;
+	state[1] = 0xbb67ae85;
+	state[2] = 0x3c6ef372;
+	state[3] = 0xa54ff53a;
+	state[4] = 0x510e527f;
+	state[5] = 0x9b05688c;
+	state[6] = 0x1f83d9ab;
+	state[7] = 0x5be0cd19;
+}
 
-			// End of the block
-			m_bitlen += 512;
-			m_blocklen = 0;
+void Hasher::update(const uint8_t * data, size_t length) {
+	// Top up a block started by an earlier call
+	if (m_blocklen) {
+		size_t take = std::min(length, (size_t)(BLOCK_SIZE - m_blocklen));
+		memcpy(m_data + m_blocklen, data, take);
+		m_blocklen += take;
+		data += take;
+		length -= take;
+
+		if (m_blocklen < BLOCK_SIZE) {
+			return;
 		}
+
+		transform(m_state, m_data, 1);
+		m_bitlen += 512;
+		m_blocklen = 0;
+	}
+
+	// Whole blocks straight from the caller's buffer
+	size_t blocks = length / BLOCK_SIZE;
+	if (blocks) {
+		transform(m_state, data, blocks);
+		m_bitlen += (uint64_t)blocks * 512;
+		data += blocks * BLOCK_SIZE;
+		length -= blocks * BLOCK_SIZE;
 	}
+
+	memcpy(m_data, data, length);
+	m_blocklen = length;
 }
 
 void Hasher::update(const std::string &data) {
 	update(reinterpret_cast<const uint8_t*> (data.c_str()), data.size());
 }
 
-uint8_t * Hasher::digest() {
-	uint8_t * hash = new uint8_t[32];
+void Hasher::digest(uint8_t * hash) {
+	uint8_t last[2 * BLOCK_SIZE];
+
+	m_bitlen += m_blocklen * 8;
+	transform(m_state, last, pad(m_data, m_bitlen / 8, last));
+	revert(m_state, hash);
+}
+
+void Hasher::digestMany(const uint8_t * const * messages, size_t length, size_t count, uint8_t * hashes) {
+	/** SHA-NI hashes one message faster than AVX2 does eight, so lanes only pay without it */
+	if (active() != AVX2) {
+		for (size_t i = 0; i < count; i++) {
+			Hasher hasher;
+			hasher.update(messages[i], length);
+			hasher.digest(hashes + i * DIGEST_SIZE);
+		}
+		return;
+	}
+
+	size_t blocks = length / BLOCK_SIZE;
+	for (size_t first = 0; first < count; first += LANES) {
+		uint32_t states[LANES][8];
+		const uint8_t * lanes[LANES];
+		uint8_t last[LANES][2 * BLOCK_SIZE];
+		size_t padded = 0;
+
+		// A short group repeats its last message in the spare lanes
+		for (size_t lane = 0; lane < LANES; lane++) {
+			const uint8_t * message = messages[std::min(first + lane, count - 1)];
+			init(states[lane]);
+			lanes[lane] = message;
+			padded = pad(message + blocks * BLOCK_SIZE, length, last[lane]);
+		}
+
+		transformLanes(states, lanes, blocks);
 
-	pad();
-	revert(hash);
+		for (size_t lane = 0; lane < LANES; lane++) {
+			lanes[lane] = last[lane];
+		}
+		transformLanes(states, lanes, padded);
 
-	return hash;
+		for (size_t lane = 0; lane < LANES && first + lane < count; lane++) {
+			revert(states[lane], hashes + (first + lane) * DIGEST_SIZE);
+		}
+	}
 }
 
 uint32_t Hasher::rotate(uint32_t x, uint32_t n) {
@@ -60,113 +148,269 @@ uint32_t Hasher::sig1(uint32_t x) {
 	return Hasher::rotate(x, 17) ^ Hasher::rotate(x, 19) ^ (x >> 10);
 }
 
-void Hasher::transform() {
-	uint32_t maj, xorA, ch, xorE, sum, newA, newE, m[64];
-	uint32_t state[8];
+Hasher::Kernel Hasher::detect() {
+#ifdef HASHER_X86
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		return PORTABLE;
+	}
+	bool ssse3 = ecx & (1u << 9);
+	bool sse41 = ecx & (1u << 19);
+	bool osxsave = ecx & (1u << 27);
+	bool avx = ecx & (1u << 28);
+
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+		return PORTABLE;
+	}
+	bool sha = ebx & (1u << 29);
+	bool avx2 = ebx & (1u << 5);
+
+	if (sha && ssse3 && sse41) {
+		return SHA_NI;
+	}
+
+	// AVX2 also needs the OS to save the YMM registers
+	if (avx2 && avx && osxsave) {
+		uint32_t xcr0, high;
+		__asm__ ("xgetbv" : "=a" (xcr0), "=d" (high) : "c" (0));
+		if ((xcr0 & 6) == 6) {
+			return AVX2;
+		}
+	}
+#endif
+	return PORTABLE;
+}
+
+Hasher::Kernel Hasher::active() {
+	static const Kernel kernel = detect();
+	return kernel;
+}
+
+const char * Hasher::kernel() {
+	switch (active()) {
+	case SHA_NI:
+		return "sha-ni";
+	case AVX2:
+		return "avx2";
+	default:
+		return "portable";
+	}
+}
 
-	for (uint8_t i = 0, j = 0; i < 16; i++, j += 4) { // Split data in 32 bit blocks for the 16 first words
-		m[i] = (m_data[j] << 24) | (m_data[j + 1] << 16) | (m_data[j + 2] << 8) | (m_data[j + 3]);
+void Hasher::transform(uint32_t * state, const uint8_t * blocks, size_t count) {
+	if (active() == SHA_NI) {
+		transformShaNi(state, blocks, count);
+	} else {
+		transformPortable(state, blocks, count);
 	}
+}
+
+void Hasher::transformPortable(uint32_t * state, const uint8_t * blocks, size_t count) {
+	uint32_t maj, xorA, ch, xorE, sum, newA, newE, m[64];
+	uint32_t work[8];
+
+	for (; count > 0; count--, blocks += BLOCK_SIZE) {
+		for (uint8_t i = 0; i < 16; i++) { // Split data in 32 bit blocks for the 16 first words
+			m[i] = loadBig(blocks + i * 4);
+		}
+
+		for (uint8_t k = 16 ; k < 64; k++) { // Remaining 48 blocks
+			m[k] = Hasher::sig1(m[k - 2]) + m[k - 7] + Hasher::sig0(m[k - 15]) + m[k - 16];
+		}
+
+		for(uint8_t i = 0 ; i < 8 ; i++) {
+			work[i] = state[i];
+		}
 
-	for (uint8_t k = 16 ; k < 64; k++) { // Remaining 48 blocks
-		m[k] = Hasher::sig1(m[k - 2]) + m[k - 7] + Hasher::sig0(m[k - 15]) + m[k - 16];
+		for (uint8_t i = 0; i < 64; i++) {
+			maj   = Hasher::majority(work[0], work[1], work[2]);
+			xorA  = Hasher::rotate(work[0], 2) ^ Hasher::rotate(work[0], 13) ^ Hasher::rotate(work[0], 22);
+
+			ch = choose(work[4], work[5], work[6]);
+
+			xorE  = Hasher::rotate(work[4], 6) ^ Hasher::rotate(work[4], 11) ^ Hasher::rotate(work[4], 25);
+
+			sum  = m[i] + K[i] + work[7] + ch + xorE;
+			newA = xorA + maj + sum;
+			newE = work[3] + sum;
+
+			work[7] = work[6];
+			work[6] = work[5];
+			work[5] = work[4];
+			work[4] = newE;
+			work[3] = work[2];
+			work[2] = work[1];
+			work[1] = work[0];
+			work[0] = newA;
+		}
+
+		for(uint8_t i = 0 ; i < 8 ; i++) {
+			state[i] += work[i];
+		}
 	}
+}
+
+#ifdef HASHER_X86
+
+__attribute__((target("sha,sse4.1,ssse3")))
+void Hasher::transformShaNi(uint32_t * state, const uint8_t * blocks, size_t count) {
+	const __m128i swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+	// The instructions keep the state as ABEF and CDGH
+	__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) state), 0xB1);
+	__m128i cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) (state + 4)), 0x1B);
+	__m128i abef = _mm_alignr_epi8(tmp, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+
+	for (; count > 0; count--, blocks += BLOCK_SIZE) {
+		__m128i savedAbef = abef;
+		__m128i savedCdgh = cdgh;
+		__m128i w[4];
+
+		// Four rounds at a time, the schedule kept in a ring of the last 16 words
+		for (int r = 0; r < 16; r++) {
+			if (r < 4) {
+				w[r] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (blocks + r * 16)), swap);
+			} else {
+				__m128i next = _mm_sha256msg1_epu32(w[r & 3], w[(r + 1) & 3]);
+				next = _mm_add_epi32(next, _mm_alignr_epi8(w[(r + 3) & 3], w[(r + 2) & 3], 4));
+				w[r & 3] = _mm_sha256msg2_epu32(next, w[(r + 3) & 3]);
+			}
+
+			__m128i msg = _mm_add_epi32(w[r & 3], _mm_loadu_si128((const __m128i *) (K + r * 4)));
+			cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+			abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(msg, 0x0E));
+		}
 
-	for(uint8_t i = 0 ; i < 8 ; i++) {
-		state[i] = m_state[i];
+		abef = _mm_add_epi32(abef, savedAbef);
+		cdgh = _mm_add_epi32(cdgh, savedCdgh);
 	}
 
-	std::array<uint32_t, 64> K = {
-		0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,
-		0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
-		0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,
-		0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
-		0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,
-		0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
-		0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,
-		0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
-		0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,
-		0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
-		0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,
-		0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
-		0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,
-		0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
-		0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,
-		0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
-	};
+	tmp = _mm_shuffle_epi32(abef, 0x1B);
+	cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+	_mm_storeu_si128((__m128i *) state, _mm_blend_epi16(tmp, cdgh, 0xF0));
+	_mm_storeu_si128((__m128i *) (state + 4), _mm_alignr_epi8(cdgh, tmp, 8));
+}
 
-	for (uint8_t i = 0; i < 64; i++) {
-		maj   = Hasher::majority(state[0], state[1], state[2]);
-		xorA  = Hasher::rotate(state[0], 2) ^ Hasher::rotate(state[0], 13) ^ Hasher::rotate(state[0], 22);
+#define ROR8(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
 
-		ch = choose(state[4], state[5], state[6]);
+__attribute__((target("avx2")))
+void Hasher::transformLanes(uint32_t (*states)[8], const uint8_t * const * lanes, size_t count) {
+	// One register per state word, one lane per message
+	__m256i s[8];
+	for (int i = 0; i < 8; i++) {
+		s[i] = _mm256_setr_epi32(states[0][i], states[1][i], states[2][i], states[3][i],
+			states[4][i], states[5][i], states[6][i], states[7][i]);
+	}
 
-		xorE  = Hasher::rotate(state[4], 6) ^ Hasher::rotate(state[4], 11) ^ Hasher::rotate(state[4], 25);
+	__m256i w[64];
+	for (size_t block = 0; block < count; block++) {
+		size_t at = block * BLOCK_SIZE;
+		for (int i = 0; i < 16; i++) {
+			w[i] = _mm256_setr_epi32(loadBig(lanes[0] + at + i * 4), loadBig(lanes[1] + at + i * 4),
+				loadBig(lanes[2] + at + i * 4), loadBig(lanes[3] + at + i * 4),
+				loadBig(lanes[4] + at + i * 4), loadBig(lanes[5] + at + i * 4),
+				loadBig(lanes[6] + at + i * 4), loadBig(lanes[7] + at + i * 4));
+		}
 
-		sum  = m[i] + K[i] + state[7] + ch + xorE;
-		newA = xorA + maj + sum;
-		newE = state[3] + sum;
+		for (int i = 16; i < 64; i++) {
+			__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROR8(w[i - 15], 7), ROR8(w[i - 15], 18)),
+				_mm256_srli_epi32(w[i - 15], 3));
+			__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROR8(w[i - 2], 17), ROR8(w[i - 2], 19)),
+				_mm256_srli_epi32(w[i - 2], 10));
+			w[i] = _mm256_add_epi32(_mm256_add_epi32(s1, w[i - 7]), _mm256_add_epi32(s0, w[i - 16]));
+		}
 
-		state[7] = state[6];
-		state[6] = state[5];
-		state[5] = state[4];
-		state[4] = newE;
-		state[3] = state[2];
-		state[2] = state[1];
-		state[1] = state[0];
-		state[0] = newA;
+		__m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+		for (int i = 0; i < 64; i++) {
+			__m256i xorE = _mm256_xor_si256(_mm256_xor_si256(ROR8(e, 6), ROR8(e, 11)), ROR8(e, 25));
+			__m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+			__m256i sum = _mm256_add_epi32(_mm256_add_epi32(h, xorE),
+				_mm256_add_epi32(ch, _mm256_add_epi32(w[i], _mm256_set1_epi32(K[i]))));
+			__m256i xorA = _mm256_xor_si256(_mm256_xor_si256(ROR8(a, 2), ROR8(a, 13)), ROR8(a, 22));
+			__m256i maj = _mm256_or_si256(_mm256_and_si256(a, _mm256_or_si256(b, c)), _mm256_and_si256(b, c));
+
+			h = g;
+			g = f;
+			f = e;
+			e = _mm256_add_epi32(d, sum);
+			d = c;
+			c = b;
+			b = a;
+			a = _mm256_add_epi32(sum, _mm256_add_epi32(xorA, maj));
+		}
+
+		s[0] = _mm256_add_epi32(s[0], a);
+		s[1] = _mm256_add_epi32(s[1], b);
+		s[2] = _mm256_add_epi32(s[2], c);
+		s[3] = _mm256_add_epi32(s[3], d);
+		s[4] = _mm256_add_epi32(s[4], e);
+		s[5] = _mm256_add_epi32(s[5], f);
+		s[6] = _mm256_add_epi32(s[6], g);
+		s[7] = _mm256_add_epi32(s[7], h);
 	}
 
-	for(uint8_t i = 0 ; i < 8 ; i++) {
-		m_state[i] += state[i];
+	for (int i = 0; i < 8; i++) {
+		uint32_t word[8];
+		_mm256_storeu_si256((__m256i *) word, s[i]);
+		for (size_t lane = 0; lane < LANES; lane++) {
+			states[lane][i] = word[lane];
+		}
 	}
 }
 
-void Hasher::pad() {
+#undef ROR8
+
+#else
 
-	uint64_t i = m_blocklen;
-	uint8_t end = m_blocklen < 56 ? 56 : 64;
+void Hasher::transformShaNi(uint32_t * state, const uint8_t * blocks, size_t count) {
+	transformPortable(state, blocks, count);
+}
 
-	m_data[i++] = 0x80; // Append a bit 1
-	while (i < end) {
-		m_data[i++] = 0x00; // Pad with zeros
+void Hasher::transformLanes(uint32_t (*states)[8], const uint8_t * const * lanes, size_t count) {
+	for (size_t lane = 0; lane < LANES; lane++) {
+		transformPortable(states[lane], lanes[lane], count);
 	}
+}
+
+#endif
+
+size_t Hasher::pad(const uint8_t * tail, size_t length, uint8_t * out) {
+	size_t rest = length % BLOCK_SIZE;
+	size_t blocks = rest < 56 ? 1 : 2;
+
+	memcpy(out, tail, rest);
+	out[rest] = 0x80; // Append a bit 1
+	memset(out + rest + 1, 0, blocks * BLOCK_SIZE - rest - 1); // Pad with zeros
 
-	if(m_blocklen >= 56) {
-		transform();
-		memset(m_data, 0, 56);
+	// End with the total message's length in bits
+	uint64_t bits = (uint64_t)length * 8;
+	uint8_t * end = out + blocks * BLOCK_SIZE;
+	for (int i = 1; i <= 8; i++, bits >>= 8) {
+		end[-i] = (uint8_t)bits;
 	}
 
-	// Append to the padding the total message's length in bits and transform.
-	m_bitlen += m_blocklen * 8;
-	m_data[63] = m_bitlen;
-	m_data[62] = m_bitlen >> 8;
-	m_data[61] = m_bitlen >> 16;
-	m_data[60] = m_bitlen >> 24;
-	m_data[59] = m_bitlen >> 32;
-	m_data[58] = m_bitlen >> 40;
-	m_data[57] = m_bitlen >> 48;
-	m_data[56] = m_bitlen >> 56;
-	transform();
-}
-
-void Hasher::revert(uint8_t * hash) {
+	return blocks;
+}
+
+void Hasher::revert(const uint32_t * state, uint8_t * hash) {
 	// SHA uses big endian byte ordering
 	// Revert all bytes
 	for (uint8_t i = 0 ; i < 4 ; i++) {
 		for(uint8_t j = 0 ; j < 8 ; j++) {
-			hash[i + (j * 4)] = (m_state[j] >> (24 - i * 8)) & 0x000000ff;
+			hash[i + (j * 4)] = (state[j] >> (24 - i * 8)) & 0x000000ff;
 		}
 	}
 }
 
 std::string Hasher::toString(const uint8_t * digest) {
-	std::stringstream s;
-	s << std::setfill('0') << std::hex;
+	static const char hex[] = "0123456789abcdef";
+	std::string s(2 * DIGEST_SIZE, '0');
 
-	for(uint8_t i = 0 ; i < 32 ; i++) {
-		s << std::setw(2) << (unsigned int) digest[i];
+	for(uint8_t i = 0 ; i < DIGEST_SIZE ; i++) {
+		s[2 * i] = hex[digest[i] >> 4];
+		s[2 * i + 1] = hex[digest[i] & 0x0f];
 	}
 
-	return s.str();
-}
\ No newline at end of file
+	return s;
+}
@@ -1,34 +1,83 @@
 #ifndef HASHER_H
 #define HASHER_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <string>
-#include <array>
 
+/**
+ * @brief SHA-256. The 64-byte blocks go through SHA-NI, AVX2 or portable code,
+ * @brief whichever the CPU runs best, picked once by CPUID.
+ **/
 class Hasher {
 
 public:
+	const static size_t DIGEST_SIZE = 32;
+	const static size_t BLOCK_SIZE = 64;
+
 	Hasher();
-    
+
 	void update(const uint8_t * data, size_t length);
 	void update(const std::string &data);
-	uint8_t * digest();
+
+	/**
+	 * @brief Finish the message and write its DIGEST_SIZE bytes to hash.
+	 **/
+	void digest(uint8_t * hash);
+
+	/**
+	 * @brief Hash count messages of length bytes each, side by side in the lanes of the CPU,
+	 * @brief the digest of messages[i] going to hashes + i * DIGEST_SIZE.
+	 **/
+	static void digestMany(const uint8_t * const * messages, size_t length, size_t count, uint8_t * hashes);
 
 	static std::string toString(const uint8_t * digest);
 
+	/**
+	 * @brief Name of the kernel in use: "sha-ni", "avx2" or "portable".
+	 **/
+	static const char * kernel();
+
 private:
+	enum Kernel { PORTABLE, AVX2, SHA_NI };
+
+	/* Messages hashed together by the AVX2 kernel */
+	const static size_t LANES = 8;
+
 	uint8_t  m_data[64];
 	uint32_t m_blocklen;
 	uint64_t m_bitlen;
 	uint32_t m_state[8];
 
+	static Kernel detect();
+	static Kernel active();
+
 	static uint32_t rotate(uint32_t x, uint32_t n);
 	static uint32_t choose(uint32_t e, uint32_t f, uint32_t g);
 	static uint32_t majority(uint32_t a, uint32_t b, uint32_t c);
 	static uint32_t sig0(uint32_t x);
 	static uint32_t sig1(uint32_t x);
-	void transform();
-	void pad();
-	void revert(uint8_t * hash);
+
+	/**
+	 * @brief Run count consecutive blocks through the state of one message.
+	 **/
+	static void transform(uint32_t * state, const uint8_t * blocks, size_t count);
+	static void transformPortable(uint32_t * state, const uint8_t * blocks, size_t count);
+	static void transformShaNi(uint32_t * state, const uint8_t * blocks, size_t count);
+
+	/**
+	 * @brief Run count blocks of LANES messages at once, states[lane] holding the state of lanes[lane].
+	 **/
+	static void transformLanes(uint32_t (*states)[8], const uint8_t * const * lanes, size_t count);
+
+	/**
+	 * @brief Build the padded last blocks of a message from its tail of length % 64 bytes.
+	 * @return The number of blocks written to out, 1 or 2.
+	 **/
+	static size_t pad(const uint8_t * tail, size_t length, uint8_t * out);
+
+	static void revert(const uint32_t * state, uint8_t * hash);
+	static void init(uint32_t * state);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -10,6 +10,9 @@ enum Command {
     LS,
     OUTPORT,
     IMPORT,
+    SYNC,
+    STATS,
+    SCRUB,
     EXIT,
     WAITING
 };
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifndef SHELL_H
 #define SHELL_H
 
+#include <iostream>
+#include <map>
 #include <sstream>
 #include <string>
 #include <stdexcept>
@@ -11,21 +13,23 @@
 
 #include "VolumeEmulator/Volume.h"
 #include "FileSystem/MyFS.h"
+#include "Statistics/Histogram.h"
+#include "Statistics/StatsReport.h"
 
 class Shell {
 private:
-    Volume disk;
-    MyFS fileSystem;
+    Volume& disk;
+    MyFS& fileSystem;
+
+    /** Latency of every command run so far, by name */
+    std::map<std::string, Histogram> commandLatency;
 
 public:
     /** Inversion of Control */
-    Shell(Volume& disk, MyFS& fileSystem) {
-        this->disk = disk;
-        this->fileSystem = fileSystem;
-    }
+    Shell(Volume& disk, MyFS& fileSystem) : disk(disk), fileSystem(fileSystem) {}
 
-    bool format() {
-        return fileSystem.format(&disk);
+    bool format(size_t blockSize, bool lazy, uint32_t compression, bool dedup) {
+        return fileSystem.format(&disk, blockSize, lazy, compression, dedup);
     }
 
     bool mount() {
@@ -83,6 +87,115 @@ public:
     bool ls() {
         return fileSystem.ls();
     }
+
+    void sync() {
+        fileSystem.flush();
+        disk.sync();
+    }
+
+    void exit() {
+        fileSystem.exit();
+    }
+
+    /**
+     * @brief Start a background scrub reading rate bytes per second.
+     **/
+    bool scrub(size_t rate) {
+        return fileSystem.scrub(rate);
+    }
+
+    void stopScrub() {
+        fileSystem.stopScrub();
+    }
+
+    ScrubStats scrubStats() const {
+        return fileSystem.scrubStats();
+    }
+
+    void record(const char* command, uint64_t nanos) {
+        commandLatency[command].record(nanos);
+    }
+
+    /**
+     * @brief Print the volume, cache, file system and command statistics.
+     * @param option "json" prints one JSON object, "reset" starts counting again.
+     **/
+    bool stats(const char* option) {
+        if (strcmp(option, "reset") == 0) {
+            disk.resetStats();
+            fileSystem.resetStats();
+            commandLatency.clear();
+            return true;
+        } else if (option[0] != '\0' && strcmp(option, "json") != 0) {
+            return false;
+        }
+
+        StatsReport report(std::cout, strcmp(option, "json") == 0);
+
+        const VolumeStats& volume = disk.stats();
+        report.begin("volume");
+        report.field("blocksRead", volume.blocksRead);
+        report.field("blocksWritten", volume.blocksWritten);
+        report.field("bytesRead", volume.bytesRead);
+        report.field("bytesWritten", volume.bytesWritten);
+        report.field("syscalls", volume.syscalls);
+        report.field("readLatency", volume.readLatency);
+        report.field("writeLatency", volume.writeLatency);
+        report.field("syncLatency", volume.syncLatency);
+        report.end();
+
+        const CacheStats& cache = disk.cacheStats();
+        report.begin("cache");
+        report.field("hits", cache.hits);
+        report.field("misses", cache.misses);
+        report.field("evictions", cache.evictions);
+        report.field("writeBacks", cache.writeBacks);
+        report.end();
+
+        const FsStats& fs = fileSystem.stats();
+        report.begin("filesystem");
+        report.field("inodeLoads", fs.inodeLoads);
+        report.field("inodeStores", fs.inodeStores);
+        report.field("inodeCacheHits", fs.inodeCacheHits);
+        report.field("inodeAllocations", fs.inodeAllocations);
+        report.field("inodeFrees", fs.inodeFrees);
+        report.field("blockAllocations", fs.blockAllocations);
+        report.field("directorySyncs", fs.directorySyncs);
+        report.field("metaBlockSyncs", fs.metaBlockSyncs);
+        report.field("tableReads", fs.tableReads);
+        report.field("tableWrites", fs.tableWrites);
+        report.field("dataBlocksRead", fs.dataBlocksRead);
+        report.field("dataBlocksWritten", fs.dataBlocksWritten);
+        report.field("blocksPrefetched", fs.blocksPrefetched);
+        report.field("pointerReads", fs.pointerReads);
+        report.field("bitmapWrites", fs.bitmapWrites);
+        report.field("tableScans", fs.tableScans);
+        report.field("clustersCompressed", fs.clustersCompressed);
+        report.field("clustersRaw", fs.clustersRaw);
+        report.field("blocksSaved", fs.blocksSaved);
+        report.field("blocksDeduplicated", fs.blocksDeduplicated);
+        report.field("fingerprintWrites", fs.fingerprintWrites);
+        report.field("checksumErrors", fs.checksumErrors);
+        report.field("checksumWrites", fs.checksumWrites);
+        report.end();
+
+        ScrubStats scrub = fileSystem.scrubStats();
+        report.begin("scrub");
+        report.field("blocksTotal", scrub.blocksTotal);
+        report.field("blocksScrubbed", scrub.blocksScrubbed);
+        report.field("blocksCorrupt", scrub.blocksCorrupt);
+        report.end();
+
+        report.begin("commands");
+        for (std::map<std::string, Histogram>::const_iterator it = commandLatency.begin();
+                it != commandLatency.end(); ++it) {
+            report.field(it->first.c_str(), it->second);
+        }
+        report.end();
+
+        report.finish();
+        return true;
+    }
 };
 
 #endif
\ No newline at end of file
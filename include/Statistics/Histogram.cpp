@@ -0,0 +1,45 @@
+#include "Histogram.h"
+
+void Histogram::record(uint64_t nanos) {
+    uint64_t micros = nanos / 1000;
+    int i = micros == 0 ? 0 : 64 - __builtin_clzll(micros);
+    if (i >= BUCKETS) {
+        i = BUCKETS - 1;
+    }
+
+    buckets[i].fetch_add(1, std::memory_order_relaxed);
+    samples.fetch_add(1, std::memory_order_relaxed);
+    totalNanos.fetch_add(nanos, std::memory_order_relaxed);
+
+    uint64_t current = maxNanos.load(std::memory_order_relaxed);
+    while (nanos > current && !maxNanos.compare_exchange_weak(current, nanos, std::memory_order_relaxed)) {
+    }
+}
+
+void Histogram::reset() {
+    for (int i = 0; i < BUCKETS; i++) {
+        buckets[i].store(0, std::memory_order_relaxed);
+    }
+
+    samples.store(0, std::memory_order_relaxed);
+    totalNanos.store(0, std::memory_order_relaxed);
+    maxNanos.store(0, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::percentile(double fraction) const {
+    uint64_t total = count();
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t wanted = (uint64_t)(fraction * total + 0.5);
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += bucket(i);
+        if (seen >= wanted && seen > 0) {
+            return bound(i);
+        }
+    }
+
+    return bound(BUCKETS - 1);
+}
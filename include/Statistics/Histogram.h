@@ -0,0 +1,69 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+
+/**
+ * @brief Latency histogram with power-of-two buckets, safe to record from several threads.
+ * @brief Bucket 0 counts samples below 1 us, bucket i those in [2^(i-1), 2^i) us.
+ **/
+class Histogram {
+public:
+    const static int BUCKETS = 32;
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> samples;
+    std::atomic<uint64_t> totalNanos;
+    std::atomic<uint64_t> maxNanos;
+
+    Histogram(const Histogram&);
+    Histogram& operator=(const Histogram&);
+public:
+    Histogram() { reset(); }
+
+    /**
+     * @brief Add one sample of nanos nanoseconds.
+    **/
+    void record(uint64_t nanos);
+
+    void reset();
+
+    uint64_t count() const { return samples.load(std::memory_order_relaxed); }
+
+    uint64_t total() const { return totalNanos.load(std::memory_order_relaxed); }
+
+    uint64_t max() const { return maxNanos.load(std::memory_order_relaxed); }
+
+    uint64_t bucket(int i) const { return buckets[i].load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Upper bound of a bucket in microseconds.
+    **/
+    static uint64_t bound(int i) { return (uint64_t)1 << i; }
+
+    /**
+     * @brief Upper bound in microseconds below which fraction of the samples fall.
+    **/
+    uint64_t percentile(double fraction) const;
+};
+
+/**
+ * @brief Measure elapsed time from construction, in nanoseconds.
+ **/
+class Stopwatch {
+private:
+    std::chrono::steady_clock::time_point start;
+
+public:
+    Stopwatch() : start(std::chrono::steady_clock::now()) {}
+
+    uint64_t elapsed() const {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+#endif
@@ -0,0 +1,99 @@
+#include "StatsReport.h"
+#include <algorithm>
+#include <iomanip>
+#include <string>
+
+StatsReport::StatsReport(std::ostream &out, bool json) : out(out), json(json) {
+    empty.push_back(true);
+    if (json) {
+        out << "{";
+    }
+}
+
+void StatsReport::key(const char *name) {
+    size_t depth = empty.size() - 1;
+
+    if (json) {
+        out << (empty.back() ? "" : ",") << "\"" << name << "\":";
+    } else {
+        /** Values line up in one column whatever the nesting */
+        int width = 28 - 4 * (int)std::min(depth, (size_t)4);
+        out << std::string(depth * 4, ' ') << std::left << std::setw(width) << name << std::right;
+    }
+
+    empty.back() = false;
+}
+
+void StatsReport::begin(const char *section) {
+    if (json) {
+        key(section);
+        out << "{";
+    } else {
+        out << std::string((empty.size() - 1) * 4, ' ') << section << "\n";
+        empty.back() = false;
+    }
+
+    empty.push_back(true);
+}
+
+void StatsReport::end() {
+    if (empty.size() <= 1) {
+        return;
+    }
+
+    empty.pop_back();
+    if (json) {
+        out << "}";
+    }
+}
+
+void StatsReport::field(const char *name, uint64_t value) {
+    key(name);
+    out << value << (json ? "" : "\n");
+}
+
+void StatsReport::field(const char *name, const Histogram &histogram) {
+    key(name);
+
+    uint64_t count = histogram.count();
+    double average = count ? histogram.total() / 1000.0 / count : 0;
+
+    if (!json) {
+        out << "count " << count << std::fixed << std::setprecision(1)
+            << ", avg " << average << " us"
+            << ", p50 < " << histogram.percentile(0.50) << " us"
+            << ", p99 < " << histogram.percentile(0.99) << " us"
+            << ", max " << histogram.max() / 1000.0 << " us\n";
+        out.unsetf(std::ios::fixed);
+        return;
+    }
+
+    out << "{\"count\":" << count
+        << ",\"totalUs\":" << histogram.total() / 1000
+        << ",\"maxUs\":" << histogram.max() / 1000
+        << ",\"p50Us\":" << histogram.percentile(0.50)
+        << ",\"p99Us\":" << histogram.percentile(0.99)
+        << ",\"buckets\":[";
+
+    /** Trailing empty buckets are left out */
+    int used = Histogram::BUCKETS;
+    while (used > 0 && histogram.bucket(used - 1) == 0) {
+        used--;
+    }
+
+    for (int i = 0; i < used; i++) {
+        out << (i ? "," : "") << histogram.bucket(i);
+    }
+    out << "]}";
+}
+
+void StatsReport::finish() {
+    while (empty.size() > 1) {
+        end();
+    }
+
+    if (json) {
+        out << "}" << std::endl;
+    }
+    empty.back() = true;
+}
@@ -0,0 +1,50 @@
+#ifndef STATS_REPORT_H
+#define STATS_REPORT_H
+
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+
+#include "Histogram.h"
+
+/**
+ * @brief Print named counters and histograms grouped in sections,
+ * @brief either as indented text or as a single JSON object.
+ **/
+class StatsReport {
+private:
+    std::ostream &out;
+    bool json;
+
+    /** One flag per open section: nothing written in it yet */
+    std::vector<bool> empty;
+
+    /**
+     * @brief Write the separator, indentation and name that precede a value.
+    **/
+    void key(const char *name);
+
+public:
+    StatsReport(std::ostream &out, bool json);
+
+    /**
+     * @brief Open a nested section.
+    **/
+    void begin(const char *section);
+
+    /**
+     * @brief Close the section opened last.
+    **/
+    void end();
+
+    void field(const char *name, uint64_t value);
+
+    void field(const char *name, const Histogram &histogram);
+
+    /**
+     * @brief Close every open section and the report itself.
+    **/
+    void finish();
+};
+
+#endif
@@ -0,0 +1,166 @@
+#include "BlockCache.h"
+#include "BufferPool.h"
+#include <algorithm>
+#include <iterator>
+#include <string.h>
+
+BlockCache::BlockCache(size_t capacity, size_t blockSize, WriteBack writeBack) {
+    this->capacity = capacity;
+    this->blockSize = blockSize;
+    this->writeBack = writeBack;
+    memset(&counters, 0, sizeof(counters));
+}
+
+BlockCache::~BlockCache() {
+    for (std::list<Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+        BufferPool::shared().release(it->data, blockSize);
+    }
+}
+
+void BlockCache::evict() {
+    Entry &victim = entries.back();
+    if (victim.dirty) {
+        writeBack(victim.blockNumber, victim.data);
+        counters.writeBacks++;
+    }
+
+    index.erase(victim.blockNumber);
+    BufferPool::shared().release(victim.data, blockSize);
+    entries.pop_back();
+    counters.evictions++;
+}
+
+void BlockCache::resize(size_t capacity) {
+    this->capacity = capacity;
+
+    /** Evict from the tail until the cache fits again */
+    while (entries.size() > capacity) {
+        evict();
+    }
+}
+
+std::list<BlockCache::Entry>::iterator BlockCache::reserve(uint64_t blockNumber) {
+    if (entries.size() < capacity) {
+        Entry entry;
+        entry.blockNumber = blockNumber;
+        entry.dirty = false;
+        entry.data = BufferPool::shared().acquire(blockSize);
+        entries.push_front(entry);
+    } else {
+        /** Recycle the buffer of the least recently used block */
+        Entry &victim = entries.back();
+        if (victim.dirty) {
+            writeBack(victim.blockNumber, victim.data);
+            counters.writeBacks++;
+        }
+
+        index.erase(victim.blockNumber);
+        counters.evictions++;
+
+        victim.blockNumber = blockNumber;
+        victim.dirty = false;
+        entries.splice(entries.begin(), entries, std::prev(entries.end()));
+    }
+
+    index[blockNumber] = entries.begin();
+    return entries.begin();
+}
+
+bool BlockCache::lookup(uint64_t blockNumber, char *data) {
+    if (capacity == 0) {
+        return false;
+    }
+
+    std::unordered_map<uint64_t, std::list<Entry>::iterator>::iterator it = index.find(blockNumber);
+    if (it == index.end()) {
+        counters.misses++;
+        return false;
+    }
+
+    /** Move to the front as most recently used */
+    entries.splice(entries.begin(), entries, it->second);
+    memcpy(data, it->second->data, blockSize);
+    counters.hits++;
+
+    return true;
+}
+
+void BlockCache::insert(uint64_t blockNumber, const char *data, bool dirty) {
+    if (capacity == 0) {
+        return;
+    }
+
+    std::list<Entry>::iterator entry;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator>::iterator it = index.find(blockNumber);
+    if (it != index.end()) {
+        entry = it->second;
+        entries.splice(entries.begin(), entries, entry);
+
+        /** A block filled from disk never supersedes what is already cached */
+        if (!dirty) {
+            return;
+        }
+    } else {
+        entry = reserve(blockNumber);
+    }
+
+    memcpy(entry->data, data, blockSize);
+    entry->dirty = entry->dirty || dirty;
+}
+
+void BlockCache::update(uint64_t blockNumber, const char *data) {
+    std::unordered_map<uint64_t, std::list<Entry>::iterator>::iterator it = index.find(blockNumber);
+    if (it == index.end()) {
+        return;
+    }
+
+    memcpy(it->second->data, data, blockSize);
+    it->second->dirty = false;
+}
+
+void BlockCache::flush() {
+    std::vector<Entry*> dirty;
+    for (std::list<Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+        if (it->dirty) {
+            dirty.push_back(&(*it));
+        }
+    }
+
+    /** Ascending order keeps the write-back sequential on disk */
+    std::sort(dirty.begin(), dirty.end(), [](const Entry *a, const Entry *b) {
+        return a->blockNumber < b->blockNumber;
+    });
+
+    for (size_t i = 0; i < dirty.size(); i++) {
+        writeBack(dirty[i]->blockNumber, dirty[i]->data);
+        dirty[i]->dirty = false;
+        counters.writeBacks++;
+    }
+}
+
+void BlockCache::discard(uint64_t first, size_t count) {
+    std::list<Entry>::iterator it = entries.begin();
+    while (it != entries.end()) {
+        if (it->blockNumber < first || (size_t)(it->blockNumber - first) >= count) {
+            ++it;
+            continue;
+        }
+
+        index.erase(it->blockNumber);
+        BufferPool::shared().release(it->data, blockSize);
+        it = entries.erase(it);
+    }
+}
+
+void BlockCache::clear() {
+    flush();
+
+    while (!entries.empty()) {
+        evict();
+    }
+}
+
+void BlockCache::reset(size_t blockSize) {
+    clear();
+    this->blockSize = blockSize;
+}
@@ -0,0 +1,126 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "DataStructure/Config.h"
+
+/**
+ * @brief Counters of the block cache.
+ **/
+struct CacheStats
+{
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t writeBacks;
+};
+
+/**
+ * @brief Bounded write-back LRU cache of volume blocks.
+ * @brief Dirty blocks reach the disk only when they are evicted or flushed.
+ **/
+class BlockCache {
+public:
+    /** Callback used to write a dirty block back to the disk */
+    typedef std::function<void(uint64_t blockNumber, const char *data)> WriteBack;
+
+private:
+    struct Entry
+    {
+        uint64_t blockNumber;
+        bool dirty;
+        char *data;     // Aligned buffer from BufferPool
+    };
+
+    size_t capacity;    // Maximum number of cached blocks
+    size_t blockSize;   // Size of each cached block
+    WriteBack writeBack;
+    CacheStats counters;
+
+    /** Most recently used entry is in the front */
+    std::list<Entry> entries;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+
+    /**
+     * @brief Get a slot for a new block, evicting the least recently used one when full.
+    **/
+    std::list<Entry>::iterator reserve(uint64_t blockNumber);
+
+    /**
+     * @brief Write back the least recently used block if dirty and drop it.
+    **/
+    void evict();
+
+    BlockCache(const BlockCache&);
+    BlockCache& operator=(const BlockCache&);
+public:
+    BlockCache(size_t capacity, size_t blockSize, WriteBack writeBack);
+
+    ~BlockCache();
+
+    /**
+     * @brief Maximum number of blocks held by the cache (0 means disabled).
+    **/
+    size_t size() const { return capacity; }
+
+    /**
+     * @brief Change the capacity, writing back whatever no longer fits.
+    **/
+    void resize(size_t capacity);
+
+    /**
+     * @brief Copy a cached block into data.
+     * @return false on a miss.
+    **/
+    bool lookup(uint64_t blockNumber, char *data);
+
+    /**
+     * @brief Check if a block is cached, without touching the LRU order or the counters.
+    **/
+    bool contains(uint64_t blockNumber) const { return index.count(blockNumber) > 0; }
+
+    /**
+     * @brief Insert or replace a block.
+     * @param dirty The block has to be written back before it leaves the cache.
+     *              A clean insert of a block that is already cached is ignored.
+    **/
+    void insert(uint64_t blockNumber, const char *data, bool dirty);
+
+    /**
+     * @brief Replace a cached block that has just been written to disk, leaving it clean.
+     * @brief Blocks that are not cached stay uncached.
+    **/
+    void update(uint64_t blockNumber, const char *data);
+
+    /**
+     * @brief Write back every dirty block, in ascending block order.
+    **/
+    void flush();
+
+    /**
+     * @brief Drop count blocks from first on without writing them back.
+    **/
+    void discard(uint64_t first, size_t count);
+
+    /**
+     * @brief Write back dirty blocks then drop everything.
+    **/
+    void clear();
+
+    /**
+     * @brief Drop everything and hold blocks of a new size from now on.
+    **/
+    void reset(size_t blockSize);
+
+    const CacheStats& stats() const { return counters; }
+
+    void resetStats() { counters = CacheStats(); }
+};
+
+#endif
@@ -0,0 +1,59 @@
+#include "BufferPool.h"
+#include <new>
+#include <unistd.h>
+
+BufferPool::BufferPool(size_t retain) {
+    long page = sysconf(_SC_PAGESIZE);
+    this->alignment = page > 0 ? (size_t)page : 4096;
+    this->retain = retain;
+}
+
+BufferPool::~BufferPool() {
+    for (std::unordered_map<size_t, std::vector<char*> >::iterator it = freeLists.begin();
+            it != freeLists.end(); ++it) {
+        for (size_t i = 0; i < it->second.size(); i++) {
+            free(it->second[i]);
+        }
+    }
+}
+
+BufferPool& BufferPool::shared() {
+    static BufferPool pool(Config::POOL_BUFFERS);
+    return pool;
+}
+
+char* BufferPool::acquire(size_t size) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::vector<char*> &list = freeLists[size];
+        if (!list.empty()) {
+            char* buffer = list.back();
+            list.pop_back();
+            return buffer;
+        }
+    }
+
+    void* buffer = NULL;
+    if (posix_memalign(&buffer, alignment, size == 0 ? alignment : size) != 0) {
+        throw std::bad_alloc();
+    }
+
+    return (char*)buffer;
+}
+
+void BufferPool::release(char *buffer, size_t size) {
+    if (buffer == NULL) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::vector<char*> &list = freeLists[size];
+        if (list.size() < retain) {
+            list.push_back(buffer);
+            return;
+        }
+    }
+
+    free(buffer);
+}
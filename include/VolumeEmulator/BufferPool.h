@@ -0,0 +1,72 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stdlib.h>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "DataStructure/Config.h"
+
+/**
+ * @brief Pool of page-aligned buffers, as needed by O_DIRECT transfers.
+ * @brief Released buffers are kept per size for reuse, up to a bounded number.
+ **/
+class BufferPool {
+private:
+    std::mutex lock;
+    std::unordered_map<size_t, std::vector<char*> > freeLists;
+    size_t alignment;   // Alignment of every buffer (page size)
+    size_t retain;      // Free buffers kept per size, the rest go back to the system
+
+    BufferPool(const BufferPool&);
+    BufferPool& operator=(const BufferPool&);
+public:
+    BufferPool(size_t retain);
+
+    ~BufferPool();
+
+    /**
+     * @brief Pool shared by the whole process.
+    **/
+    static BufferPool& shared();
+
+    /**
+     * @brief Alignment guaranteed for every buffer.
+    **/
+    size_t align() const { return alignment; }
+
+    /**
+     * @brief Get an aligned buffer of size bytes (content undefined).
+     * @exception Throws bad_alloc exception when memory is exhausted.
+    **/
+    char* acquire(size_t size);
+
+    /**
+     * @brief Give back a buffer obtained by acquire with the same size.
+    **/
+    void release(char *buffer, size_t size);
+};
+
+/**
+ * @brief Buffer borrowed from the shared pool for the lifetime of the object.
+ **/
+class PooledBuffer {
+private:
+    char* buffer;
+    size_t length;
+
+    PooledBuffer(const PooledBuffer&);
+    PooledBuffer& operator=(const PooledBuffer&);
+public:
+    explicit PooledBuffer(size_t size)
+        : buffer(BufferPool::shared().acquire(size)), length(size) {}
+
+    ~PooledBuffer() { BufferPool::shared().release(buffer, length); }
+
+    char* data() const { return buffer; }
+
+    size_t size() const { return length; }
+};
+
+#endif
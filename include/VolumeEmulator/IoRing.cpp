@@ -0,0 +1,159 @@
+#include "IoRing.h"
+#include <stdexcept>
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+static int ioUringSetup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static void fail(const char *what) {
+    char message[BUFSIZ];
+    snprintf(message, BUFSIZ, "%s: %s", what, strerror(errno));
+    throw std::runtime_error(message);
+}
+
+IoRing::IoRing(unsigned queueDepth) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ringDescriptor = ioUringSetup(queueDepth, &params);
+    if (ringDescriptor < 0) {
+        fail("Unable to set up io_uring");
+    }
+
+    depth = params.sq_entries;
+    unsubmitted = 0;
+
+    /** Both rings may share one mapping on recent kernels */
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+
+    sqRing = mmap(NULL, sqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+        ringDescriptor, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        close(ringDescriptor);
+        fail("Unable to map submission ring");
+    }
+
+    if (single) {
+        cqRing = sqRing;
+    } else {
+        cqRing = mmap(NULL, cqRingSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+            ringDescriptor, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            munmap(sqRing, sqRingSize);
+            close(ringDescriptor);
+            fail("Unable to map completion ring");
+        }
+    }
+
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* entries = mmap(NULL, sqesSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+        ringDescriptor, IORING_OFF_SQES);
+    if (entries == MAP_FAILED) {
+        if (cqRing != sqRing) {
+            munmap(cqRing, cqRingSize);
+        }
+        munmap(sqRing, sqRingSize);
+        close(ringDescriptor);
+        fail("Unable to map submission entries");
+    }
+    sqes = (struct io_uring_sqe*)entries;
+
+    char* sq = (char*)sqRing;
+    sqHead = (unsigned*)(sq + params.sq_off.head);
+    sqTail = (unsigned*)(sq + params.sq_off.tail);
+    sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    sqArray = (unsigned*)(sq + params.sq_off.array);
+
+    char* cq = (char*)cqRing;
+    cqHead = (unsigned*)(cq + params.cq_off.head);
+    cqTail = (unsigned*)(cq + params.cq_off.tail);
+    cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+}
+
+IoRing::~IoRing() {
+    munmap(sqes, sqesSize);
+    if (cqRing != sqRing) {
+        munmap(cqRing, cqRingSize);
+    }
+    munmap(sqRing, sqRingSize);
+    close(ringDescriptor);
+}
+
+bool IoRing::prepare(bool write, int fd, const struct iovec *iov, unsigned count,
+        uint64_t offset, uint64_t userData) {
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    unsigned tail = *sqTail;
+    if (tail - head >= depth) {
+        return false;
+    }
+
+    unsigned index = tail & *sqMask;
+    struct io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = count;
+    sqe->off = offset;
+    sqe->user_data = userData;
+
+    sqArray[index] = index;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    unsubmitted++;
+
+    return true;
+}
+
+void IoRing::submit(unsigned minComplete) {
+    while (true) {
+        unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+        int result = ioUringEnter(ringDescriptor, unsubmitted, minComplete, flags);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (result < 0) {
+            fail("Unable to enter io_uring");
+        }
+
+        unsubmitted -= std::min((unsigned)result, unsubmitted);
+        return;
+    }
+}
+
+size_t IoRing::reap(std::vector<IoCompletion> &out) {
+    size_t count = 0;
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &cqes[head & *cqMask];
+        IoCompletion completion = { cqe->user_data, cqe->res };
+        out.push_back(completion);
+
+        head++;
+        count++;
+    }
+
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    return count;
+}
@@ -0,0 +1,74 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+
+struct iovec;
+
+/**
+ * @brief Completed request reaped from the ring.
+ **/
+struct IoCompletion
+{
+    uint64_t userData;
+    int result;         // Bytes transferred or -errno
+};
+
+/**
+ * @brief Minimal io_uring submission/completion ring, driven by raw syscalls.
+ **/
+class IoRing {
+private:
+    int ringDescriptor;
+    unsigned depth;
+
+    /** Submission queue */
+    void* sqRing;
+    size_t sqRingSize;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+
+    /** Completion queue */
+    void* cqRing;
+    size_t cqRingSize;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+
+    /** Prepared but not yet passed to the kernel */
+    unsigned unsubmitted;
+
+    IoRing(const IoRing&);
+    IoRing& operator=(const IoRing&);
+public:
+    /**
+     * @brief Set up a ring with room for queueDepth requests.
+     * @exception Throws runtime_error exception when io_uring is unavailable.
+    **/
+    explicit IoRing(unsigned queueDepth);
+
+    ~IoRing();
+
+    unsigned queueDepth() const { return depth; }
+
+    /**
+     * @brief Queue a vectored read or write at offset of fd.
+     * @return false when the submission queue is full.
+    **/
+    bool prepare(bool write, int fd, const struct iovec *iov, unsigned count,
+        uint64_t offset, uint64_t userData);
+
+    /**
+     * @brief Hand prepared requests to the kernel and wait for at least minComplete of them.
+    **/
+    void submit(unsigned minComplete);
+
+    /**
+     * @brief Move every available completion into out.
+    **/
+    size_t reap(std::vector<IoCompletion> &out);
+};
+
+#endif
@@ -1,89 +1,922 @@
 #include "Volume.h"
+#include "BufferPool.h"
+#include "DataStructure/Geometry.h"
 #include <stdexcept>
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <limits.h>
+#include <algorithm>
+
+/** From <linux/fs.h>, which cannot be included since it defines BLOCK_SIZE */
+#ifndef BLKSSZGET
+#define BLKSSZGET _IO(0x12, 104)
+#endif
 #include <string>
 
-Volume::Volume() {
-    fileDescriptor = 0; 
+Volume::Volume() 
+    : cache(Config::CACHE_BLOCKS, Config::BLOCK_SIZE, 
+        [this](uint64_t blockNumber, const char *data) { writeBack(blockNumber, data); }) 
+{
+    backend = BACKEND_FILE;
+    stripeUnit = Config::STRIPE_UNIT;
+    imageSize = 0;
+    ring = NULL;
+    nextTag = 0;
+    direct = false;
+    directWanted = false;
+    directAlign = 1;
     blocks = 0; 
+    blockSize = Config::BLOCK_SIZE;
+    imageBytes = 0;
     mounts = 0;
 }
 
 Volume::~Volume() {
-    close(fileDescriptor);
-    fileDescriptor = 0;
+    if (ring != NULL) {
+        drain();
+        delete ring;
+        ring = NULL;
+    }
+
+    if (!descriptors.empty()) {
+        std::lock_guard<std::mutex> guard(cacheLock);
+        cache.clear();
+    }
+
+    for (size_t i = 0; i < mappings.size(); i++) {
+        msync(mappings[i], imageSize, MS_SYNC);
+        munmap(mappings[i], imageSize);
+    }
+    mappings.clear();
+
+    for (size_t i = 0; i < descriptors.size(); i++) {
+        close(descriptors[i]);
+    }
+    descriptors.clear();
 }
 
-void Volume::sanityCheck(int blockNumber, char *data) {
-    char* error = NULL;
+void VolumeStats::reset() {
+    blocksRead = 0;
+    blocksWritten = 0;
+    bytesRead = 0;
+    bytesWritten = 0;
+    syscalls = 0;
+    readLatency.reset();
+    writeLatency.reset();
+    syncLatency.reset();
+}
+
+void Volume::sanityCheck(uint64_t blockNumber, char *data) {
+    checkRange(blockNumber);
 
-    if (blockNumber < 0) {
-        strcpy(error, "Block number is negative!");
-    } else if (blockNumber >= (int)blocks) {
-        strcpy(error, "Block number is too big!");
-    } else if (data == NULL) {
-        strcpy(error, "null data pointer!");
+    if (data == NULL) {
+        char what[BUFSIZ];
+        snprintf(what, BUFSIZ, "null data pointer! (block %llu)", (unsigned long long)blockNumber);
+        throw std::invalid_argument(what);
     }
+}
 
-    if (error != NULL) {
+void Volume::checkRange(uint64_t blockNumber) {
+    if (blockNumber >= blocks) {
         char what[BUFSIZ];
-        snprintf(what, BUFSIZ, error);
+        snprintf(what, BUFSIZ, "Block number is too big! (block %llu)", (unsigned long long)blockNumber);
         throw std::invalid_argument(what);
     }
 }
 
-void Volume::open(const char *path, size_t nblocks) {
-    fileDescriptor = ::open(path, O_RDWR|O_CREAT, 0600);
+/**
+ * @brief Logical sector size that O_DIRECT offsets and lengths must be aligned to.
+ **/
+static size_t directAlignment(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISBLK(st.st_mode)) {
+        int sector = 0;
+        if (ioctl(fd, BLKSSZGET, &sector) == 0 && sector > 0) {
+            return (size_t)sector;
+        }
+    }
 
-    bool error = false;
-    if (fileDescriptor < 0) {
-    	error = true;
-    } else if (ftruncate(fileDescriptor, nblocks * Config::BLOCK_SIZE) < 0) {
-    	error = true;
+#ifdef STATX_DIOALIGN
+    struct statx stx;
+    if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 
+        && (stx.stx_mask & STATX_DIOALIGN) && stx.stx_dio_offset_align > 0) 
+    {
+        return std::max(stx.stx_dio_offset_align, stx.stx_dio_mem_align);
     }
+#endif
+
+    return 512;
+}
+
+void Volume::open(const char *path, size_t nblocks, const VolumeOptions &options) {
+    std::vector<std::string> paths(1, path);
+    open(paths, nblocks, options);
+}
 
-    if (error) {
+void Volume::open(const std::vector<std::string> &paths, size_t nblocks, const VolumeOptions &options) {
+    if (paths.empty() || options.stripeUnit < Config::BLOCK_SIZE 
+        || (options.stripeUnit & (options.stripeUnit - 1)) != 0) 
+    {
         char what[BUFSIZ];
-    	snprintf(what, BUFSIZ, "Unable to open %s: %s", path, strerror(errno));
-    	throw std::runtime_error(what);
+        snprintf(what, BUFSIZ, "Unsupported stripe unit %zu over %zu images", 
+            options.stripeUnit, paths.size());
+        throw std::invalid_argument(what);
     }
 
+    imageBytes = nblocks * Config::BLOCK_SIZE;
+    stripeUnit = options.stripeUnit;
+
+    /** Every image gets the same number of stripe units, the last ones may be partly unused */
+    size_t units = (imageBytes + stripeUnit - 1) / stripeUnit;
+    imageSize = paths.size() == 1 
+        ? imageBytes 
+        : (units + paths.size() - 1) / paths.size() * stripeUnit;
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        int fd = ::open(paths[i].c_str(), O_RDWR|O_CREAT, 0600);
+
+        bool error = false;
+        if (fd < 0) {
+            error = true;
+        } else if (descriptors.push_back(fd), ftruncate(fd, imageSize) < 0) {
+            error = true;
+        } else if (options.backend == BACKEND_MMAP) {
+            void* address = mmap(NULL, imageSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+
+            if (address == MAP_FAILED) {
+                error = true;
+            } else {
+                mappings.push_back((char*)address);
+            }
+        }
+
+        if (error) {
+            char what[BUFSIZ];
+            snprintf(what, BUFSIZ, "Unable to open %s: %s", paths[i].c_str(), strerror(errno));
+            throw std::runtime_error(what);
+        }
+    }
+
+    /** The page cache already holds the images, a second copy is useless */
+    if (options.backend == BACKEND_MMAP) {
+        setCacheSize(0);
+    }
+
+    /** 
+     * O_DIRECT needs blocks and stripe units that are whole sectors, and file systems 
+     * that support it on every image. Otherwise the volume quietly stays on buffered I/O.
+     **/
+    if (options.direct && options.backend != BACKEND_MMAP) {
+        size_t sector = 1;
+        for (size_t i = 0; i < descriptors.size(); i++) {
+            sector = std::max(sector, directAlignment(descriptors[i]));
+        }
+
+        directWanted = true;
+        directAlign = sector;
+        applyDirect();
+    }
+
+    if (options.backend == BACKEND_URING) {
+        ring = new IoRing((unsigned)options.queueDepth);
+    }
+
+    this->backend = options.backend;
     blocks = nblocks;
 }
 
-void Volume::readBlock(int blockNumber, char *data) {
+void Volume::setBlockSize(size_t size) {
+    if (!Geometry::isValid(size)) {
+        char what[BUFSIZ];
+        snprintf(what, BUFSIZ, "Unsupported block size %zu", size);
+        throw std::invalid_argument(what);
+    }
+
+    if (size == blockSize) {
+        return;
+    }
+
+    drain();
+
+    std::lock_guard<std::mutex> guard(cacheLock);
+    cache.reset(size);
+
+    blockSize = size;
+    blocks = imageBytes / size;
+
+    /** Blocks that became whole sectors go on O_DIRECT, those that no longer are come off it */
+    applyDirect();
+}
+
+void Volume::applyDirect() {
+    bool wanted = directWanted && blockSize % directAlign == 0 && stripeUnit % directAlign == 0;
+    if (wanted == direct) {
+        return;
+    }
+
+    size_t changed = 0;
+    for (; changed < descriptors.size(); changed++) {
+        int flags = fcntl(descriptors[changed], F_GETFL);
+        if (flags < 0 || fcntl(descriptors[changed], F_SETFL, wanted ? flags | O_DIRECT : flags & ~O_DIRECT) != 0) {
+            break;
+        }
+    }
+
+    if (changed == descriptors.size()) {
+        direct = wanted;
+        return;
+    }
+
+    /** One image refused, every image goes back to buffered I/O */
+    for (size_t i = 0; i < changed; i++) {
+        fcntl(descriptors[i], F_SETFL, fcntl(descriptors[i], F_GETFL) & ~O_DIRECT);
+    }
+    direct = false;
+}
+
+bool Volume::isAligned(const struct iovec *iov, int count) const {
+    for (int i = 0; i < count; i++) {
+        if ((uintptr_t)iov[i].iov_base % directAlign != 0 || iov[i].iov_len % directAlign != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+char* Volume::blockPointer(uint64_t blockNumber) {
+    if (mappings.empty() || blockNumber >= blocks) {
+        return NULL;
+    }
+
+    int image;
+    off_t position;
+    if (locate((off_t)blockNumber * blockSize, blockSize, image, position) < blockSize) {
+        return NULL;
+    }
+
+    return mappings[image] + position;
+}
+
+size_t Volume::locate(off_t offset, size_t length, int &image, off_t &position) const {
+    if (descriptors.size() == 1) {
+        image = 0;
+        position = offset;
+        return length;
+    }
+
+    off_t unit = offset / stripeUnit;
+    size_t within = offset % stripeUnit;
+    image = (int)(unit % descriptors.size());
+    position = (unit / descriptors.size()) * stripeUnit + within;
+
+    return std::min(length, stripeUnit - within);
+}
+
+bool Volume::imageRange(off_t begin, off_t end, int image, off_t &first, off_t &last) const {
+    off_t n = descriptors.size();
+    off_t unit = stripeUnit;
+
+    /** Units holding the first and the last byte, then the first and last ones of the image */
+    off_t head = begin / unit;
+    off_t tail = (end - 1) / unit;
+    off_t from = head + (image - head % n + n) % n;
+    off_t to = tail - (tail % n - image + n) % n;
+    if (from > to) {
+        return false;
+    }
+
+    first = (from / n) * unit + (from == head ? begin % unit : 0);
+    last = (to / n) * unit + (to == tail ? (end - 1) % unit + 1 : unit);
+    return true;
+}
+
+bool Volume::lookup(uint64_t blockNumber, char *data) {
+    bool arriving;
+    {
+        std::lock_guard<std::mutex> guard(cacheLock);
+        if (cache.lookup(blockNumber, data)) {
+            return true;
+        }
+        arriving = prefetching.count(blockNumber) > 0;
+    }
+
+    if (!arriving) {
+        return false;
+    }
+
+    /** The block is already being read ahead, waiting for it is cheaper than reading it again */
+    drain();
+
+    std::lock_guard<std::mutex> guard(cacheLock);
+    return cache.lookup(blockNumber, data);
+}
+
+void Volume::readBlock(uint64_t blockNumber, char *data) {
     sanityCheck(blockNumber, data);
 
-    char* error = NULL;
-    if (lseek(fileDescriptor, blockNumber * Config::BLOCK_SIZE, SEEK_SET) < 0) {
-        strcpy(error, "Unable to lseek %d: %s");
-    } else if (::read(fileDescriptor, data, Config::BLOCK_SIZE) != Config::BLOCK_SIZE) {
-        strcpy(error, "Unable to read %d: %s");
+    if (lookup(blockNumber, data)) {
+        return;
     }
 
-    if (error != NULL) {
-        char what[BUFSIZ];
-    	snprintf(what, BUFSIZ, error, blockNumber, strerror(errno));
-    	throw std::runtime_error(what);
+    {
+        std::lock_guard<std::mutex> guard(cacheLock);
+        filling.insert(blockNumber);
+    }
+
+    /** The disk is read without holding the lock, pread does not share the offset */
+    readRaw(blockNumber, data);
+
+    /** Like read-ahead, a block written meanwhile was dropped from filling and is not replaced */
+    std::lock_guard<std::mutex> guard(cacheLock);
+    if (filling.erase(blockNumber)) {
+        cache.insert(blockNumber, data, false);
     }
 }
 
-void Volume::writeBlock(int blockNumber, char *data) {
+void Volume::writeBlock(uint64_t blockNumber, char *data) {
     sanityCheck(blockNumber, data);
 
-    char* error = NULL;
-    if (lseek(fileDescriptor, blockNumber * Config::BLOCK_SIZE, SEEK_SET) < 0) {
-        strcpy(error, "Unable to lseek %d: %s");
-    } else if (::write(fileDescriptor, data, Config::BLOCK_SIZE) != Config::BLOCK_SIZE) {
-        strcpy(error, "Unable to write %d: %s");
+    {
+        std::lock_guard<std::mutex> guard(cacheLock);
+        prefetching.erase(blockNumber);
+        filling.erase(blockNumber);
+        if (cache.size() != 0) {
+            cache.insert(blockNumber, data, true);
+            return;
+        }
     }
 
-    if (error != NULL) {
-        char what[BUFSIZ];
-    	snprintf(what, BUFSIZ, error, blockNumber, strerror(errno));
-    	throw std::runtime_error(what);
+    /** Without a cache the disk is written without holding the lock, like readBlock */
+    writeRaw(blockNumber, data);
+}
+
+void Volume::readBlocks(uint64_t start, size_t count, char *data) {
+    sanityCheck(start, data);
+    sanityCheck(start + count - 1, data);
+
+    std::list<RangeRead>::iterator range;
+    {
+        std::lock_guard<std::mutex> guard(cacheLock);
+        RangeRead read = { start, count, std::vector<uint64_t>() };
+        range = rangeReads.insert(rangeReads.end(), read);
+    }
+
+    struct iovec iov = { data, count * blockSize };
+    try {
+        transfer(false, start, &iov, 1);
+    } catch (...) {
+        std::lock_guard<std::mutex> guard(cacheLock);
+        rangeReads.erase(range);
+        throw;
+    }
+
+    /** Dirty cached blocks are newer than the disk image */
+    std::lock_guard<std::mutex> guard(cacheLock);
+    for (size_t i = 0; i < count; i++) {
+        cache.lookup(start + i, data + i * blockSize);
+    }
+
+    /** 
+     * A dirty block evicted during the read reached the disk too late for it and 
+     * is no longer cached, it is read again under the lock that orders write-backs.
+     **/
+    std::vector<uint64_t> writtenBack;
+    writtenBack.swap(range->writtenBack);
+    rangeReads.erase(range);
+
+    for (size_t i = 0; i < writtenBack.size(); i++) {
+        if (!cache.contains(writtenBack[i])) {
+            readRaw(writtenBack[i], data + (writtenBack[i] - start) * blockSize);
+        }
+    }
+}
+
+void Volume::writeBlocks(uint64_t start, size_t count, const char *data) {
+    sanityCheck(start, (char*)data);
+    sanityCheck(start + count - 1, (char*)data);
+
+    {
+        std::lock_guard<std::mutex> guard(cacheLock);
+        for (size_t i = 0; i < count; i++) {
+            prefetching.erase(start + i);
+            filling.erase(start + i);
+            cache.update(start + i, data + i * blockSize);
+        }
+    }
+
+    struct iovec iov = { (void*)data, count * blockSize };
+    transfer(true, start, &iov, 1);
+}
+
+void Volume::discard(uint64_t start, size_t count) {
+    if (count == 0) {
+        return;
+    }
+
+    checkRange(start);
+    checkRange(start + count - 1);
+
+    drain();
+
+    {
+        std::lock_guard<std::mutex> guard(cacheLock);
+        cache.discard(start, count);
+        for (uint64_t i = start; i < start + count && !(prefetching.empty() && filling.empty()); i++) {
+            prefetching.erase(i);
+            filling.erase(i);
+        }
+    }
+
+    /** Holes read back as zeros, also through a shared mapping */
+    off_t begin = (off_t)start * blockSize;
+    off_t end = begin + (off_t)count * blockSize;
+    bool punched = true;
+    for (size_t i = 0; i < descriptors.size() && punched; i++) {
+        off_t first, last;
+        if (!imageRange(begin, end, (int)i, first, last)) {
+            continue;
+        }
+
+        counters.syscalls++;
+        punched = fallocate(descriptors[i], FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, 
+            first, last - first) == 0;
+    }
+
+    if (punched) {
+        return;
+    }
+
+    /** No hole punching on this file system, write the zeros instead */
+    size_t batch = std::max((size_t)1, std::min(count, Config::IO_BATCH_BYTES / blockSize));
+    PooledBuffer zeros(batch * blockSize);
+    memset(zeros.data(), 0, zeros.size());
+
+    for (size_t done = 0; done < count; done += batch) {
+        size_t now = std::min(batch, count - done);
+        struct iovec iov = { zeros.data(), now * blockSize };
+        transfer(true, start + done, &iov, 1);
+    }
+}
+
+void Volume::readBlocks(std::vector<BlockRequest> requests) {
+    /** Cached blocks, read-ahead ones included, need no I/O */
+    std::vector<BlockRequest> misses;
+    for (size_t i = 0; i < requests.size(); i++) {
+        sanityCheck(requests[i].blockNumber, requests[i].data);
+        if (!lookup(requests[i].blockNumber, requests[i].data)) {
+            misses.push_back(requests[i]);
+        }
+    }
+
+    submitRuns(false, misses);
+}
+
+void Volume::writeBlocks(std::vector<BlockRequest> requests) {
+    {
+        std::lock_guard<std::mutex> guard(cacheLock);
+        for (size_t i = 0; i < requests.size(); i++) {
+            prefetching.erase(requests[i].blockNumber);
+            filling.erase(requests[i].blockNumber);
+            cache.update(requests[i].blockNumber, requests[i].data);
+        }
+    }
+
+    submitRuns(true, requests);
+}
+
+void Volume::submitRead(uint64_t blockNumber, char *data, Completion done) {
+    sanityCheck(blockNumber, data);
+
+    if (lookup(blockNumber, data)) {
+        if (done) {
+            done(blockSize);
+        }
+        return;
+    }
+
+    std::vector<struct iovec> iov(1);
+    iov[0].iov_base = data;
+    iov[0].iov_len = blockSize;
+    enqueue(false, blockNumber, iov, done);
+}
+
+void Volume::submitWrite(uint64_t blockNumber, const char *data, Completion done) {
+    sanityCheck(blockNumber, (char*)data);
+
+    {
+        std::lock_guard<std::mutex> guard(cacheLock);
+        prefetching.erase(blockNumber);
+        filling.erase(blockNumber);
+        cache.update(blockNumber, data);
+    }
+
+    std::vector<struct iovec> iov(1);
+    iov[0].iov_base = (void*)data;
+    iov[0].iov_len = blockSize;
+    enqueue(true, blockNumber, iov, done);
+}
+
+void Volume::enqueue(bool write, uint64_t firstBlock, std::vector<struct iovec> &iov, Completion done) {
+    size_t bytes = iov.size() * blockSize;
+
+    /** Runs that cross to another image are split and moved synchronously */
+    int image;
+    off_t position;
+    bool single = locate((off_t)firstBlock * blockSize, bytes, image, position) == bytes;
+
+    if (ring == NULL || !single || (direct && !isAligned(iov.data(), (int)iov.size()))) {
+        transfer(write, firstBlock, iov.data(), (int)iov.size());
+        if (done) {
+            done((int)bytes);
+        }
+        return;
+    }
+
+    std::vector<AsyncRequest> finished;
+    {
+        std::lock_guard<std::mutex> guard(ringLock);
+
+        /** A full queue makes room by waiting for the oldest requests */
+        while (inFlight.size() >= ring->queueDepth()) {
+            complete(1, finished);
+        }
+
+        uint64_t tag = nextTag++;
+        AsyncRequest &request = inFlight[tag];
+        request.write = write;
+        request.firstBlock = firstBlock;
+        request.iov.swap(iov);
+        request.bytes = bytes;
+        request.done = done;
+
+        while (!ring->prepare(write, descriptors[image], request.iov.data(), 
+                (unsigned)request.iov.size(), position, tag)) {
+            complete(1, finished);
+        }
+        ring->submit(0);
+        counters.syscalls++;
+    }
+
+    for (size_t i = 0; i < finished.size(); i++) {
+        if (finished[i].done) {
+            finished[i].done((int)finished[i].bytes);
+        }
+    }
+}
+
+void Volume::complete(unsigned minComplete, std::vector<AsyncRequest> &finished) {
+    std::vector<IoCompletion> completions;
+    ring->submit(minComplete);
+    counters.syscalls++;
+    ring->reap(completions);
+
+    for (size_t i = 0; i < completions.size(); i++) {
+        std::unordered_map<uint64_t, AsyncRequest>::iterator it = inFlight.find(completions[i].userData);
+        if (it == inFlight.end()) {
+            continue;
+        }
+
+        AsyncRequest &request = it->second;
+
+        /** Errors and short transfers are redone synchronously, which resumes or throws */
+        if (completions[i].result != (int)request.bytes) {
+            transfer(request.write, request.firstBlock, request.iov.data(), (int)request.iov.size());
+        } else {
+            account(request.write, request.bytes, request.started.elapsed());
+        }
+
+        finished.push_back(request);
+        inFlight.erase(it);
+    }
+}
+
+void Volume::drain() {
+    if (ring == NULL) {
+        return;
+    }
+
+    std::vector<AsyncRequest> finished;
+    {
+        std::lock_guard<std::mutex> guard(ringLock);
+        while (!inFlight.empty()) {
+            complete(1, finished);
+        }
+    }
+
+    for (size_t i = 0; i < finished.size(); i++) {
+        if (finished[i].done) {
+            finished[i].done((int)finished[i].bytes);
+        }
+    }
+}
+
+bool Volume::sameRun(uint64_t previous, uint64_t next) const {
+    if (next != previous + 1) {
+        return false;
+    }
+
+    /** A run also ends where the next image of a striped volume takes over */
+    return descriptors.size() == 1 || (size_t)next * blockSize % stripeUnit != 0;
+}
+
+void Volume::prefetch(std::vector<uint64_t> blockNumbers) {
+    std::sort(blockNumbers.begin(), blockNumbers.end());
+    blockNumbers.erase(std::unique(blockNumbers.begin(), blockNumbers.end()), blockNumbers.end());
+    for (size_t i = 0; i < blockNumbers.size(); i++) {
+        checkRange(blockNumbers[i]);
+    }
+
+    /** Without io_uring, the kernel reads ahead into the page cache or the mapping */
+    if (ring == NULL || !mappings.empty()) {
+        if (direct) {
+            return;
+        }
+
+        size_t first = 0;
+        for (size_t i = 0; i < blockNumbers.size(); i++) {
+            if (i + 1 < blockNumbers.size() && blockNumbers[i + 1] == blockNumbers[i] + 1) {
+                continue;
+            }
+
+            off_t begin = (off_t)blockNumbers[first] * blockSize;
+            off_t end = (off_t)(blockNumbers[i] + 1) * blockSize;
+            for (size_t image = 0; image < descriptors.size(); image++) {
+                off_t from, to;
+                if (!imageRange(begin, end, (int)image, from, to)) {
+                    continue;
+                }
+
+                counters.syscalls++;
+                if (mappings.empty()) {
+                    posix_fadvise(descriptors[image], from, to - from, POSIX_FADV_WILLNEED);
+                } else {
+                    off_t page = from - from % (off_t)BufferPool::shared().align();
+                    madvise(mappings[image] + page, to - page, MADV_WILLNEED);
+                }
+            }
+            first = i + 1;
+        }
+        return;
+    }
+
+    /** With io_uring, blocks that are neither cached nor on their way are read into pooled buffers */
+    std::vector<BlockRequest> wanted;
+    {
+        std::lock_guard<std::mutex> guard(cacheLock);
+        if (cache.size() == 0) {
+            return;
+        }
+
+        for (size_t i = 0; i < blockNumbers.size(); i++) {
+            if (!cache.contains(blockNumbers[i]) && prefetching.insert(blockNumbers[i]).second) {
+                BlockRequest request = { blockNumbers[i], BufferPool::shared().acquire(blockSize) };
+                wanted.push_back(request);
+            }
+        }
+    }
+
+    size_t first = 0;
+    for (size_t i = 0; i < wanted.size(); i++) {
+        if (i + 1 < wanted.size() && sameRun(wanted[i].blockNumber, wanted[i + 1].blockNumber)) {
+            continue;
+        }
+
+        std::vector<BlockRequest> run(wanted.begin() + first, wanted.begin() + i + 1);
+        std::vector<struct iovec> iov(run.size());
+        for (size_t j = 0; j < run.size(); j++) {
+            iov[j].iov_base = run[j].data;
+            iov[j].iov_len = blockSize;
+        }
+
+        /** Blocks written meanwhile were dropped from prefetching, their stale copy is not kept */
+        size_t size = blockSize;
+        enqueue(false, run[0].blockNumber, iov, [this, run, size](int) {
+            std::lock_guard<std::mutex> guard(cacheLock);
+            for (size_t j = 0; j < run.size(); j++) {
+                if (prefetching.erase(run[j].blockNumber)) {
+                    cache.insert(run[j].blockNumber, run[j].data, false);
+                }
+                BufferPool::shared().release(run[j].data, size);
+            }
+        });
+        first = i + 1;
+    }
+}
+
+void Volume::submitRuns(bool write, std::vector<BlockRequest> &requests) {
+    for (size_t i = 0; i < requests.size(); i++) {
+        sanityCheck(requests[i].blockNumber, requests[i].data);
+    }
+
+    std::sort(requests.begin(), requests.end(), [](const BlockRequest &a, const BlockRequest &b) {
+        return a.blockNumber < b.blockNumber;
+    });
+
+    /** Each run of consecutive block numbers becomes one vectored call */
+    std::vector<struct iovec> iov;
+    size_t first = 0;
+    for (size_t i = 0; i < requests.size(); i++) {
+        struct iovec entry = { requests[i].data, blockSize };
+        iov.push_back(entry);
+
+        bool last = (i + 1 == requests.size()) 
+            || !sameRun(requests[i].blockNumber, requests[i + 1].blockNumber);
+        if (last) {
+            enqueue(write, requests[first].blockNumber, iov, Completion());
+            iov.clear();
+            first = i + 1;
+        }
+    }
+
+    /** With io_uring every run was in flight at once, on all the images */
+    drain();
+}
+
+void Volume::sync() {
+    Stopwatch watch;
+    std::lock_guard<std::mutex> guard(cacheLock);
+    cache.flush();
+
+    for (size_t i = 0; i < mappings.size(); i++) {
+        counters.syscalls++;
+        if (msync(mappings[i], imageSize, MS_SYNC) < 0) {
+            char what[BUFSIZ];
+            snprintf(what, BUFSIZ, "Unable to msync: %s", strerror(errno));
+            throw std::runtime_error(what);
+        }
+    }
+
+    counters.syncLatency.record(watch.elapsed());
+}
+
+void Volume::resetStats() {
+    counters.reset();
+
+    std::lock_guard<std::mutex> guard(cacheLock);
+    cache.resetStats();
+}
+
+void Volume::setCacheSize(size_t blocks) {
+    std::lock_guard<std::mutex> guard(cacheLock);
+    cache.resize(blocks);
+}
+
+void Volume::readRaw(uint64_t blockNumber, char *data) {
+    struct iovec iov = { data, blockSize };
+    transfer(false, blockNumber, &iov, 1);
+}
+
+void Volume::writeRaw(uint64_t blockNumber, const char *data) {
+    struct iovec iov = { (void*)data, blockSize };
+    transfer(true, blockNumber, &iov, 1);
+}
+
+void Volume::writeBack(uint64_t blockNumber, const char *data) {
+    filling.erase(blockNumber);
+    for (std::list<RangeRead>::iterator it = rangeReads.begin(); it != rangeReads.end(); ++it) {
+        if (blockNumber >= it->start && blockNumber - it->start < it->count) {
+            it->writtenBack.push_back(blockNumber);
+        }
+    }
+
+    writeRaw(blockNumber, data);
+}
+
+void Volume::transfer(bool write, uint64_t firstBlock, struct iovec *iov, int count) {
+    size_t bytes = 0;
+    for (int i = 0; i < count; i++) {
+        bytes += iov[i].iov_len;
+    }
+
+    Stopwatch watch;
+    move(write, firstBlock, iov, count);
+    account(write, bytes, watch.elapsed());
+}
+
+void Volume::account(bool write, size_t bytes, uint64_t nanos) {
+    if (write) {
+        counters.blocksWritten += bytes / blockSize;
+        counters.bytesWritten += bytes;
+        counters.writeLatency.record(nanos);
+    } else {
+        counters.blocksRead += bytes / blockSize;
+        counters.bytesRead += bytes;
+        counters.readLatency.record(nanos);
+    }
+}
+
+void Volume::move(bool write, uint64_t firstBlock, struct iovec *iov, int count) {
+    off_t offset = (off_t)firstBlock * blockSize;
+
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += iov[i].iov_len;
+    }
+
+    /** O_DIRECT rejects unaligned memory, such buffers go through one pooled buffer */
+    if (direct && !isAligned(iov, count)) {
+        PooledBuffer bounce(total);
+        size_t position = 0;
+        if (write) {
+            for (int i = 0; i < count; i++) {
+                memcpy(bounce.data() + position, iov[i].iov_base, iov[i].iov_len);
+                position += iov[i].iov_len;
+            }
+        }
+
+        struct iovec aligned = { bounce.data(), total };
+        move(write, firstBlock, &aligned, 1);
+
+        if (!write) {
+            for (int i = 0; i < count; i++) {
+                memcpy(iov[i].iov_base, bounce.data() + position, iov[i].iov_len);
+                position += iov[i].iov_len;
+            }
+        }
+        return;
+    }
+
+    /** Most transfers stay within one image */
+    int image;
+    off_t position;
+    if (locate(offset, total, image, position) == total) {
+        moveSegment(write, image, position, iov, count);
+        return;
+    }
+
+    /** Otherwise the buffers are cut at every stripe unit boundary */
+    std::vector<struct iovec> piece;
+    int index = 0;
+    size_t skip = 0;
+    for (size_t done = 0; done < total; ) {
+        size_t length = locate(offset + done, total - done, image, position);
+
+        piece.clear();
+        for (size_t left = length; left > 0; ) {
+            size_t take = std::min(left, iov[index].iov_len - skip);
+            struct iovec part = { (char*)iov[index].iov_base + skip, take };
+            piece.push_back(part);
+
+            left -= take;
+            skip += take;
+            if (skip == iov[index].iov_len) {
+                index++;
+                skip = 0;
+            }
+        }
+
+        moveSegment(write, image, position, piece.data(), (int)piece.size());
+        done += length;
+    }
+}
+
+void Volume::moveSegment(bool write, int image, off_t offset, struct iovec *iov, int count) {
+    if (backend == BACKEND_MMAP) {
+        for (int i = 0; i < count; i++) {
+            if (write) {
+                memcpy(mappings[image] + offset, iov[i].iov_base, iov[i].iov_len);
+            } else {
+                memcpy(iov[i].iov_base, mappings[image] + offset, iov[i].iov_len);
+            }
+            offset += iov[i].iov_len;
+        }
+        return;
+    }
+
+    /** preadv/pwritev may stop short, resume from the first unfinished buffer */
+    while (count > 0) {
+        counters.syscalls++;
+        ssize_t result = write 
+            ? ::pwritev(descriptors[image], iov, std::min(count, IOV_MAX), offset) 
+            : ::preadv(descriptors[image], iov, std::min(count, IOV_MAX), offset);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (result <= 0) {
+            char what[BUFSIZ];
+            snprintf(what, BUFSIZ, "Unable to %s image %d at %ld: %s", write ? "write" : "read", 
+                image, (long)offset, result < 0 ? strerror(errno) : "unexpected end of file");
+            throw std::runtime_error(what);
+        }
+
+        offset += result;
+        while (count > 0 && (size_t)result >= iov->iov_len) {
+            result -= iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + result;
+            iov->iov_len -= result;
+        }
     }
 }
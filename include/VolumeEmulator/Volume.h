@@ -2,13 +2,119 @@
 #define VOLUME_H
 
 #include <stdlib.h>
+#include <atomic>
+#include <mutex>
+#include <list>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/uio.h>
 #include "DataStructure/Config.h"
+#include "BlockCache.h"
+#include "IoRing.h"
+#include "Statistics/Histogram.h"
+
+/**
+ * @brief How the volume reaches its disk image.
+ **/
+enum VolumeBackend {
+    BACKEND_FILE,   // pread/pwrite through the block cache
+    BACKEND_MMAP,   // Whole image mapped in memory, blocks are copied in and out
+    BACKEND_URING   // pread/pwrite for single blocks, batches go asynchronously through io_uring
+};
+
+/**
+ * @brief One block of a batched read or write.
+ **/
+struct BlockRequest
+{
+    uint64_t blockNumber;
+    char *data;
+};
+
+/**
+ * @brief Settings chosen when the disk image is opened.
+ **/
+struct VolumeOptions
+{
+    VolumeBackend backend;  // I/O path used to reach the image
+    size_t queueDepth;      // Requests kept in flight by BACKEND_URING
+    bool direct;            // Bypass the kernel page cache with O_DIRECT when possible
+    size_t stripeUnit;      // Bytes kept on one image before the next one, with several images
+
+    VolumeOptions() 
+        : backend(BACKEND_FILE), queueDepth(Config::QUEUE_DEPTH), direct(false), 
+        stripeUnit(Config::STRIPE_UNIT) {}
+};
+
+/**
+ * @brief I/O that reached the disk image, cache hits are not counted here.
+ **/
+struct VolumeStats
+{
+    std::atomic<uint64_t> blocksRead;
+    std::atomic<uint64_t> blocksWritten;
+    std::atomic<uint64_t> bytesRead;
+    std::atomic<uint64_t> bytesWritten;
+    std::atomic<uint64_t> syscalls;     // preadv/pwritev, io_uring_enter, msync and fallocate calls
+    Histogram readLatency;              // One sample per transfer, a vectored run counts once
+    Histogram writeLatency;
+    Histogram syncLatency;
+
+    VolumeStats() { reset(); }
+
+    void reset();
+};
 
 class Volume {
+public:
+    /** Called once a submitted request is done, with the number of bytes moved */
+    typedef std::function<void(int result)> Completion;
+
 private:
-    int	    fileDescriptor; // File descriptor of disk image
+    /** A run of consecutive blocks in flight on the ring */
+    struct AsyncRequest
+    {
+        bool write;
+        uint64_t firstBlock;
+        std::vector<struct iovec> iov;
+        size_t bytes;
+        Completion done;
+        Stopwatch started;
+    };
+
+    /** A run of blocks read from disk by readBlocks before the cache is laid over it */
+    struct RangeRead
+    {
+        uint64_t start;
+        size_t count;
+        std::vector<uint64_t> writtenBack;  // Blocks of the run written back meanwhile
+    };
+
+    std::vector<int> descriptors;   // One per image, blocks are striped across them round-robin
+    std::vector<char*> mappings;    // Start of every mapped image (BACKEND_MMAP only)
+    VolumeBackend backend;  // Selected I/O path
+    size_t  stripeUnit;     // Bytes kept on one image before moving to the next
+    size_t  imageSize;      // Size of each image file
+    bool    direct;         // Image opened with O_DIRECT
+    bool    directWanted;   // O_DIRECT was asked for at open, it follows the block size from then on
+    size_t  directAlign;    // Alignment required by O_DIRECT transfers
     size_t  blocks;	        // Number of blocks in disk image
+    size_t  blockSize;      // Size of each block, set by the file system geometry
+    size_t  imageBytes;     // Size of the volume, over all images
     size_t  mounts;	        // Number of mounts
+    BlockCache cache;       // Write-back cache in front of the disk image
+    std::mutex cacheLock;   // Guards the cache, disk I/O itself is positional
+    std::unordered_set<uint64_t> prefetching;    // Blocks on their way into the cache, under cacheLock
+    std::unordered_set<uint64_t> filling;        // Blocks read from disk after a miss, under cacheLock
+    std::list<RangeRead> rangeReads;             // Runs being read by readBlocks, under cacheLock
+    IoRing* ring;           // Submission ring (BACKEND_URING only)
+    std::mutex ringLock;    // Guards the ring and the requests in flight
+    std::unordered_map<uint64_t, AsyncRequest> inFlight;
+    uint64_t nextTag;
+    VolumeStats counters;   // I/O done on the disk image
 
     /**
      * @brief Check parameters
@@ -16,7 +122,106 @@ private:
      * @param data Buffer to operate on
      * @exception Throws invalid_argument exception on error.
     **/
-    void sanityCheck(int blocknum, char *data);
+    void sanityCheck(uint64_t blocknum, char *data);
+
+    /**
+     * @brief Check a block number, for calls that move no data.
+     * @exception Throws invalid_argument exception past the last block.
+    **/
+    void checkRange(uint64_t blockNumber);
+
+    /**
+     * @brief Read block straight from disk image, bypassing the cache.
+    **/
+    void readRaw(uint64_t blockNumber, char *data);
+
+    /**
+     * @brief Write block straight to disk image, bypassing the cache.
+    **/
+    void writeRaw(uint64_t blockNumber, const char *data);
+
+    /**
+     * @brief Write back a dirty block leaving the cache, under cacheLock.
+     * @brief A fill of that block under way would bring back an older copy, it is dropped,
+     * @brief and a run being read over it is told to read the block again.
+    **/
+    void writeBack(uint64_t blockNumber, const char *data);
+
+    /**
+     * @brief Move buffers to or from consecutive blocks starting at firstBlock with one
+     * @brief preadv/pwritev (or memcpy when mapped), resuming after short transfers.
+    **/
+    void transfer(bool write, uint64_t firstBlock, struct iovec *iov, int count);
+
+    /**
+     * @brief Body of transfer, without the accounting. 
+     * @brief Buffers are split where the volume moves on to another image.
+    **/
+    void move(bool write, uint64_t firstBlock, struct iovec *iov, int count);
+
+    /**
+     * @brief Move buffers to or from offset in one image.
+    **/
+    void moveSegment(bool write, int image, off_t offset, struct iovec *iov, int count);
+
+    /**
+     * @brief Find the image and the position in it of a byte of the volume.
+     * @return How many of the length bytes from offset on are contiguous in that image.
+    **/
+    size_t locate(off_t offset, size_t length, int &image, off_t &position) const;
+
+    /**
+     * @brief Bytes of [begin, end) held by one image, which are contiguous in it.
+     * @return false when that image holds none of them.
+    **/
+    bool imageRange(off_t begin, off_t end, int image, off_t &first, off_t &last) const;
+
+    /**
+     * @brief Count a transfer of bytes that took nanos nanoseconds.
+    **/
+    void account(bool write, size_t bytes, uint64_t nanos);
+
+    /**
+     * @brief Turn O_DIRECT on every image when it was asked for and blocks and stripe units 
+     * @brief are whole sectors, off otherwise. Images whose file system refuses it stay buffered.
+    **/
+    void applyDirect();
+
+    /**
+     * @brief Check if every buffer can be handed to O_DIRECT as is.
+    **/
+    bool isAligned(const struct iovec *iov, int count) const;
+
+    /**
+     * @brief Copy a cached block into data, waiting for it first if it is being read ahead.
+     * @return false on a miss.
+    **/
+    bool lookup(uint64_t blockNumber, char *data);
+
+    /**
+     * @brief Check if block next can be moved in the same call as block previous.
+    **/
+    bool sameRun(uint64_t previous, uint64_t next) const;
+
+    /**
+     * @brief Sort requests and transfer each contiguous run in a single call.
+    **/
+    void submitRuns(bool write, std::vector<BlockRequest> &requests);
+
+    /**
+     * @brief Queue a run on the ring, or perform it at once without one.
+    **/
+    void enqueue(bool write, uint64_t firstBlock, std::vector<struct iovec> &iov, Completion done);
+
+    /**
+     * @brief Wait for minComplete requests and finish every request reaped.
+     * @brief Callbacks are collected in finished and run by the caller without the lock.
+    **/
+    void complete(unsigned minComplete, std::vector<AsyncRequest> &finished);
+
+    /** The cache keeps a callback to this volume, so it must not be copied */
+    Volume(const Volume&);
+    Volume& operator=(const Volume&);
 public:
     
     Volume();
@@ -28,6 +233,19 @@ public:
     **/
     size_t size() const { return blocks; }
 
+    /**
+     * @brief Return the size of a block in bytes.
+    **/
+    size_t getBlockSize() const { return blockSize; }
+
+    /**
+     * @brief Change the block size, the number of blocks follows from the image size.
+     * @brief Cached blocks are written back and dropped first.
+     * @exception Throws invalid_argument unless size is a power of two
+     * @exception between Config::BLOCK_SIZE and Config::MAX_BLOCK_SIZE.
+    **/
+    void setBlockSize(size_t size);
+
     /**
      * @brief Check if the volume has been mounted.
     **/
@@ -46,29 +264,142 @@ public:
         if (mounts > 0) {
             --mounts; 
         }
+
+        if (mounts == 0) {
+            sync();
+        }
     }
 
+    /**
+     * @brief Write every dirty cached block back to disk image (msync when mapped).
+    **/
+    void sync();
+
+    /**
+     * @brief Set the number of blocks kept in the cache (0 disables caching).
+    **/
+    void setCacheSize(size_t blocks);
+
+    /**
+     * @brief Hit, miss and write-back counters of the cache.
+    **/
+    const CacheStats& cacheStats() const { return cache.stats(); }
+
+    /**
+     * @brief Blocks, bytes, system calls and latencies of the I/O done on the disk image.
+    **/
+    const VolumeStats& stats() const { return counters; }
+
+    /**
+     * @brief Start counting again, for the cache as well.
+    **/
+    void resetStats();
+
     /**
      * @brief Open disk image
      * @param path Path to disk image
-     * @param blocks Number of blocks in disk image
+     * @param blocks Size of disk image, counted in blocks of Config::BLOCK_SIZE
+     * @param options Backend, queue depth and O_DIRECT selection
      * @exception Throws runtime_error exception on error.
     **/
-    void open(const char *path, size_t blocks);
+    void open(const char *path, size_t blocks, const VolumeOptions &options = VolumeOptions());
+
+    /**
+     * @brief Open a volume striped across several disk images (RAID-0 like):
+     * @brief consecutive stripe units of the volume go to the images in turn.
+     * @param paths Paths to the disk images, always given in the same order
+     * @param blocks Size of the whole volume, counted in blocks of Config::BLOCK_SIZE
+     * @exception Throws invalid_argument exception unless the stripe unit is a power of two
+     * @exception of at least Config::BLOCK_SIZE, runtime_error exception on other errors.
+    **/
+    void open(const std::vector<std::string> &paths, size_t blocks, 
+        const VolumeOptions &options = VolumeOptions());
+
+    /**
+     * @brief Number of images the volume is striped across.
+    **/
+    size_t images() const { return descriptors.size(); }
+
+    /**
+     * @brief Check if the image is accessed with O_DIRECT.
+     * @brief It is not while the block size is not a multiple of the logical sector size,
+     * @brief nor when the file system does not support it, even if it was asked for.
+    **/
+    bool isDirect() const { return direct; }
+
+    /**
+     * @brief Direct pointer to a block for zero-copy access.
+     * @return NULL unless the volume is memory-mapped, or when the block straddles two images.
+    **/
+    char* blockPointer(uint64_t blockNumber);
 
     /**
-     * @brief Read block from disk
+     * @brief Read block from disk. Safe to call from several threads at once.
      * @param blockNumber Block to read from
      * @param data Buffer to read into
     **/
-    void readBlock(int blockNumber, char *data);
+    void readBlock(uint64_t blockNumber, char *data);
     
     /** 
-     * @brief Write block to disk
+     * @brief Write block to disk. Safe to call from several threads at once.
      * @param blockNumber Block to write to
      * @param data Buffer to write from
     **/
-    void writeBlock(int blockNumber, char *data);
+    void writeBlock(uint64_t blockNumber, char *data);
+
+    /**
+     * @brief Read count consecutive blocks with a single call.
+     * @param start First block to read from
+     * @param data Buffer of count blocks to read into
+    **/
+    void readBlocks(uint64_t start, size_t count, char *data);
+
+    /**
+     * @brief Write count consecutive blocks with a single call, bypassing the cache.
+     * @param start First block to write to
+     * @param data Buffer of count blocks to write from
+    **/
+    void writeBlocks(uint64_t start, size_t count, const char *data);
+
+    /**
+     * @brief Zero count blocks from start on, punching a hole in the image when possible
+     * @brief so that no data is written and the space is given back to the file system.
+    **/
+    void discard(uint64_t start, size_t count);
+
+    /**
+     * @brief Read scattered blocks, each contiguous run is issued as one preadv.
+    **/
+    void readBlocks(std::vector<BlockRequest> requests);
+
+    /**
+     * @brief Write scattered blocks, each contiguous run is issued as one pwritev.
+    **/
+    void writeBlocks(std::vector<BlockRequest> requests);
+
+    /**
+     * @brief Start reading blocks ahead of their use, without waiting for them.
+     * @brief With io_uring they are read into the cache; otherwise the kernel is asked to
+     * @brief read them into the page cache (nothing is done with O_DIRECT).
+    **/
+    void prefetch(std::vector<uint64_t> blockNumbers);
+
+    /**
+     * @brief Start reading a block without waiting for it.
+     * @brief data must stay valid until done runs; without io_uring it runs before returning.
+    **/
+    void submitRead(uint64_t blockNumber, char *data, Completion done = Completion());
+
+    /**
+     * @brief Start writing a block without waiting for it, bypassing the cache.
+     * @brief Reads of the same block are only ordered after it once drain() returns.
+    **/
+    void submitWrite(uint64_t blockNumber, const char *data, Completion done = Completion());
+
+    /**
+     * @brief Wait for every submitted request and run their callbacks.
+    **/
+    void drain();
 };
 
 #endif
\ No newline at end of file
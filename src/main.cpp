@@ -7,20 +7,23 @@
 #include "Shell/CommandType.h"
 
 Command convertToCommand(char* cmd);
-bool startUpDisk(Volume& disk, const char* imagePath, const int& blocks);
+bool startUpDisk(Volume& disk, const char* imagePath, size_t blocks, int optionCount, char* options[]);
+bool handleFormat(Shell& shell, int args, char* arg1, char* arg2, char* arg3);
 bool handlePassword(Shell& shell, char* flag);
+bool handleScrub(Shell& shell, int args, char* arg1);
 bool handlePassword(Shell& shell, char* flag, char* file);
 
 int main(int argc, char* argv[]) {
     Volume disk;
     MyFS fileSystem;
 
-    if (argc != 3) {
-        fprintf(stderr, "[?] Format: %s <file> <blocks>\n", argv[0]);
+    if (argc < 3) {
+        fprintf(stderr, "[?] Format: %s <file>[,<file>...] <blocks> [file|mmap|uring] [direct] "
+            "[stripe=<bytes>]\n", argv[0]);
     	return EXIT_FAILURE;
     }
 
-    if (!startUpDisk(disk, argv[1], std::atoi(argv[2]))) {
+    if (!startUpDisk(disk, argv[1], std::strtoull(argv[2], NULL, 10), argc - 3, argv + 3)) {
         return EXIT_FAILURE;
     }
 
@@ -30,7 +33,8 @@ int main(int argc, char* argv[]) {
         char line[BUFSIZ], 
             cmd[BUFSIZ], 
             arg1[BUFSIZ], 
-            arg2[BUFSIZ];
+            arg2[BUFSIZ],
+            arg3[BUFSIZ];
 
         fprintf(stderr, "3d> ");
     	fflush(stderr);
@@ -39,15 +43,16 @@ int main(int argc, char* argv[]) {
     	    break;
     	}
 
-        int args = sscanf(line, "%s %s %s", cmd, arg1, arg2);
+        int args = sscanf(line, "%s %s %s %s", cmd, arg1, arg2, arg3);
     	if (args == 0) {
     	    continue;
 	    }
 
         Command command = convertToCommand(cmd);
+        Stopwatch watch;
         switch(command) {
             case FORMAT:
-                if (shell.format()) {
+                if (handleFormat(shell, args, arg1, arg2, arg3)) {
                     std::cout << "[*] Formatted" << std::endl;
                 } else {
                     std::cout << "[!] Error: Unable format disk!" << std::endl;
@@ -128,6 +133,23 @@ int main(int argc, char* argv[]) {
                 }
                 break;
 
+            case SYNC:
+                shell.sync();
+                std::cout << "[*] Synced." << std::endl;
+                break;
+
+            case STATS:
+                if (!shell.stats(args > 1 ? arg1 : "")) {
+                    std::cout << "[!] Usage: stats [json|reset]" << std::endl;
+                }
+                break;
+
+            case SCRUB:
+                if (!handleScrub(shell, args, arg1)) {
+                    std::cout << "[!] Usage: scrub [MiB/s|stop], on a mounted volume with checksums" << std::endl;
+                }
+                break;
+
             case EXIT:
                 status = false;
                 break;
@@ -135,8 +157,15 @@ int main(int argc, char* argv[]) {
             default:
                 std::cout << "[!] Unknown command." << std::endl;
         };
+
+        if (command != WAITING && command != STATS) {
+            shell.record(cmd, watch.elapsed());
+        }
     }
 
+    /** A clean unmount lets the next mount skip the inode table scan */
+    shell.exit();
+
     return 0;
 }
 
@@ -163,6 +192,12 @@ Command convertToCommand(char* cmd) {
         return OUTPORT;
 	} else if (strcmp(cmd, "import")== 0) {
         return IMPORT;
+	} else if (strcmp(cmd, "sync")== 0) {
+        return SYNC;
+	} else if (strcmp(cmd, "stats")== 0) {
+        return STATS;
+	} else if (strcmp(cmd, "scrub")== 0) {
+        return SCRUB;
 	} else if (strcmp(cmd, "exit")== 0 || strcmp(cmd, "quit")== 0) {
 	    return EXIT;
 	};
@@ -170,14 +205,99 @@ Command convertToCommand(char* cmd) {
     return WAITING;
 }
 
-bool startUpDisk(Volume& disk, const char* imagePath, const int& blocks) {
+bool startUpDisk(Volume& disk, const char* imagePath, size_t blocks, int optionCount, char* options[]) {
+    VolumeOptions selected;
+    for (int i = 0; i < optionCount; i++) {
+        if (strcmp(options[i], "file") == 0) {
+            selected.backend = BACKEND_FILE;
+        } else if (strcmp(options[i], "mmap") == 0) {
+            selected.backend = BACKEND_MMAP;
+        } else if (strcmp(options[i], "uring") == 0) {
+            selected.backend = BACKEND_URING;
+        } else if (strcmp(options[i], "direct") == 0) {
+            selected.direct = true;
+        } else if (strncmp(options[i], "stripe=", 7) == 0) {
+            selected.stripeUnit = strtoul(options[i] + 7, NULL, 10);
+        } else {
+            fprintf(stderr, "[!] Error: Unknown option %s\n", options[i]);
+            return false;
+        }
+    }
+
+    /** Several images separated by commas make a striped volume */
+    std::vector<std::string> paths;
+    std::stringstream list(imagePath);
+    std::string path;
+    while (std::getline(list, path, ',')) {
+        if (!path.empty()) {
+            paths.push_back(path);
+        }
+    }
+
     try {
-        disk.open(imagePath, blocks);
-    } catch(std::runtime_error &e) {
+        disk.open(paths, blocks, selected);
+    } catch(std::exception &e) {
         fprintf(stderr, "[!] Error: Cannot open disk %s / %s\n", imagePath, e.what());
     	return false;
     }
 
+    /** Blocks of the mounted volume may be larger, whole sectors turn O_DIRECT on then */
+    if (selected.direct && !disk.isDirect()) {
+        fprintf(stderr, "[?] O_DIRECT is not available for %s with %zu-byte blocks, using buffered I/O.\n", 
+            imagePath, disk.getBlockSize());
+    }
+
+    return true;
+}
+
+bool handleFormat(Shell& shell, int args, char* arg1, char* arg2, char* arg3) {
+    /** format [blocksize] [full] [lz | dedup] */
+    size_t blockSize = Config::BLOCK_SIZE;
+    bool lazy = true;
+    uint32_t compression = MetaBlock::NONE;
+    bool dedup = false;
+
+    char* options[] = { arg1, arg2, arg3 };
+    for (int i = 0; i < args - 1 && i < 3; i++) {
+        if (strcmp(options[i], "full") == 0) {
+            lazy = false;
+        } else if (strcmp(options[i], "lz") == 0) {
+            compression = MetaBlock::LZ;
+        } else if (strcmp(options[i], "dedup") == 0) {
+            dedup = true;
+        } else {
+            blockSize = strtoul(options[i], NULL, 10);
+        }
+    }
+
+    return shell.format(blockSize, lazy, compression, dedup);
+}
+
+bool handleScrub(Shell& shell, int args, char* arg1) {
+    /** scrub [MiB/s | stop]: a scrub already running reports how far it got */
+    ScrubStats scrub = shell.scrubStats();
+    if (args > 1 && strcmp(arg1, "stop") == 0) {
+        shell.stopScrub();
+        std::cout << "[*] Scrub stopped." << std::endl;
+        return true;
+    }
+
+    if (scrub.running) {
+        std::cout << "[*] Scrubbing: " << scrub.blocksScrubbed << " of " << scrub.blocksTotal 
+            << " blocks, " << scrub.blocksCorrupt << " corrupt." << std::endl;
+        return true;
+    }
+
+    size_t rate = Config::SCRUB_RATE;
+    if (args > 1) {
+        rate = strtoul(arg1, NULL, 10) << 20;
+    }
+
+    if (!shell.scrub(rate)) {
+        return false;
+    }
+
+    std::cout << "[*] Scrub started." << std::endl;
     return true;
 }
 
@@ -0,0 +1,212 @@
+#!/bin/bash
+# Check the hierarchical Bitmap against a plain model: next-fit allocation wrapping past the
+# cursor, runs up to the last bit of the volume, and summaries after every kind of change.
+
+WORKSPACE=$(mktemp -d)
+trap "rm -rf $WORKSPACE" EXIT
+
+cat > $WORKSPACE/bitmap.cpp <<'EOF'
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "DataStructure/Bitmap.h"
+
+static int failures = 0;
+
+static void check(bool passed, const char *what, size_t bits) {
+    if (!passed && failures++ < 20) {
+        printf("  FAIL %s (%zu bits)\n", what, bits);
+    }
+}
+
+/* The same bits as a plain vector, searched one by one */
+struct Model {
+    std::vector<bool> used;
+    size_t cursor;
+
+    explicit Model(size_t bits) : used(bits, false), cursor(0) {}
+
+    bool clear(size_t from, size_t count) const {
+        for (size_t bit = from; bit < from + count; bit++) {
+            if (used[bit]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* next-fit: the first fit at or after the cursor, else the first one before it */
+    size_t allocateRun(size_t count, size_t lower, size_t upper) {
+        upper = std::min(upper, used.size());
+        if (count == 0 || lower >= upper || count > upper - lower) {
+            return Bitmap::npos;
+        }
+
+        size_t start = cursor >= lower && cursor < upper ? cursor : lower;
+        size_t found = Bitmap::npos;
+        for (size_t first = start; first + count <= upper && found == Bitmap::npos; first++) {
+            found = clear(first, count) ? first : found;
+        }
+        for (size_t first = lower; first < start && first + count <= upper && found == Bitmap::npos; first++) {
+            found = clear(first, count) ? first : found;
+        }
+
+        if (found != Bitmap::npos) {
+            for (size_t bit = found; bit < found + count; bit++) {
+                used[bit] = true;
+            }
+            cursor = found + count;
+        }
+        return found;
+    }
+
+    size_t count(size_t from, size_t to) const {
+        size_t total = 0;
+        for (size_t bit = from; bit < std::min(to, used.size()); bit++) {
+            total += used[bit];
+        }
+        return total;
+    }
+};
+
+static void compare(const Bitmap &bitmap, const Model &model, const char *what) {
+    size_t bits = model.used.size();
+    check(bitmap.count() == model.count(0, bits), what, bits);
+    for (size_t bit = 0; bit < bits; bit++) {
+        if (bitmap.test(bit) != model.used[bit]) {
+            check(false, what, bits);
+            return;
+        }
+    }
+}
+
+/* Random changes and allocations over bitmaps of one to four levels */
+static void randomized(size_t bits) {
+    Bitmap bitmap(bits);
+    Model model(bits);
+
+    /* the model searches bit by bit, large bitmaps get fewer steps */
+    int steps = bits > 10000 ? 200 : 4000;
+    for (int step = 0; step < steps; step++) {
+        size_t lower = rand() % 3 ? 0 : rand() % bits;
+        size_t upper = rand() % 3 ? bits : lower + rand() % (bits - lower + 1);
+        size_t bit = rand() % bits;
+
+        switch (rand() % 6) {
+        case 0:
+            bitmap.set(bit);
+            model.used[bit] = true;
+            break;
+        case 1:
+        case 2:
+            bitmap.reset(bit);
+            model.used[bit] = false;
+            break;
+        case 3:
+            check(bitmap.allocate(lower, upper) == model.allocateRun(1, lower, upper), "allocate", bits);
+            break;
+        case 4: {
+            size_t count = 1 + rand() % (rand() % 4 ? 8 : 300);
+            check(bitmap.allocateRun(count, lower, upper) == model.allocateRun(count, lower, upper), "allocateRun", bits);
+            break;
+        }
+        case 5: {
+            size_t first = Bitmap::npos;
+            for (size_t b = lower; b < std::min(upper, bits) && first == Bitmap::npos; b++) {
+                first = model.used[b] ? first : b;
+            }
+            check(bitmap.find(lower, upper) == first, "find", bits);
+            check(bitmap.count(lower, upper) == model.count(lower, upper), "count range", bits);
+            break;
+        }
+        }
+    }
+    compare(bitmap, model, "random changes");
+
+    /* marked bits only show up in the summaries after a rebuild */
+    for (int k = 0; k < 50; k++) {
+        size_t bit = rand() % bits;
+        bitmap.mark(bit);
+        model.used[bit] = true;
+    }
+    bitmap.rebuild();
+    compare(bitmap, model, "mark and rebuild");
+
+    /* stored words come back the same, summaries included */
+    std::vector<uint64_t> words(bitmap.words(), bitmap.words() + bitmap.wordCount());
+    Bitmap restored(bits);
+    restored.assign(words.data(), words.size());
+    compare(restored, model, "assign");
+
+    /* filled up one allocation at a time, then nothing is left */
+    Model full = model;
+    while (restored.allocate(0, bits) != Bitmap::npos) {
+    }
+    full.used.assign(bits, true);
+    compare(restored, full, "allocate until full");
+    check(restored.allocateRun(1, 0, bits) == Bitmap::npos, "run on a full bitmap", bits);
+}
+
+static void edges(size_t bits) {
+    /* the only room is at the very end, the last partial word included */
+    Bitmap bitmap(bits);
+    for (size_t bit = 0; bit + 10 < bits; bit++) {
+        bitmap.set(bit);
+    }
+    check(bitmap.allocateRun(11, 0, bits) == Bitmap::npos, "run longer than the room at the end", bits);
+    check(bitmap.allocateRun(10, 0, bits) == bits - 10, "run up to the last bit", bits);
+    check(bitmap.allocate(0, bits) == Bitmap::npos, "allocate past the last bit", bits);
+    check(bitmap.count() == bits, "count of a full bitmap", bits);
+
+    /* with the cursor at the end, the search wraps around to the free bits before it */
+    bitmap.reset(3);
+    bitmap.reset(4);
+    bitmap.reset(bits / 2);
+    check(bitmap.allocate(0, bits) == 3, "allocate wraps to the start", bits);
+    check(bitmap.allocateRun(2, 0, bits) == Bitmap::npos, "no run of two left", bits);
+    check(bitmap.allocate(0, bits) == 4, "allocate goes on from the cursor", bits);
+    check(bitmap.allocate(0, bits) == bits / 2, "allocate skips full words", bits);
+
+    /* a run just before the cursor, reaching past it, is found by the second pass */
+    bitmap.reset(bits - 1);
+    bitmap.reset(bits - 2);
+    bitmap.reset(bits - 3);
+    check(bitmap.allocate(bits - 2, bits) == bits - 2, "allocate in a range", bits);
+    bitmap.reset(bits - 2);
+    check(bitmap.allocateRun(3, 0, bits) == bits - 3, "run wrapping back before the cursor", bits);
+
+    /* a range that ends before the volume keeps runs inside it */
+    Bitmap range(bits);
+    check(range.allocateRun(5, bits - 20, bits - 16) == Bitmap::npos, "run longer than the range", bits);
+    check(range.allocateRun(4, bits - 20, bits - 16) == bits - 20, "run filling the range", bits);
+    check(range.allocate(bits - 20, bits - 16) == Bitmap::npos, "allocate in a full range", bits);
+}
+
+int main() {
+    srand(5);
+    size_t sizes[] = { 1, 63, 64, 65, 200, 4095, 4096, 4097, 262145 };
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        randomized(sizes[i]);
+        if (sizes[i] >= 64) {
+            edges(sizes[i]);
+        }
+    }
+
+    return failures ? 1 : 0;
+}
+EOF
+
+echo "Testing allocation bitmap ..."
+if ! g++ -std=gnu++11 -Iinclude -o $WORKSPACE/bitmap $WORKSPACE/bitmap.cpp -Llib -lfs -pthread; then
+    echo "Failure: cannot build the test"
+    exit 1
+fi
+
+if $WORKSPACE/bitmap; then
+    echo "Success"
+else
+    echo "Failure"
+    exit 1
+fi
@@ -0,0 +1,172 @@
+#!/bin/bash
+# Grow files block by block in turns so their extents fragment, into the Extent Block and
+# past it into a tree, then outport them again after a remount and remove them.
+
+WORKSPACE=$(mktemp -d)
+trap "rm -rf $WORKSPACE" EXIT
+
+cat > $WORKSPACE/extents.cpp <<'EOF'
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/* The extent table and write() are private, the shell only imports whole files */
+#define private public
+#include "FileSystem/MyFS.h"
+#undef private
+
+static int failures = 0;
+static std::string workspace;
+
+static void check(bool passed, const char *what, const std::string &file) {
+    if (!passed) {
+        printf("  FAIL %s (%s)\n", what, file.c_str());
+        failures++;
+    }
+}
+
+static std::vector<char> load(const std::string &path) {
+    std::vector<char> data;
+    FILE *stream = fopen(path.c_str(), "r");
+    if (stream) {
+        char buffer[65536];
+        for (size_t n; (n = fread(buffer, 1, sizeof(buffer), stream)) > 0; ) {
+            data.insert(data.end(), buffer, buffer + n);
+        }
+        fclose(stream);
+    }
+    return data;
+}
+
+static void store(const std::string &path, const std::vector<char> &data) {
+    FILE *stream = fopen(path.c_str(), "w");
+    fwrite(data.data(), 1, data.size(), stream);
+    fclose(stream);
+}
+
+static size_t inumberOf(MyFS &fs, const std::string &name) {
+    int offset = fs.dirLookup(fs.currentDir, (char*)name.c_str());
+    return offset >= 0 ? fs.currentDir.table[offset].inumber : 0;
+}
+
+static Inode inodeOf(MyFS &fs, const std::string &name) {
+    Inode node;
+    memset(&node, 0, sizeof(node));
+    fs.loadInode(inumberOf(fs, name), &node);
+    return node;
+}
+
+static bool outportSame(MyFS &fs, const std::string &name, const std::vector<char> &expected) {
+    std::string path = workspace + "/out";
+    return fs.outport((char*)name.c_str(), path.c_str()) && load(path) == expected;
+}
+
+static void append(MyFS &fs, const std::string &name, std::vector<char> &content, size_t length) {
+    std::vector<char> data(length);
+    for (size_t k = 0; k < length; k++) {
+        data[k] = rand();
+    }
+
+    ssize_t written = fs.write(inumberOf(fs, name), data.data(), (int)length, content.size());
+    check(written == (ssize_t)length, "write", name);
+    content.insert(content.end(), data.begin(), data.end());
+}
+
+int main(int argc, char **argv) {
+    workspace = argv[1];
+    std::string image = workspace + "/extents.img";
+    srand(13);
+
+    const char *names[] = { "a", "b", "c", "d" };
+    std::vector<char> contents[4];
+    size_t baseline = 0;
+    uint32_t table = 0;
+    {
+        Volume volume;
+        volume.open(image.c_str(), 20000);
+        if (!MyFS::format(&volume, 512)) {
+            check(false, "format", image);
+            return 1;
+        }
+
+        MyFS fs;
+        fs.mount(&volume);
+        baseline = fs.freeBlocks.count();
+        table = Config::EXTENTS_PER_INODE + fs.geometry.extentsPerBlock;
+
+        for (int f = 0; f < 3; f++) {
+            check(fs.touch((char*)names[f]), "touch", names[f]);
+        }
+
+        /* 
+         * a and b take blocks in turns, then b and c: every block is an extent of its own.
+         * a fills part of its Extent Block, c fills it up, b runs out of it and becomes a tree.
+         **/
+        for (uint32_t round = 0; round < 40 + table; round++) {
+            int first = round < 40 ? 0 : 2;
+            append(fs, names[first], contents[first], 512);
+            append(fs, names[1], contents[1], 512);
+        }
+
+        /* a ends inside its last block, which is read back before the next write */
+        append(fs, names[0], contents[0], 300);
+        append(fs, names[0], contents[0], 100);
+
+        /* d is imported whole into free space, a single extent */
+        contents[3].resize(100000);
+        for (size_t k = 0; k < contents[3].size(); k++) {
+            contents[3][k] = rand();
+        }
+        store(workspace + "/in", contents[3]);
+        check(fs.import((workspace + "/in").c_str(), (char*)names[3]), "import", names[3]);
+
+        Inode a = inodeOf(fs, names[0]), b = inodeOf(fs, names[1]);
+        Inode c = inodeOf(fs, names[2]), d = inodeOf(fs, names[3]);
+        check((a.flags & Inode::EXTENTS) && a.extentCount == 41 && a.extentBlock != 0, "extents in the Extent Block", names[0]);
+        check((b.flags & Inode::TREE) && b.fileSize() == contents[1].size(), "past the extent table", names[1]);
+        check((c.flags & Inode::EXTENTS) && c.extentCount == table, "full extent table", names[2]);
+        check((d.flags & Inode::EXTENTS) && d.extentCount == 1, "imported in one extent", names[3]);
+
+        for (int f = 0; f < 4; f++) {
+            check(outportSame(fs, names[f], contents[f]), "outport", names[f]);
+        }
+        fs.exit();
+    }
+
+    /* another volume object, so every Extent Block comes from the image */
+    Volume volume;
+    volume.open(image.c_str(), 20000);
+    MyFS fs;
+    check(fs.mount(&volume), "remount", image);
+
+    /* a takes more extents, c has no room for another one and becomes a tree */
+    append(fs, names[0], contents[0], 5000);
+    append(fs, names[2], contents[2], 512);
+    check(inodeOf(fs, names[2]).flags & Inode::TREE, "full extent table after remount", names[2]);
+    for (int f = 0; f < 4; f++) {
+        check(outportSame(fs, names[f], contents[f]), "outport after remount", names[f]);
+        check(fs.rm((char*)names[f]), "rm", names[f]);
+    }
+
+    check(fs.freeBlocks.count() == baseline, "blocks freed", image);
+    fs.exit();
+
+    return failures ? 1 : 0;
+}
+EOF
+
+echo "Testing fragmented extents ..."
+if ! g++ -std=gnu++11 -Iinclude -o $WORKSPACE/extents $WORKSPACE/extents.cpp -Llib -lfs -pthread; then
+    echo "Failure: cannot build the test"
+    exit 1
+fi
+
+# Imports report every copy, only the failures are kept
+if $WORKSPACE/extents $WORKSPACE > $WORKSPACE/log 2>&1; then
+    echo "Success"
+else
+    grep FAIL $WORKSPACE/log
+    echo "Failure"
+    exit 1
+fi
@@ -0,0 +1,162 @@
+#!/bin/bash
+# Import files around the inline limit on plain, compressed and deduplicated volumes,
+# grow inline files past it, then outport them again after a remount.
+
+WORKSPACE=$(mktemp -d)
+trap "rm -rf $WORKSPACE" EXIT
+
+cat > $WORKSPACE/inline.cpp <<'EOF'
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/* The inode flags are private, the shell never shows how a file is stored */
+#define private public
+#include "FileSystem/MyFS.h"
+#undef private
+
+static int failures = 0;
+static std::string workspace;
+
+static void check(bool passed, const char *what, const std::string &file) {
+    if (!passed) {
+        printf("  FAIL %s (%s)\n", what, file.c_str());
+        failures++;
+    }
+}
+
+static std::vector<char> load(const std::string &path) {
+    std::vector<char> data;
+    FILE *stream = fopen(path.c_str(), "r");
+    for (int c; stream && (c = fgetc(stream)) != EOF; ) {
+        data.push_back((char)c);
+    }
+    if (stream) {
+        fclose(stream);
+    }
+    return data;
+}
+
+static void store(const std::string &path, const std::vector<char> &data) {
+    FILE *stream = fopen(path.c_str(), "w");
+    fwrite(data.data(), 1, data.size(), stream);
+    fclose(stream);
+}
+
+static Inode inodeOf(MyFS &fs, const std::string &name) {
+    Inode node;
+    memset(&node, 0, sizeof(node));
+    int offset = fs.dirLookup(fs.currentDir, (char*)name.c_str());
+    if (offset >= 0) {
+        fs.loadInode(fs.currentDir.table[offset].inumber, &node);
+    }
+    return node;
+}
+
+static bool outportSame(MyFS &fs, const std::string &name, const std::vector<char> &expected) {
+    std::string path = workspace + "/out";
+    return fs.outport((char*)name.c_str(), path.c_str()) && load(path) == expected;
+}
+
+int main(int argc, char **argv) {
+    workspace = argv[1];
+    srand(3);
+
+    const char *kinds[] = { "plain", "lz", "dedup" };
+    for (int kind = 0; kind < 3; kind++) {
+        std::string image = workspace + "/" + kinds[kind] + ".img";
+        uint32_t inlineBytes = 0;
+        size_t baseline = 0;
+
+        /* sizes on both sides of the limit, the first ones stay in the inode */
+        std::vector<size_t> sizes;
+        sizes.push_back(0);
+        sizes.push_back(1);
+        std::vector<std::vector<char> > contents;
+
+        {
+            Volume volume;
+            volume.open(image.c_str(), 20000);
+            if (!MyFS::format(&volume, 512, true, kind == 1 ? MetaBlock::LZ : MetaBlock::NONE, kind == 2)) {
+                check(false, "format", image);
+                return 1;
+            }
+
+            MyFS fs;
+            fs.mount(&volume);
+            baseline = fs.freeBlocks.count();
+            inlineBytes = fs.geometry.inlineBytes;
+            check(inlineBytes > 0, "room for inline data", image);
+            sizes.push_back(inlineBytes);
+            sizes.push_back(inlineBytes + 1);
+            sizes.push_back(5000);
+
+            for (size_t i = 0; i < sizes.size(); i++) {
+                std::string name = "f" + std::to_string(i);
+                std::vector<char> data(sizes[i]);
+                for (size_t k = 0; k < data.size(); k++) {
+                    data[k] = kind == 1 ? 'a' + rand() % 4 : rand();
+                }
+                contents.push_back(data);
+                store(workspace + "/in", data);
+
+                check(fs.import((workspace + "/in").c_str(), (char*)name.c_str()), "import", name);
+                Inode node = inodeOf(fs, name);
+                check(((node.flags & Inode::INLINE) != 0) == (sizes[i] <= inlineBytes), "inline iff it fits", name);
+                check(node.fileSize() == sizes[i], "size", name);
+            }
+
+            /* an inline file written past the limit moves to blocks, its first bytes kept */
+            std::string name = "f1";
+            std::vector<char> tail(inlineBytes * 3);
+            for (size_t k = 0; k < tail.size(); k++) {
+                tail[k] = kind == 1 ? 'x' : rand();
+            }
+            int offset = fs.dirLookup(fs.currentDir, (char*)name.c_str());
+            size_t inumber = fs.currentDir.table[offset].inumber;
+            check(fs.write(inumber, tail.data(), (int)tail.size(), 1) == (ssize_t)tail.size(), "write past the limit", name);
+            contents[1].insert(contents[1].end(), tail.begin(), tail.end());
+            check(!(inodeOf(fs, name).flags & Inode::INLINE), "grown file leaves the inode", name);
+
+            for (size_t i = 0; i < sizes.size(); i++) {
+                std::string name = "f" + std::to_string(i);
+                check(outportSame(fs, name, contents[i]), "outport", name);
+            }
+            fs.exit();
+        }
+
+        /* another volume object, so every byte comes from the image */
+        Volume volume;
+        volume.open(image.c_str(), 20000);
+        MyFS fs;
+        check(fs.mount(&volume), "remount", image);
+        for (size_t i = 0; i < sizes.size(); i++) {
+            std::string name = "f" + std::to_string(i);
+            check(outportSame(fs, name, contents[i]), "outport after remount", name);
+            check(fs.rm((char*)name.c_str()), "rm", name);
+        }
+
+        /* removing every file gives back every block, inline files had none */
+        check(fs.freeBlocks.count() == baseline, "blocks freed", image);
+        fs.exit();
+    }
+
+    return failures ? 1 : 0;
+}
+EOF
+
+echo "Testing inline files ..."
+if ! g++ -std=gnu++11 -Iinclude -o $WORKSPACE/inline $WORKSPACE/inline.cpp -Llib -lfs -pthread; then
+    echo "Failure: cannot build the test"
+    exit 1
+fi
+
+# Imports report every copy, only the failures are kept
+if $WORKSPACE/inline $WORKSPACE > $WORKSPACE/log 2>&1; then
+    echo "Success"
+else
+    grep FAIL $WORKSPACE/log
+    echo "Failure"
+    exit 1
+fi
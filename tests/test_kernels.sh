@@ -0,0 +1,229 @@
+#!/bin/bash
+# Check every SHA-256 kernel and both CRC-32C paths against known vectors,
+# including the kernels the dispatcher does not pick on this CPU.
+
+WORKSPACE=$(mktemp -d)
+trap "rm -rf $WORKSPACE" EXIT
+
+cat > $WORKSPACE/kernels.cpp <<'EOF'
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+/* The kernels are private, the dispatch only ever runs the best one */
+#define private public
+#include "HashMachine/Hasher.h"
+#include "HashMachine/Crc32c.h"
+#undef private
+
+typedef void (*Transform)(uint32_t *state, const uint8_t *blocks, size_t count);
+
+static int failures = 0;
+
+static void check(bool passed, const char *what) {
+    if (!passed) {
+        printf("  FAIL %s\n", what);
+        failures++;
+    }
+}
+
+static bool cpuHas(unsigned int leaf, int reg, int bit) {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int r[4];
+    if (!__get_cpuid_count(leaf, 0, &r[0], &r[1], &r[2], &r[3])) {
+        return false;
+    }
+    return r[reg] & (1u << bit);
+#else
+    return false;
+#endif
+}
+
+/* AVX2 also needs the OS to save the YMM registers */
+static bool cpuHasAvx2() {
+#if defined(__x86_64__) || defined(__i386__)
+    if (!cpuHas(7, 1, 5) || !cpuHas(1, 2, 27) || !cpuHas(1, 2, 28)) {
+        return false;
+    }
+    uint32_t xcr0, high;
+    __asm__ ("xgetbv" : "=a" (xcr0), "=d" (high) : "c" (0));
+    return (xcr0 & 6) == 6;
+#else
+    return false;
+#endif
+}
+
+static std::string hashWith(Transform transform, const uint8_t *message, size_t length) {
+    uint32_t state[8];
+    uint8_t last[2 * Hasher::BLOCK_SIZE], digest[Hasher::DIGEST_SIZE];
+    size_t blocks = length / Hasher::BLOCK_SIZE;
+
+    Hasher::init(state);
+    transform(state, message, blocks);
+    transform(state, last, Hasher::pad(message + blocks * Hasher::BLOCK_SIZE, length, last));
+    Hasher::revert(state, digest);
+    return Hasher::toString(digest);
+}
+
+/* Eight messages of the same length through the AVX2 lanes */
+static std::vector<std::string> hashLanes(const uint8_t * const *messages, size_t length) {
+    uint32_t states[Hasher::LANES][8];
+    uint8_t last[Hasher::LANES][2 * Hasher::BLOCK_SIZE];
+    const uint8_t *lanes[Hasher::LANES];
+    size_t blocks = length / Hasher::BLOCK_SIZE, padded = 0;
+
+    for (size_t lane = 0; lane < Hasher::LANES; lane++) {
+        Hasher::init(states[lane]);
+        lanes[lane] = messages[lane];
+        padded = Hasher::pad(messages[lane] + blocks * Hasher::BLOCK_SIZE, length, last[lane]);
+    }
+    Hasher::transformLanes(states, lanes, blocks);
+    for (size_t lane = 0; lane < Hasher::LANES; lane++) {
+        lanes[lane] = last[lane];
+    }
+    Hasher::transformLanes(states, lanes, padded);
+
+    std::vector<std::string> digests;
+    for (size_t lane = 0; lane < Hasher::LANES; lane++) {
+        uint8_t digest[Hasher::DIGEST_SIZE];
+        Hasher::revert(states[lane], digest);
+        digests.push_back(Hasher::toString(digest));
+    }
+    return digests;
+}
+
+int main() {
+    bool shaNi = cpuHas(7, 1, 29) && cpuHas(1, 2, 9) && cpuHas(1, 2, 19);
+    bool avx2 = cpuHasAvx2();
+    bool sse42 = Crc32c::hardware();
+    printf("  sha-ni %s, avx2 %s, sse4.2 %s, dispatch %s / %s\n", shaNi ? "yes" : "no", avx2 ? "yes" : "no",
+        sse42 ? "yes" : "no", Hasher::kernel(), Crc32c::kernel());
+
+    /* FIPS 180-2 vectors */
+    std::string million(1000000, 'a');
+    struct { std::string message; const char *digest; } vectors[] = {
+        { "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+        { "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+        { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 
+          "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+        { million, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+    };
+
+    for (size_t v = 0; v < sizeof(vectors) / sizeof(vectors[0]); v++) {
+        const uint8_t *message = (const uint8_t *)vectors[v].message.data();
+        size_t length = vectors[v].message.size();
+
+        Hasher hasher;
+        hasher.update(vectors[v].message);
+        uint8_t digest[Hasher::DIGEST_SIZE];
+        hasher.digest(digest);
+        check(Hasher::toString(digest) == vectors[v].digest, "sha256 dispatch");
+
+        check(hashWith(Hasher::transformPortable, message, length) == vectors[v].digest, "sha256 portable");
+        if (shaNi) {
+            check(hashWith(Hasher::transformShaNi, message, length) == vectors[v].digest, "sha256 sha-ni");
+        }
+        if (avx2) {
+            const uint8_t *messages[Hasher::LANES];
+            for (size_t lane = 0; lane < Hasher::LANES; lane++) {
+                messages[lane] = message;
+            }
+            std::vector<std::string> digests = hashLanes(messages, length);
+            for (size_t lane = 0; lane < Hasher::LANES; lane++) {
+                check(digests[lane] == vectors[v].digest, "sha256 avx2 lanes");
+            }
+        }
+    }
+
+    /* Different messages in every lane, and digestMany around the padding boundaries */
+    std::vector<uint8_t> data(70000);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (uint8_t)(i * 2654435761u >> 13);
+    }
+    size_t lengths[] = { 0, 1, 55, 56, 63, 64, 65, 119, 120, 4096 };
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        size_t length = lengths[l];
+        const uint8_t *messages[17];
+        for (size_t i = 0; i < 17; i++) {
+            messages[i] = data.data() + i * 3001;
+        }
+
+        if (avx2) {
+            std::vector<std::string> digests = hashLanes(messages, length);
+            for (size_t lane = 0; lane < Hasher::LANES; lane++) {
+                check(digests[lane] == hashWith(Hasher::transformPortable, messages[lane], length), "sha256 avx2 lanes apart");
+            }
+        }
+        if (shaNi) {
+            check(hashWith(Hasher::transformShaNi, messages[0], length) 
+                == hashWith(Hasher::transformPortable, messages[0], length), "sha256 sha-ni lengths");
+        }
+
+        for (size_t count = 1; count <= 17; count++) {
+            std::vector<uint8_t> hashes(count * Hasher::DIGEST_SIZE);
+            Hasher::digestMany(messages, length, count, hashes.data());
+            for (size_t i = 0; i < count; i++) {
+                check(Hasher::toString(&hashes[i * Hasher::DIGEST_SIZE]) 
+                    == hashWith(Hasher::transformPortable, messages[i], length), "sha256 digestMany");
+            }
+        }
+    }
+
+    /* RFC 3720 B.4 vectors, and the check value */
+    uint8_t zeros[32], ones[32], up[32], down[32];
+    for (int i = 0; i < 32; i++) {
+        zeros[i] = 0;
+        ones[i] = 0xff;
+        up[i] = i;
+        down[i] = 31 - i;
+    }
+    struct { const uint8_t *data; size_t length; uint32_t crc; } sums[] = {
+        { (const uint8_t *)"123456789", 9, 0xe3069283 },
+        { zeros, 32, 0x8a9136aa },
+        { ones, 32, 0x62a8ab43 },
+        { up, 32, 0x46dd794e },
+        { down, 32, 0x113fdb5c },
+        { zeros, 0, 0 },
+    };
+    for (size_t s = 0; s < sizeof(sums) / sizeof(sums[0]); s++) {
+        check(Crc32c::compute(sums[s].data, sums[s].length) == sums[s].crc, "crc32c dispatch");
+        check(Crc32c::updateSlicing(0, sums[s].data, sums[s].length) == sums[s].crc, "crc32c slicing");
+        if (sse42) {
+            check(Crc32c::updateSse42(0, sums[s].data, sums[s].length) == sums[s].crc, "crc32c sse4.2");
+        }
+    }
+
+    /* Both paths agree on every length and alignment, and when a sum is extended piece by piece */
+    for (size_t offset = 0; offset < 8; offset++) {
+        for (size_t length = 0; length < 300; length++) {
+            uint32_t slicing = Crc32c::updateSlicing(0, data.data() + offset, length);
+            if (sse42) {
+                check(Crc32c::updateSse42(0, data.data() + offset, length) == slicing, "crc32c sse4.2 lengths");
+            }
+
+            uint32_t split = Crc32c::update(0, data.data() + offset, length / 3);
+            split = Crc32c::update(split, data.data() + offset + length / 3, length - length / 3);
+            check(split == slicing, "crc32c update");
+        }
+    }
+
+    return failures ? 1 : 0;
+}
+EOF
+
+echo "Testing SHA-256 and CRC-32C kernels ..."
+if ! g++ -std=gnu++11 -Iinclude -o $WORKSPACE/kernels $WORKSPACE/kernels.cpp -Llib -lfs -pthread; then
+    echo "Failure: cannot build the test"
+    exit 1
+fi
+
+if $WORKSPACE/kernels; then
+    echo "Success"
+else
+    echo "Failure"
+    exit 1
+fi
@@ -0,0 +1,145 @@
+#!/bin/bash
+# Write a sparse file past 4 GiB on plain and deduplicated volumes, straddling the 32-bit
+# boundary, then read it back after a remount: data, holes, the 64-bit size and the end.
+
+WORKSPACE=$(mktemp -d)
+trap "rm -rf $WORKSPACE" EXIT
+
+cat > $WORKSPACE/large.cpp <<'EOF'
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/* write() and the inode are private, importing 4 GiB of holes would fill the image */
+#define private public
+#include "FileSystem/MyFS.h"
+#undef private
+
+static int failures = 0;
+
+static void check(bool passed, const char *what, const std::string &image) {
+    if (!passed) {
+        printf("  FAIL %s (%s)\n", what, image.c_str());
+        failures++;
+    }
+}
+
+/* Pieces of the file with data, the bytes between them are holes */
+struct Piece {
+    uint64_t offset;
+    std::vector<char> data;
+};
+
+static std::vector<char> readBack(MyFS &fs, size_t inumber, uint64_t offset, size_t length) {
+    std::vector<char> data(length);
+    size_t got = 0;
+    while (got < length) {
+        ssize_t n = fs.read(inumber, data.data() + got, (int)(length - got), offset + got);
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+    }
+    data.resize(got);
+    return data;
+}
+
+int main(int argc, char **argv) {
+    std::string workspace = argv[1];
+    srand(17);
+
+    const uint64_t GiB = 1ull << 30;
+    for (int kind = 0; kind < 2; kind++) {
+        bool dedup = kind == 1;
+        std::string image = workspace + (dedup ? "/dedup.img" : "/plain.img");
+
+        /* the start as extents, then a piece across 2^32 that turns the file into a tree */
+        std::vector<Piece> pieces(4);
+        uint64_t offsets[] = { 0, 4 * GiB - 1000, 4 * GiB + 70000, 5 * GiB + 123 };
+        size_t lengths[] = { 10000, 3000, 4096, 10000 };
+        for (size_t p = 0; p < pieces.size(); p++) {
+            pieces[p].offset = offsets[p];
+            pieces[p].data.resize(lengths[p]);
+            for (size_t k = 0; k < lengths[p]; k++) {
+                pieces[p].data[k] = rand();
+            }
+        }
+        uint64_t size = pieces.back().offset + pieces.back().data.size();
+
+        size_t baseline = 0;
+        size_t inumber = 0;
+        {
+            Volume volume;
+            volume.open(image.c_str(), 40000);
+            if (!MyFS::format(&volume, 4096, true, MetaBlock::NONE, dedup)) {
+                check(false, "format", image);
+                return 1;
+            }
+
+            MyFS fs;
+            fs.mount(&volume);
+            baseline = fs.freeBlocks.count();
+
+            std::string name = "big";
+            check(fs.touch(&name[0]), "touch", image);
+            inumber = fs.currentDir.table[fs.dirLookup(fs.currentDir, &name[0])].inumber;
+
+            for (size_t p = 0; p < pieces.size(); p++) {
+                ssize_t written = fs.write(inumber, pieces[p].data.data(), (int)pieces[p].data.size(), pieces[p].offset);
+                check(written == (ssize_t)pieces[p].data.size(), "write", image);
+            }
+
+            Inode node;
+            fs.loadInode(inumber, &node);
+            check((node.flags & Inode::TREE) && node.sizeHigh == 1 && node.fileSize() == size, "64-bit size", image);
+            fs.exit();
+        }
+
+        /* another volume object, so the size and every pointer block come from the image */
+        Volume volume;
+        volume.open(image.c_str(), 40000);
+        MyFS fs;
+        check(fs.mount(&volume), "remount", image);
+
+        Inode node;
+        fs.loadInode(inumber, &node);
+        check(node.fileSize() == size, "64-bit size after remount", image);
+
+        for (size_t p = 0; p < pieces.size(); p++) {
+            check(readBack(fs, inumber, pieces[p].offset, pieces[p].data.size()) == pieces[p].data, "data", image);
+        }
+
+        /* holes right after the data, far into the first 4 GiB and past 2^32 read as zeros */
+        uint64_t holes[] = { 10000, 2 * GiB + 5, 4 * GiB + 2000, 4 * GiB + 80000, 5 * GiB - 9000 };
+        for (size_t h = 0; h < sizeof(holes) / sizeof(holes[0]); h++) {
+            check(readBack(fs, inumber, holes[h], 8192) == std::vector<char>(8192, 0), "hole", image);
+        }
+
+        /* a read across the end stops there */
+        check(readBack(fs, inumber, size - 100, 4096).size() == 100, "read across the end", image);
+        check(readBack(fs, inumber, size, 4096).empty(), "read past the end", image);
+
+        std::string name = "big";
+        check(fs.rm(&name[0]), "rm", image);
+        check(fs.freeBlocks.count() == baseline, "blocks freed", image);
+        fs.exit();
+    }
+
+    return failures ? 1 : 0;
+}
+EOF
+
+echo "Testing files past 4 GiB ..."
+if ! g++ -std=gnu++11 -Iinclude -o $WORKSPACE/large $WORKSPACE/large.cpp -Llib -lfs -pthread; then
+    echo "Failure: cannot build the test"
+    exit 1
+fi
+
+if $WORKSPACE/large $WORKSPACE > $WORKSPACE/log 2>&1; then
+    echo "Success"
+else
+    grep FAIL $WORKSPACE/log
+    echo "Failure"
+    exit 1
+fi
@@ -0,0 +1,138 @@
+#!/bin/bash
+# Round trip data of every kind through LzCodec, and feed it corrupt, truncated and malformed streams.
+
+WORKSPACE=$(mktemp -d)
+trap "rm -rf $WORKSPACE" EXIT
+
+cat > $WORKSPACE/lz.cpp <<'EOF'
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Compression/LzCodec.h"
+
+static int failures = 0;
+
+static void check(bool passed, const char *what, size_t length) {
+    if (!passed) {
+        printf("  FAIL %s (%zu bytes)\n", what, length);
+        failures++;
+    }
+}
+
+/* Bytes past capacity are guarded, a decoder writing there is caught */
+static const size_t GUARD = 64;
+
+static size_t guardedDecompress(const std::vector<char> &stream, size_t length, std::vector<char> &target, size_t capacity) {
+    target.assign(capacity + GUARD, '\x5a');
+    size_t restored = LzCodec::decompress(stream.data(), length, target.data(), capacity);
+
+    for (size_t i = capacity; i < capacity + GUARD; i++) {
+        check(target[i] == '\x5a', "decompress writes past capacity", length);
+    }
+    check(restored <= capacity, "decompress restores more than capacity", length);
+    return restored;
+}
+
+static std::vector<char> sample(int kind, size_t length) {
+    std::vector<char> data(length);
+    std::string text;
+    for (size_t i = 0; i < length; i++) {
+        switch (kind) {
+        case 0: data[i] = rand(); break;             // incompressible
+        case 1: data[i] = 'a' + rand() % 3; break;   // few symbols
+        case 2: data[i] = 0; break;                  // one long run
+        case 3: data[i] = i % 251; break;            // period longer than a match
+        }
+    }
+
+    if (kind == 4) {
+        while (text.size() < length) {
+            char line[128];
+            snprintf(line, sizeof(line), "12:%02d:%02d INFO worker-%d request id=%d status=200\n", 
+                rand() % 60, rand() % 60, rand() % 8, rand());
+            text += line;
+        }
+        memcpy(data.data(), text.data(), length);
+    }
+    return data;
+}
+
+static void malformed(const char *what, const char *bytes, size_t length, size_t capacity) {
+    std::vector<char> stream(bytes, bytes + length), target;
+    check(guardedDecompress(stream, length, target, capacity) == 0, what, length);
+}
+
+int main() {
+    srand(7);
+    size_t lengths[] = { 1, 3, 4, 5, 15, 16, 19, 20, 255, 256, 4096, 65535, 65536, 65537, 200000 };
+
+    for (int kind = 0; kind < 5; kind++) {
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+            size_t length = lengths[l];
+            std::vector<char> data = sample(kind, length), target;
+            std::vector<char> stream(LzCodec::bound(length));
+
+            size_t packed = LzCodec::compress(data.data(), length, stream.data(), stream.size());
+            check(packed > 0 && packed <= LzCodec::bound(length), "compress within bound", length);
+
+            size_t restored = guardedDecompress(stream, packed, target, length);
+            check(restored == length && !memcmp(target.data(), data.data(), length), "round trip", length);
+
+            /* a stream compressed into too little room is refused, so is a target too small */
+            if (packed > 1) {
+                check(LzCodec::compress(data.data(), length, stream.data(), packed - 1) == 0, "compress past capacity", length);
+                packed = LzCodec::compress(data.data(), length, stream.data(), stream.size());
+            }
+            check(guardedDecompress(stream, packed, target, length - 1) == 0, "decompress past capacity", length);
+
+            /* cut short anywhere, a stream never restores the whole data */
+            for (int cut = 0; cut < 20 && packed > 1; cut++) {
+                size_t kept = rand() % packed;
+                restored = guardedDecompress(stream, kept, target, length);
+                check(restored < length, "truncated stream", length);
+            }
+
+            /* flipped bits either fail or decode to something that fits */
+            for (int flip = 0; flip < 50; flip++) {
+                std::vector<char> corrupt(stream.begin(), stream.begin() + packed);
+                corrupt[rand() % packed] ^= 1 << (rand() % 8);
+                guardedDecompress(corrupt, packed, target, length);
+            }
+        }
+    }
+
+    /* random bytes are never trusted past capacity */
+    for (int trial = 0; trial < 2000; trial++) {
+        size_t length = 1 + rand() % 300;
+        std::vector<char> noise = sample(0, length), target;
+        guardedDecompress(noise, length, target, rand() % 1000);
+    }
+
+    /* hand-built streams, each broken in one place */
+    malformed("literals past the stream", "\x50" "ab", 3, 100);
+    malformed("offset cut short", "\x10" "a" "\x01", 3, 100);
+    malformed("offset of zero", "\x10" "a" "\x00\x00", 4, 100);
+    malformed("offset before the data", "\x10" "a" "\x02\x00", 4, 100);
+    malformed("match past capacity", "\x1f" "a" "\x01\x00" "\xff\x10", 6, 100);
+    malformed("length extension cut short", "\xf0" "\xff\xff", 3, 1000);
+    malformed("literals past capacity", "\x50" "abcde", 6, 4);
+
+    return failures ? 1 : 0;
+}
+EOF
+
+echo "Testing LZ codec ..."
+if ! g++ -std=gnu++11 -Iinclude -o $WORKSPACE/lz $WORKSPACE/lz.cpp -Llib -lfs -pthread; then
+    echo "Failure: cannot build the test"
+    exit 1
+fi
+
+if $WORKSPACE/lz; then
+    echo "Success"
+else
+    echo "Failure"
+    exit 1
+fi
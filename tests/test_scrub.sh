@@ -0,0 +1,120 @@
+#!/bin/bash
+# Scrub a volume with a small cache while files are imported and removed on it,
+# write-backs of the cache must never be reported as corrupt blocks.
+
+WORKSPACE=$(mktemp -d)
+trap "rm -rf $WORKSPACE" EXIT
+
+cat > $WORKSPACE/scrub.cpp <<'EOF'
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <chrono>
+
+#include "FileSystem/MyFS.h"
+
+static void sample(const std::string &path, size_t length) {
+    FILE *stream = fopen(path.c_str(), "w");
+    for (size_t i = 0; i < length; i++) {
+        fputc(rand() % 7 ? rand() : 0, stream);
+    }
+    fclose(stream);
+}
+
+/* Wait for the scrub started last, then tell how many corrupt blocks it found */
+static uint64_t finish(MyFS &fs) {
+    while (fs.scrubStats().running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return fs.scrubStats().blocksCorrupt;
+}
+
+int main(int argc, char **argv) {
+    std::string workspace = argv[1];
+    std::string image = workspace + "/scrub.img";
+    srand(11);
+
+    for (int f = 0; f < 3; f++) {
+        sample(workspace + "/in" + std::to_string(f), 20000 + rand() % 300000);
+    }
+
+    /* 
+     * O_DIRECT, where the file system has it, keeps the scrub reads long enough for write-backs 
+     * to land in them. Deduplicated volumes map files by trees, whose pointer blocks go through 
+     * the cache in the middle of the data.
+     */
+    Volume volume;
+    VolumeOptions options;
+    options.direct = true;
+    volume.open(image.c_str(), 40000, options);
+    if (!MyFS::format(&volume, 1024, true, MetaBlock::NONE, true)) {
+        printf("  FAIL format\n");
+        return 1;
+    }
+
+    /* a few cached blocks, so imports evict dirty ones under the scrub all the time */
+    volume.setCacheSize(8);
+
+    MyFS fs;
+    if (!fs.mount(&volume)) {
+        printf("  FAIL mount\n");
+        return 1;
+    }
+
+    for (int d = 0; d < 4; d++) {
+        std::string directory = "d" + std::to_string(d);
+        fs.mkdir(&directory[0]);
+    }
+
+    uint64_t corrupt = 0;
+    int scrubs = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int round = 0; std::chrono::steady_clock::now() - begin < std::chrono::seconds(2); round++) {
+        if (!fs.scrubStats().running) {
+            corrupt += fs.scrubStats().blocksCorrupt;
+            scrubs += fs.scrub(1ull << 30);
+        }
+
+        /* files spread over directories, so their Inode and Directory Blocks take turns in the cache */
+        std::string directory = "d" + std::to_string(round % 4);
+        std::string name = "f" + std::to_string(round / 4 % 4);
+        std::string path = workspace + "/in" + std::to_string(round % 3);
+        std::string parent = "..";
+        fs.cd(&directory[0]);
+        fs.rm(&name[0]);
+        if (!fs.import(path.c_str(), &name[0])) {
+            printf("  FAIL import %s/%s\n", directory.c_str(), name.c_str());
+            return 1;
+        }
+        fs.cd(&parent[0]);
+    }
+    corrupt += finish(fs);
+
+    /* once quiet, the whole volume is checked again */
+    fs.flush();
+    scrubs += fs.scrub(1ull << 30);
+    corrupt += finish(fs);
+
+    printf("  %d scrubs, %lu corrupt blocks\n", scrubs, (unsigned long)corrupt);
+    fs.exit();
+    return corrupt == 0 && scrubs > 1 ? 0 : 1;
+}
+EOF
+
+echo "Testing scrub during imports ..."
+if ! g++ -std=gnu++11 -Iinclude -o $WORKSPACE/scrub $WORKSPACE/scrub.cpp -Llib -lfs -pthread; then
+    echo "Failure: cannot build the test"
+    exit 1
+fi
+
+# Imports and scrubs report every step, only the corrupt blocks and the count are kept
+if $WORKSPACE/scrub $WORKSPACE > $WORKSPACE/log 2>&1; then
+    tail -1 $WORKSPACE/log
+    echo "Success"
+else
+    grep -E "FAIL|Scrub: block" $WORKSPACE/log | head -20
+    tail -1 $WORKSPACE/log
+    echo "Failure"
+    exit 1
+fi
@@ -0,0 +1,166 @@
+#!/bin/bash
+# Import files whose block maps end right before and right after each level of the
+# single, double and triple indirect trees, then outport them again after a remount.
+
+WORKSPACE=$(mktemp -d)
+trap "rm -rf $WORKSPACE" EXIT
+
+cat > $WORKSPACE/tree.cpp <<'EOF'
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/* The tree roots are private, the shell never shows how a file is mapped */
+#define private public
+#include "FileSystem/MyFS.h"
+#undef private
+
+static int failures = 0;
+static std::string workspace;
+
+static void check(bool passed, const char *what, const std::string &file) {
+    if (!passed) {
+        printf("  FAIL %s (%s)\n", what, file.c_str());
+        failures++;
+    }
+}
+
+static std::vector<char> load(const std::string &path) {
+    std::vector<char> data;
+    FILE *stream = fopen(path.c_str(), "r");
+    if (stream) {
+        char buffer[65536];
+        for (size_t n; (n = fread(buffer, 1, sizeof(buffer), stream)) > 0; ) {
+            data.insert(data.end(), buffer, buffer + n);
+        }
+        fclose(stream);
+    }
+    return data;
+}
+
+static void store(const std::string &path, const std::vector<char> &data) {
+    FILE *stream = fopen(path.c_str(), "w");
+    fwrite(data.data(), 1, data.size(), stream);
+    fclose(stream);
+}
+
+static Inode inodeOf(MyFS &fs, const std::string &name) {
+    Inode node;
+    memset(&node, 0, sizeof(node));
+    int offset = fs.dirLookup(fs.currentDir, (char*)name.c_str());
+    if (offset >= 0) {
+        fs.loadInode(fs.currentDir.table[offset].inumber, &node);
+    }
+    return node;
+}
+
+static bool outportSame(MyFS &fs, const std::string &name, const std::vector<char> &expected) {
+    std::string path = workspace + "/out";
+    return fs.outport((char*)name.c_str(), path.c_str()) && load(path) == expected;
+}
+
+/* Five files fit a directory: the first ones go to d, the others back to the root */
+static void enter(MyFS &fs, size_t file) {
+    std::string up = "..", directory = "d";
+    if (file % 5 == 0) {
+        fs.cd(file ? &up[0] : &directory[0]);
+    }
+}
+
+int main(int argc, char **argv) {
+    workspace = argv[1];
+    srand(9);
+
+    for (int kind = 0; kind < 2; kind++) {
+        bool compressed = kind == 1;
+        std::string image = workspace + (compressed ? "/lz.img" : "/dedup.img");
+
+        /* 
+         * Tree slots hold one block each with deduplication, and a cluster takes two slots with 
+         * compression. Sizes end a slot before and a slot after the direct pointers, the single 
+         * and the double indirect trees of 512-byte blocks, which take 128 pointers.
+         **/
+        size_t unit = compressed ? Config::COMPRESSION_CLUSTER : 512;
+        size_t perSlot = compressed ? 2 : 1;
+        size_t levels[] = { 2, 2 + 128, 2 + 128 + 128 * 128 };
+        std::vector<size_t> sizes;
+        for (int level = 0; level < (compressed ? 2 : 3); level++) {
+            sizes.push_back(levels[level] / perSlot * unit);
+            sizes.push_back(levels[level] / perSlot * unit + 1);
+        }
+
+        std::vector<std::vector<char> > contents;
+        size_t baseline = 0;
+        {
+            Volume volume;
+            volume.open(image.c_str(), 60000);
+            if (!MyFS::format(&volume, 512, true, compressed ? MetaBlock::LZ : MetaBlock::NONE, !compressed)) {
+                check(false, "format", image);
+                return 1;
+            }
+
+            MyFS fs;
+            fs.mount(&volume);
+            baseline = fs.freeBlocks.count();
+
+            std::string directory = "d";
+            check(fs.mkdir(&directory[0]), "mkdir", directory);
+
+            for (size_t i = 0; i < sizes.size(); i++) {
+                std::string name = "f" + std::to_string(i);
+                std::vector<char> data(sizes[i]);
+                for (size_t k = 0; k < data.size(); k++) {
+                    data[k] = compressed ? 'a' + rand() % 8 : rand();
+                }
+                contents.push_back(data);
+                store(workspace + "/in", data);
+
+                enter(fs, i);
+                check(fs.import((workspace + "/in").c_str(), (char*)name.c_str()), "import", name);
+
+                Inode node = inodeOf(fs, name);
+                size_t slots = (sizes[i] + unit - 1) / unit * perSlot;
+                check((node.flags & Inode::TREE) && node.fileSize() == sizes[i], "tree-mapped size", name);
+                for (int level = 0; level < 3; level++) {
+                    check((node.treeRoots[level] != 0) == (slots > levels[level]), "tree depth", name);
+                }
+            }
+            fs.exit();
+        }
+
+        /* another volume object, so every pointer block comes from the image */
+        Volume volume;
+        volume.open(image.c_str(), 60000);
+        MyFS fs;
+        check(fs.mount(&volume), "remount", image);
+        for (size_t i = 0; i < sizes.size(); i++) {
+            std::string name = "f" + std::to_string(i);
+            enter(fs, i);
+            check(outportSame(fs, name, contents[i]), "outport after remount", name);
+            check(fs.rm((char*)name.c_str()), "rm", name);
+        }
+
+        /* every level of pointer blocks is freed with the data */
+        check(fs.freeBlocks.count() == baseline, "blocks freed", image);
+        fs.exit();
+    }
+
+    return failures ? 1 : 0;
+}
+EOF
+
+echo "Testing indirect trees ..."
+if ! g++ -std=gnu++11 -Iinclude -o $WORKSPACE/tree $WORKSPACE/tree.cpp -Llib -lfs -pthread; then
+    echo "Failure: cannot build the test"
+    exit 1
+fi
+
+# Imports report every copy, only the failures are kept
+if $WORKSPACE/tree $WORKSPACE > $WORKSPACE/log 2>&1; then
+    echo "Success"
+else
+    grep FAIL $WORKSPACE/log
+    echo "Failure"
+    exit 1
+fi